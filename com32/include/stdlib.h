@@ -40,6 +40,7 @@ __extern __mallocfunc void *malloc(size_t);
 __extern __mallocfunc void *zalloc(size_t);
 __extern __mallocfunc void *calloc(size_t, size_t);
 __extern __mallocfunc void *realloc(void *, size_t);
+__extern void *malloc_at(void *, size_t);
 __extern long strtol(const char *, char **, int);
 __extern long long strtoll(const char *, char **, int);
 __extern unsigned long strtoul(const char *, char **, int);
@@ -52,6 +53,8 @@ __extern int unsetenv(const char *);
 
 __extern void qsort(void *, size_t, size_t,
 		    int (*)(const void *, const void *));
+__extern int mergesort(void *, size_t, size_t,
+		      int (*)(const void *, const void *));
 
 __extern long jrand48(unsigned short *);
 __extern long mrand48(void);
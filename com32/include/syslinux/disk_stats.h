@@ -0,0 +1,79 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2026 The Syslinux Authors - All Rights Reserved
+ *
+ *   Permission is hereby granted, free of charge, to any person
+ *   obtaining a copy of this software and associated documentation
+ *   files (the "Software"), to deal in the Software without
+ *   restriction, including without limitation the rights to use,
+ *   copy, modify, merge, publish, distribute, sublicense, and/or
+ *   sell copies of the Software, and to permit persons to whom
+ *   the Software is furnished to do so, subject to the following
+ *   conditions:
+ *
+ *   The above copyright notice and this permission notice shall
+ *   be included in all copies or substantial portions of the Software.
+ *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *   OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ *   HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ *   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ *   OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * syslinux/disk_stats.h
+ *
+ * Disk I/O and block cache statistics; shared between the core and COM32
+ */
+
+#ifndef _SYSLINUX_DISK_STATS_H
+#define _SYSLINUX_DISK_STATS_H
+
+#include <stdint.h>
+
+/*
+ * Statistics as returned by INT 22h AX=0026h.
+ * Add new members only at the end; this is an ABI.
+ */
+struct disk_io_stats {
+    uint32_t calls;		/* INT 13h read/write calls */
+    uint32_t sectors;		/* Sectors transferred */
+    uint32_t errors;		/* Calls that returned an error */
+    uint32_t resets;		/* Disk resets after repeated errors */
+    uint32_t downgrades;	/* Times maxtransfer had to be lowered */
+    uint32_t chs_fallbacks;	/* EBIOS failed and CHS was used instead */
+    uint32_t bounces;		/* Transfers through the bounce buffer */
+    uint32_t bounce_bytes;	/* Bytes copied to/from the bounce buffer */
+    uint32_t flat;		/* Transfers with EDD 3.0 64-bit buffers */
+    uint32_t time_total;	/* Time spent in INT 13h, ms (~55 ms clock) */
+};
+
+struct disk_cache_stats {
+    uint32_t block_size;	/* Cache block size, bytes */
+    uint32_t entries;		/* Number of blocks in the cache */
+    uint32_t lookups;		/* get_cache() calls */
+    uint32_t hits;		/* ... that found the block cached */
+    uint32_t fills;		/* Disk requests issued by the cache */
+    uint32_t blocks_read;	/* Blocks read, including read-ahead */
+    uint32_t readahead;		/* Blocks read ahead of a miss */
+    uint32_t evictions;		/* Valid blocks dropped to make room */
+};
+
+struct disk_stats {
+    uint32_t disk_number;	/* BIOS drive number */
+    uint32_t ebios;		/* EBIOS is being used */
+    uint32_t sector_size;
+    uint32_t maxtransfer;	/* Current sectors per transfer limit */
+    struct disk_io_stats io;
+    struct disk_cache_stats cache;
+};
+
+/* COM32 library call; returns 0 on success, -1 if not available */
+int syslinux_disk_stats(struct disk_stats *stats);
+
+#endif /* _SYSLINUX_DISK_STATS_H */
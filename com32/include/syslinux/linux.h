@@ -51,8 +51,15 @@ struct initramfs {
 };
 #define INITRAMFS_MAX_ALIGN	4096
 
+/* How much of the kernel syslinux_linux_initramfs_addr() looks at */
+#define LINUX_HEADER_SIZE	1024
+
 int syslinux_boot_linux(void *kernel_buf, size_t kernel_size,
 			struct initramfs *initramfs, char *cmdline);
+void *syslinux_linux_initramfs_addr(const void *kernel_buf,
+				    size_t kernel_size,
+				    struct initramfs *initramfs,
+				    const char *cmdline);
 
 /* Initramfs manipulation functions */
 
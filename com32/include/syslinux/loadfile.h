@@ -10,6 +10,13 @@
 
 int loadfile(const char *, void **, size_t *);
 int zloadfile(const char *, void **, size_t *);
+int zloadfile_formats(const char *, void **, size_t *, unsigned int);
 int floadfile(FILE *, void **, size_t *, const void *, size_t);
+int loadfiles(const char **, void **, size_t *, int);
+
+/* Fill in where each of count files of the given sizes goes; 0 if done */
+typedef int (*loadfiles_place_t)(void *, void **, const size_t *, int);
+int loadfiles_placed(const char **, void **, size_t *, int,
+		     loadfiles_place_t, void *);
 
 #endif
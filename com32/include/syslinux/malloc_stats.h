@@ -0,0 +1,78 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2026 The Syslinux Authors - All Rights Reserved
+ *
+ *   Permission is hereby granted, free of charge, to any person
+ *   obtaining a copy of this software and associated documentation
+ *   files (the "Software"), to deal in the Software without
+ *   restriction, including without limitation the rights to use,
+ *   copy, modify, merge, publish, distribute, sublicense, and/or
+ *   sell copies of the Software, and to permit persons to whom
+ *   the Software is furnished to do so, subject to the following
+ *   conditions:
+ *
+ *   The above copyright notice and this permission notice shall
+ *   be included in all copies or substantial portions of the Software.
+ *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *   OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ *   HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ *   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ *   OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * syslinux/malloc_stats.h
+ *
+ * Core memory allocator statistics; shared between the core and COM32
+ */
+
+#ifndef _SYSLINUX_MALLOC_STATS_H
+#define _SYSLINUX_MALLOC_STATS_H
+
+#include <stdint.h>
+
+/*
+ * The core tags each allocation with its owner: 0 is free memory,
+ * 1 the list heads, 2 the core itself and 3 COM32 modules (through
+ * cs_pm->lmalloc()).
+ */
+#define MALLOC_STATS_TAGS	4
+
+/* The main heap, and the low memory heap for lmalloc() */
+#define MALLOC_STATS_HEAPS	2
+
+/*
+ * Statistics as returned by INT 22h AX=0027h.
+ * Add new members only at the end; this is an ABI.
+ */
+struct malloc_tag_stats {
+    uint32_t allocs;		/* Successful allocations */
+    uint32_t frees;
+    uint32_t failures;		/* Allocations that found no room */
+    uint32_t blocks;		/* Blocks in use now */
+    uint32_t bytes;		/* Bytes in use now, including headers */
+    uint32_t peak_bytes;	/* Most bytes ever in use at once */
+};
+
+struct malloc_heap_stats {
+    uint32_t free_blocks;
+    uint32_t free_bytes;
+    uint32_t largest_free;	/* Largest free block, bytes */
+    uint32_t exact_hits;	/* Allocations that found an exact fit */
+    uint32_t bin_searches;	/* Blocks looked at that were too small */
+};
+
+struct malloc_stats {
+    struct malloc_tag_stats tag[MALLOC_STATS_TAGS];
+    struct malloc_heap_stats heap[MALLOC_STATS_HEAPS];
+};
+
+/* COM32 library call; returns 0 on success, -1 if not available */
+int syslinux_malloc_stats(struct malloc_stats *stats);
+
+#endif /* _SYSLINUX_MALLOC_STATS_H */
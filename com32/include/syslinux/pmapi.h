@@ -51,6 +51,13 @@ struct com32_filedata {
     uint16_t handle;		/* File handle */
 };
 
+struct com32_readfile {
+    uint16_t handle;		/* File handle, 0 once the file hit EOF */
+    void *buf;			/* Destination buffer */
+    size_t size;		/* Buffer size, a multiple of the block size */
+    size_t bytes;		/* Bytes read so far */
+};
+
 struct com32_pmapi {
     size_t __pmapi_size;
 
@@ -74,6 +81,8 @@ struct com32_pmapi {
     /* Should be "const volatile", but gcc miscompiles that sometimes */
     volatile uint32_t *jiffies;
     volatile uint32_t *ms_timer;
+
+    int (*read_files)(struct com32_readfile *, int);
 };
 
 #endif /* _SYSLINUX_PMAPI_H */
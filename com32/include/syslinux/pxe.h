@@ -35,10 +35,12 @@
 #define _SYSLINUX_PXE_H
 
 #include <syslinux/pxe_api.h>
+#include <syslinux/pxe_stats.h>
 
 /* SYSLINUX-defined PXE utility functions */
 int pxe_get_cached_info(int level, void **buf, size_t *len);
 int pxe_get_nic_type(t_PXENV_UNDI_GET_NIC_TYPE * gnt);
 uint32_t pxe_dns(const char *hostname);
+int pxe_get_net_stats(struct pxe_net_stats *stats);
 
 #endif /* _SYSLINUX_PXE_H */
@@ -0,0 +1,59 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2026 The Syslinux Authors - All Rights Reserved
+ *
+ *   Permission is hereby granted, free of charge, to any person
+ *   obtaining a copy of this software and associated documentation
+ *   files (the "Software"), to deal in the Software without
+ *   restriction, including without limitation the rights to use,
+ *   copy, modify, merge, publish, distribute, sublicense, and/or
+ *   sell copies of the Software, and to permit persons to whom
+ *   the Software is furnished to do so, subject to the following
+ *   conditions:
+ *
+ *   The above copyright notice and this permission notice shall
+ *   be included in all copies or substantial portions of the Software.
+ *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *   OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ *   HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ *   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ *   OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * syslinux/pxe_stats.h
+ *
+ * PXELINUX network statistics; shared between the core and COM32
+ */
+
+#ifndef _SYSLINUX_PXE_STATS_H
+#define _SYSLINUX_PXE_STATS_H
+
+#include <stdint.h>
+
+/*
+ * Network transfer statistics, as returned by INT 22h AX=0025h.
+ * Add new members only at the end; this is an ABI.
+ */
+struct pxe_xfer_stats {
+    uint32_t packets;		/* Good packets received */
+    uint32_t retransmits;	/* Requests sent again after a timeout */
+    uint32_t duplicates;	/* Duplicate or out of sequence packets */
+    uint32_t rtt_samples;	/* Number of round trip time samples */
+    uint32_t rtt_total;		/* Sum of the samples, ms */
+    uint32_t srtt;		/* Smoothed round trip time, ms */
+    uint32_t rto;		/* Retransmit timeout, ms */
+};
+
+struct pxe_net_stats {
+    struct pxe_xfer_stats last;	/* The most recently closed TFTP file */
+    struct pxe_xfer_stats tftp;	/* All TFTP transfers */
+    struct pxe_xfer_stats dns;	/* All DNS queries */
+};
+
+#endif /* _SYSLINUX_PXE_STATS_H */
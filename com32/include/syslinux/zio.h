@@ -7,7 +7,18 @@
 
 #include <stdio.h>
 
+/*
+ * Formats zopen_formats() may unpack.  zopen() only unpacks gzip, so
+ * that callers which hand the data on, like mboot.c32 with multiboot
+ * modules, don't start unpacking files the OS expects to do itself.
+ */
+#define ZIO_GZIP	0x0001
+#define ZIO_LZ4		0x0002
+#define ZIO_ZSTD	0x0004
+#define ZIO_ALL		(ZIO_GZIP | ZIO_LZ4 | ZIO_ZSTD)
+
 int zopen(const char *, int, ...);
+int zopen_formats(const char *, int, unsigned int);
 FILE *zfopen(const char *, const char *);
 
 #endif /* _SYSLINUX_ZIO_H */
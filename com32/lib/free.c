@@ -16,6 +16,7 @@ static struct free_arena_header *__free_block(struct free_arena_header *ah)
     if (pah->a.type == ARENA_TYPE_FREE &&
 	(char *)pah + pah->a.size == (char *)ah) {
 	/* Coalesce into the previous block */
+	__malloc_bin_remove(pah);
 	pah->a.size += ah->a.size;
 	pah->a.next = nah;
 	nah->a.prev = pah;
@@ -27,13 +28,7 @@ static struct free_arena_header *__free_block(struct free_arena_header *ah)
 	ah = pah;
 	pah = ah->a.prev;
     } else {
-	/* Need to add this block to the free chain */
 	ah->a.type = ARENA_TYPE_FREE;
-
-	ah->next_free = __malloc_head.next_free;
-	ah->prev_free = &__malloc_head;
-	__malloc_head.next_free = ah;
-	ah->next_free->prev_free = ah;
     }
 
     /* In either of the previous cases, we might be able to merge
@@ -43,8 +38,7 @@ static struct free_arena_header *__free_block(struct free_arena_header *ah)
 	ah->a.size += nah->a.size;
 
 	/* Remove the old block from the chains */
-	nah->next_free->prev_free = nah->prev_free;
-	nah->prev_free->next_free = nah->next_free;
+	__malloc_bin_remove(nah);
 	ah->a.next = nah->a.next;
 	nah->a.next->a.prev = ah;
 
@@ -53,6 +47,9 @@ static struct free_arena_header *__free_block(struct free_arena_header *ah)
 #endif
     }
 
+    /* Now that we know its final size, put it on the right free list */
+    __malloc_bin_insert(ah);
+
     /* Return the block that contains the called block */
     return ah;
 }
@@ -22,6 +22,59 @@ struct free_arena_header __malloc_head = {
     &__malloc_head
 };
 
+/* Set up by init_memory_arena(); malloc() fails before then */
+struct malloc_bins __malloc_bins;
+
+unsigned int __malloc_bin(size_t size)
+{
+    unsigned int bin;
+
+    if (size <= MALLOC_SMALL_MAX)
+	return size / sizeof(struct arena_header) - 2;
+
+    bin = MALLOC_SMALL_BINS + __builtin_clz(MALLOC_SMALL_MAX)
+	- __builtin_clz(size - 1);
+    return bin < MALLOC_BINS ? bin : MALLOC_BINS - 1;
+}
+
+static void __malloc_bin_link(struct free_arena_header *fp,
+			      struct free_arena_header *prev)
+{
+    fp->next_free = prev->next_free;
+    fp->prev_free = prev;
+    prev->next_free->prev_free = fp;
+    prev->next_free = fp;
+}
+
+/* Put a free block at the front of its list */
+void __malloc_bin_insert(struct free_arena_header *fp)
+{
+    unsigned int bin = __malloc_bin(fp->a.size);
+
+    __malloc_bin_link(fp, &__malloc_bins.bin[bin]);
+    __malloc_bins.map |= 1 << bin;
+}
+
+/* Put a free block at the back of its list, so it is used last */
+void __malloc_bin_append(struct free_arena_header *fp)
+{
+    unsigned int bin = __malloc_bin(fp->a.size);
+
+    __malloc_bin_link(fp, __malloc_bins.bin[bin].prev_free);
+    __malloc_bins.map |= 1 << bin;
+}
+
+/* This must be called before the size of the block changes */
+void __malloc_bin_remove(struct free_arena_header *fp)
+{
+    fp->next_free->prev_free = fp->prev_free;
+    fp->prev_free->next_free = fp->next_free;
+
+    /* Both neighbours are the list head if the list is now empty */
+    if (fp->next_free == fp->prev_free)
+	__malloc_bins.map &= ~(1 << __malloc_bin(fp->a.size));
+}
+
 /* This is extern so it can be overridden by the user application */
 extern size_t __stack_size;
 extern void *__mem_end;		/* Produced after argv parsing */
@@ -70,6 +123,13 @@ static void __constructor init_memory_arena(void)
 {
     struct free_arena_header *fp;
     size_t start, total_space;
+    int i;
+
+    for (i = 0; i < MALLOC_BINS; i++) {
+	fp = &__malloc_bins.bin[i];
+	fp->a.type = ARENA_TYPE_HEAD;
+	fp->a.next = fp->a.prev = fp->next_free = fp->prev_free = fp;
+    }
 
     start = (size_t) ARENA_ALIGN_UP(__mem_end);
     total_space = sp() - start;
@@ -98,6 +158,7 @@ static void *__malloc_from_block(struct free_arena_header *fp, size_t size)
     struct free_arena_header *nfp, *na;
 
     fsize = fp->a.size;
+    __malloc_bin_remove(fp);
 
     /* We need the 2* to account for the larger requirements of a free block */
     if (fsize >= size + 2 * sizeof(struct arena_header)) {
@@ -116,18 +177,11 @@ static void *__malloc_from_block(struct free_arena_header *fp, size_t size)
 	na->a.prev = nfp;
 	fp->a.next = nfp;
 
-	/* Replace current block on free chain */
-	nfp->next_free = fp->next_free;
-	nfp->prev_free = fp->prev_free;
-	fp->next_free->prev_free = nfp;
-	fp->prev_free->next_free = nfp;
+	/* The rest goes back on the free lists */
+	__malloc_bin_insert(nfp);
     } else {
 	/* Allocate the whole block */
 	fp->a.type = ARENA_TYPE_USED;
-
-	/* Remove from free chain */
-	fp->next_free->prev_free = fp->prev_free;
-	fp->prev_free->next_free = fp->next_free;
     }
 
     return (void *)(&fp->a + 1);
@@ -135,7 +189,9 @@ static void *__malloc_from_block(struct free_arena_header *fp, size_t size)
 
 void *malloc(size_t size)
 {
-    struct free_arena_header *fp;
+    struct free_arena_header *fp, *head;
+    unsigned int bin;
+    uint32_t map;
 
     if (size == 0)
 	return NULL;
@@ -143,14 +199,80 @@ void *malloc(size_t size)
     /* Add the obligatory arena header, and round up */
     size = (size + 2 * sizeof(struct arena_header) - 1) & ARENA_SIZE_MASK;
 
-    for (fp = __malloc_head.next_free; fp->a.type != ARENA_TYPE_HEAD;
-	 fp = fp->next_free) {
-	if (fp->a.size >= size) {
-	    /* Found fit -- allocate out of this block */
-	    return __malloc_from_block(fp, size);
+    bin = __malloc_bin(size);
+    map = __malloc_bins.map & ~((1 << bin) - 1);
+
+    if (bin >= MALLOC_SMALL_BINS && (map & (1 << bin))) {
+	/* Our own bin may hold blocks that are too small */
+	head = &__malloc_bins.bin[bin];
+	for (fp = head->next_free; fp != head; fp = fp->next_free) {
+	    if (fp->a.size >= size)
+		return __malloc_from_block(fp, size);
 	}
+	map &= ~(1 << bin);
+    }
+
+    if (map) {
+	/* Anything in the first non-empty bin from here on fits */
+	fp = __malloc_bins.bin[__builtin_ctz(map)].next_free;
+	return __malloc_from_block(fp, size);
     }
 
     /* Nothing found... need to request a block from the kernel */
     return NULL;		/* No kernel to get stuff from */
 }
+
+/*
+ * Allocate _size_ bytes at exactly _ptr_, which must be aligned like
+ * any malloc() result.  This is for loading things where they will end
+ * up anyway; returns NULL if that memory isn't free.
+ */
+void *malloc_at(void *ptr, size_t size)
+{
+    struct free_arena_header *fp, *nfp;
+    char *start = (char *)((struct arena_header *)ptr - 1);
+    size_t head;
+
+    if (size == 0 || ARENA_ALIGN_DOWN(ptr) != ptr)
+	return NULL;
+
+    size = (size + 2 * sizeof(struct arena_header) - 1) & ARENA_SIZE_MASK;
+
+    /* The block chain is in address order */
+    for (fp = __malloc_head.a.next; fp->a.type != ARENA_TYPE_HEAD;
+	 fp = fp->a.next) {
+	if ((char *)fp > start)
+	    return NULL;
+	if (fp->a.type == ARENA_TYPE_FREE &&
+	    start - (char *)fp + size <= fp->a.size)
+	    break;
+    }
+    if (fp->a.type == ARENA_TYPE_HEAD)
+	return NULL;
+
+    head = start - (char *)fp;
+    if (head) {
+	/* The part in front has to remain a valid free block */
+	if (head < sizeof(struct free_arena_header))
+	    return NULL;
+
+	/* Split off the front, and put both parts on the free lists */
+	__malloc_bin_remove(fp);
+	nfp = (struct free_arena_header *)start;
+	nfp->a.type = ARENA_TYPE_FREE;
+	nfp->a.size = fp->a.size - head;
+	fp->a.size = head;
+
+	nfp->a.prev = fp;
+	nfp->a.next = fp->a.next;
+	fp->a.next->a.prev = nfp;
+	fp->a.next = nfp;
+
+	__malloc_bin_insert(fp);
+	__malloc_bin_insert(nfp);
+
+	fp = nfp;
+    }
+
+    return __malloc_from_block(fp, size);
+}
@@ -51,5 +51,26 @@ struct free_arena_header {
     struct free_arena_header *next_free, *prev_free;
 };
 
+/*
+ * Free blocks are kept on lists ("bins") by size, like in the core:
+ * one list per size up to MALLOC_SMALL_MAX, then one per power of two.
+ * map has a bit set for each non-empty list.
+ */
+#define MALLOC_BINS		32
+#define MALLOC_SMALL_BINS	15
+#define MALLOC_SMALL_MAX	((MALLOC_SMALL_BINS + 1) * \
+				 sizeof(struct arena_header))
+
+struct malloc_bins {
+    uint32_t map;		/* Bit n set if bin[n] is non-empty */
+    struct free_arena_header bin[MALLOC_BINS];
+};
+
 extern struct free_arena_header __malloc_head;
+extern struct malloc_bins __malloc_bins;
+
 void __inject_free_block(struct free_arena_header *ah);
+unsigned int __malloc_bin(size_t size);
+void __malloc_bin_insert(struct free_arena_header *fp);
+void __malloc_bin_append(struct free_arena_header *fp);
+void __malloc_bin_remove(struct free_arena_header *fp);
@@ -1,46 +1,452 @@
 /*
  * qsort.c
  *
- * This is actually combsort.  It's an O(n log n) algorithm with
- * simplicity/small code size being its main virtue.
+ * qsort() is an introsort: quicksort with a median-of-three pivot,
+ * which switches to heapsort if the partitioning goes badly enough
+ * that it would otherwise turn quadratic, and leaves short ranges to
+ * a final insertion sort.
+ *
+ * mergesort() is the BSD stable sort; it needs a temporary buffer of
+ * half the array, and returns -1 if that can't be allocated.  Runs
+ * which are already in order cost one comparison to merge, so sorted
+ * or nearly sorted input is close to linear.
+ *
+ * Element swaps are done a long at a time when the array and the
+ * element size allow it, since the common case is an array of
+ * pointers.
  */
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+
+/* Ranges this short are handled by insertion sort */
+#define SORT_SHORT	8
+
+struct sort {
+    size_t size;
+    int (*compar) (const void *, const void *);
+    int words;			/* Elements are an integral number of longs */
+};
+
+static void sort_init(struct sort *s, const void *base, size_t size,
+		      int (*compar) (const void *, const void *))
+{
+    s->size = size;
+    s->compar = compar;
+    s->words = (((uintptr_t) base | size) & (sizeof(long) - 1)) == 0;
+}
+
+static void swap(const struct sort *s, char *a, char *b)
+{
+    size_t n;
+
+    if (s->words) {
+	long *p = (long *)a, *q = (long *)b, t;
+
+	for (n = s->size / sizeof(long); n; n--) {
+	    t = *p;
+	    *p++ = *q;
+	    *q++ = t;
+	}
+    } else {
+	char t;
+
+	for (n = s->size; n; n--) {
+	    t = *a;
+	    *a++ = *b;
+	    *b++ = t;
+	}
+    }
+}
+
+/* Stable, so also usable by mergesort() */
+static void insertion_sort(const struct sort *s, char *base, size_t nmemb)
+{
+    char *end = base + nmemb * s->size;
+    char *p, *q;
+
+    for (p = base + s->size; p < end; p += s->size) {
+	for (q = p; q > base && s->compar(q - s->size, q) > 0; q -= s->size)
+	    swap(s, q - s->size, q);
+    }
+}
+
+static void sift_down(const struct sort *s, char *base, size_t root,
+		      size_t nmemb)
+{
+    size_t child;
+    char *r, *c;
+
+    while ((child = 2 * root + 1) < nmemb) {
+	c = base + child * s->size;
+	if (child + 1 < nmemb && s->compar(c, c + s->size) < 0) {
+	    child++;
+	    c += s->size;
+	}
+	r = base + root * s->size;
+	if (s->compar(r, c) >= 0)
+	    break;
+	swap(s, r, c);
+	root = child;
+    }
+}
+
+static void heap_sort(const struct sort *s, char *base, size_t nmemb)
+{
+    size_t i;
+
+    for (i = nmemb / 2; i--;)
+	sift_down(s, base, i, nmemb);
 
-static inline size_t newgap(size_t gap)
+    for (i = nmemb; --i;) {
+	swap(s, base, base + i * s->size);
+	sift_down(s, base, 0, i);
+    }
+}
+
+/*
+ * Partition around the median of the first, middle and last
+ * elements, then recurse into the smaller part and loop on the
+ * larger one, so the stack stays O(log n) deep.  Short ranges are
+ * left alone for the insertion sort pass in qsort().
+ */
+static void intro_sort(const struct sort *s, char *base, size_t nmemb,
+		       int depth)
 {
-    gap = (gap * 10) / 13;
-    if (gap == 9 || gap == 10)
-	gap = 11;
+    size_t size = s->size;
+    size_t nl, nr;
+    char *lo, *mid, *hi, *i, *j;
+
+    while (nmemb > SORT_SHORT) {
+	if (!depth--) {
+	    heap_sort(s, base, nmemb);
+	    return;
+	}
+
+	lo = base;
+	mid = base + (nmemb / 2) * size;
+	hi = base + (nmemb - 1) * size;
 
-    if (gap < 1)
-	gap = 1;
-    return gap;
+	if (s->compar(mid, lo) < 0)
+	    swap(s, mid, lo);
+	if (s->compar(hi, mid) < 0) {
+	    swap(s, hi, mid);
+	    if (s->compar(mid, lo) < 0)
+		swap(s, mid, lo);
+	}
+
+	/*
+	 * Park the pivot at the bottom.  *hi is now >= the pivot, which
+	 * stops the first upward scan; the pivot itself stops the
+	 * downward ones.  Both scans stop on elements equal to the
+	 * pivot, which keeps the split even when there are many.
+	 */
+	swap(s, lo, mid);
+	i = lo;
+	j = hi + size;
+	for (;;) {
+	    do
+		i += size;
+	    while (s->compar(i, lo) < 0);
+	    do
+		j -= size;
+	    while (s->compar(lo, j) < 0);
+	    if (i >= j)
+		break;
+	    swap(s, i, j);
+	}
+	swap(s, lo, j);
+
+	nl = (j - base) / size;
+	nr = nmemb - nl - 1;
+	if (nl < nr) {
+	    intro_sort(s, base, nl, depth);
+	    base = j + size;
+	    nmemb = nr;
+	} else {
+	    intro_sort(s, j + size, nr, depth);
+	    nmemb = nl;
+	}
+    }
 }
 
 void qsort(void *base, size_t nmemb, size_t size,
 	   int (*compar) (const void *, const void *))
 {
-    size_t gap = nmemb;
-    size_t i, j;
-    char *p1, *p2;
+    struct sort s;
+    size_t n;
+    int depth = 0;
+
+    if (nmemb < 2 || !size)
+	return;
+
+    sort_init(&s, base, size, compar);
+
+    for (n = nmemb; n > 1; n >>= 1)
+	depth += 2;
+
+    intro_sort(&s, base, nmemb, depth);
+    insertion_sort(&s, base, nmemb);
+}
+
+static void merge_sort(const struct sort *s, char *base, size_t nmemb,
+		       char *tmp)
+{
+    size_t size = s->size;
+    size_t nl = nmemb / 2;
+    char *right = base + nl * size;
+    char *end = base + nmemb * size;
+    char *a, *ae, *b, *d;
+
+    if (nmemb <= SORT_SHORT) {
+	insertion_sort(s, base, nmemb);
+	return;
+    }
+
+    merge_sort(s, base, nl, tmp);
+    merge_sort(s, right, nmemb - nl, tmp);
+
+    /* Already in order? */
+    if (s->compar(right - size, right) <= 0)
+	return;
+
+    /* Take equal elements from the left half first, to stay stable */
+    memcpy(tmp, base, nl * size);
+    a = tmp;
+    ae = tmp + nl * size;
+    b = right;
+    d = base;
+    while (a < ae && b < end) {
+	if (s->compar(b, a) < 0) {
+	    memcpy(d, b, size);
+	    b += size;
+	} else {
+	    memcpy(d, a, size);
+	    a += size;
+	}
+	d += size;
+    }
+
+    /* Whatever is left of the right half is already in place */
+    memcpy(d, a, ae - a);
+}
+
+int mergesort(void *base, size_t nmemb, size_t size,
+	      int (*compar) (const void *, const void *))
+{
+    struct sort s;
+    char *tmp;
+
+    if (nmemb < 2 || !size)
+	return 0;
+
+    if (nmemb / 2 > (size_t)-1 / size) {
+	errno = ENOMEM;
+	return -1;
+    }
+
+    tmp = malloc((nmemb / 2) * size);
+    if (!tmp) {
+	errno = ENOMEM;
+	return -1;
+    }
+
+    sort_init(&s, base, size, compar);
+    merge_sort(&s, base, nmemb, tmp);
+
+    free(tmp);
+    return 0;
+}
+
+#ifdef TEST
+
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Usage: qsort [nmemb]
+ *
+ * Compares the old comb sort, qsort() and mergesort() on the element
+ * sizes com32 actually sorts (pointer and small struct arrays), for a
+ * few input orders, and checks the results.  Build on the host with
+ * "gcc -O2 -DTEST -o qsort qsort.c".
+ */
+
+static unsigned long ncompares;
+static size_t elem_size;
+
+static int cmp_key(const void *a, const void *b)
+{
+    const unsigned int *ka = a, *kb = b;
+
+    ncompares++;
+    return (*ka > *kb) - (*ka < *kb);
+}
+
+static void comb_sort(void *base, size_t nmemb, size_t size,
+		      int (*compar) (const void *, const void *))
+{
+    size_t gap = nmemb, i;
+    char *p1, *p2, t;
+    size_t k;
     int swapped;
 
     if (!nmemb)
 	return;
 
     do {
-	gap = newgap(gap);
+	gap = (gap * 10) / 13;
+	if (gap == 9 || gap == 10)
+	    gap = 11;
+	if (gap < 1)
+	    gap = 1;
 	swapped = 0;
 
 	for (i = 0, p1 = base; i < nmemb - gap; i++, p1 += size) {
-	    j = i + gap;
-	    if (compar(p1, p2 = (char *)base + j * size) > 0) {
-		memswap(p1, p2, size);
+	    p2 = (char *)base + (i + gap) * size;
+	    if (compar(p1, p2) > 0) {
+		for (k = 0; k < size; k++) {
+		    t = p1[k];
+		    p1[k] = p2[k];
+		    p2[k] = t;
+		}
 		swapped = 1;
 	    }
 	}
     } while (gap > 1 || swapped);
 }
+
+static int do_mergesort(void *base, size_t nmemb, size_t size,
+			int (*compar) (const void *, const void *))
+{
+    return mergesort(base, nmemb, size, compar);
+}
+
+static int do_qsort(void *base, size_t nmemb, size_t size,
+		    int (*compar) (const void *, const void *))
+{
+    qsort(base, nmemb, size, compar);
+    return 0;
+}
+
+static int do_comb_sort(void *base, size_t nmemb, size_t size,
+			int (*compar) (const void *, const void *))
+{
+    comb_sort(base, nmemb, size, compar);
+    return 0;
+}
+
+static const struct {
+    const char *name;
+    int (*sort) (void *, size_t, size_t,
+		 int (*)(const void *, const void *));
+    int stable;
+} sorts[] = {
+    {"combsort", do_comb_sort, 0},
+    {"qsort", do_qsort, 0},
+    {"mergesort", do_mergesort, 1},
+};
+
+static const char *const orders[] = {
+    "random", "sorted", "reversed", "few keys", "almost sorted"
+};
+
+/* Key in the first word, original position in the second (if any) */
+static void fill(char *v, size_t nmemb, size_t size, int order)
+{
+    size_t i;
+    unsigned int key;
+
+    memset(v, 0, nmemb * size);
+    for (i = 0; i < nmemb; i++) {
+	switch (order) {
+	case 0:
+	    key = rand();
+	    break;
+	case 1:
+	    key = i;
+	    break;
+	case 2:
+	    key = nmemb - i;
+	    break;
+	case 3:
+	    key = rand() % 8;
+	    break;
+	default:
+	    key = (rand() % 32) ? i : (unsigned int)rand();
+	    break;
+	}
+	memcpy(v + i * size, &key, sizeof key);
+	if (size >= 2 * sizeof key)
+	    memcpy(v + i * size + sizeof key, &i, sizeof(unsigned int));
+    }
+}
+
+static int check(const char *v, size_t nmemb, size_t size, int stable)
+{
+    unsigned int k0, k1, p0, p1;
+    size_t i;
+
+    for (i = 1; i < nmemb; i++) {
+	memcpy(&k0, v + (i - 1) * size, sizeof k0);
+	memcpy(&k1, v + i * size, sizeof k1);
+	if (k0 > k1)
+	    return 0;
+	if (stable && k0 == k1 && size >= 2 * sizeof k0) {
+	    memcpy(&p0, v + (i - 1) * size + sizeof k0, sizeof p0);
+	    memcpy(&p1, v + i * size + sizeof k0, sizeof p1);
+	    if (p0 > p1)
+		return 0;
+	}
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    static const size_t sizes[] = { 4, 8, 12, 32 };
+    size_t nmemb = argc > 1 ? strtoul(argv[1], NULL, 0) : 20000;
+    size_t si, k;
+    int order, bad = 0;
+    char *v;
+    clock_t t0;
+
+    v = malloc(nmemb * 32);
+    if (!v)
+	return 1;
+
+    printf("%zu elements; msec / compares\n", nmemb);
+    for (si = 0; si < sizeof sizes / sizeof sizes[0]; si++) {
+	elem_size = sizes[si];
+	printf("\nsize %-17zu", elem_size);
+	for (k = 0; k < sizeof sorts / sizeof sorts[0]; k++)
+	    printf("%20s", sorts[k].name);
+	printf("\n");
+
+	for (order = 0; order < 5; order++) {
+	    printf("  %-20s", orders[order]);
+	    for (k = 0; k < sizeof sorts / sizeof sorts[0]; k++) {
+		srand(order + 1);
+		fill(v, nmemb, elem_size, order);
+		ncompares = 0;
+		t0 = clock();
+		sorts[k].sort(v, nmemb, elem_size, cmp_key);
+		printf("%9.2f /%9lu",
+		       (clock() - t0) * 1000.0 / CLOCKS_PER_SEC, ncompares);
+		if (!check(v, nmemb, elem_size, sorts[k].stable)) {
+		    printf("!");
+		    bad = 1;
+		}
+	    }
+	    printf("\n");
+	}
+    }
+
+    free(v);
+    return bad;
+}
+
+#endif /* TEST */
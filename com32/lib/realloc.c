@@ -45,8 +45,7 @@ void *realloc(void *ptr, size_t size)
 	    /* Merge in subsequent free block */
 	    ah->a.next = nah->a.next;
 	    ah->a.next->a.prev = ah;
-	    nah->next_free->prev_free = nah->prev_free;
-	    nah->prev_free->next_free = nah->next_free;
+	    __malloc_bin_remove(nah);
 	    xsize = (ah->a.size += nah->a.size);
 	}
 
@@ -71,15 +70,9 @@ void *realloc(void *ptr, size_t size)
 		       which has already been grown at least once.  As such, put
 		       it at the *end* of the freelist instead of the beginning;
 		       trying to save it for future realloc()s of the same block. */
-		    nah->prev_free = __malloc_head.prev_free;
-		    nah->next_free = &__malloc_head;
-		    __malloc_head.prev_free = nah;
-		    nah->prev_free->next_free = nah;
+		    __malloc_bin_append(nah);
 		} else {
-		    nah->next_free = __malloc_head.next_free;
-		    nah->prev_free = &__malloc_head;
-		    __malloc_head.next_free = nah;
-		    nah->next_free->prev_free = nah;
+		    __malloc_bin_insert(nah);
 		}
 	    }
 	    /* otherwise, use up the whole block */
@@ -96,3 +96,61 @@ ssize_t __file_read(struct file_info * fp, void *buf, size_t count)
 
     return n;
 }
+
+/*
+ * Read exactly LEN bytes of the underlying file, for the decompressors.
+ * Large reads go straight to the destination rather than through the
+ * file buffer.
+ */
+int __file_get_bytes(struct file_info *fp, void *buf, size_t len)
+{
+    char *p = buf;
+    size_t ncopy;
+
+    while (len) {
+	if (!fp->i.nbytes) {
+	    if (!fp->i.fd.handle)
+		return -1;
+
+	    if (len >= MAXBLOCK) {
+		ncopy = __com32.cs_pm->read_file(&fp->i.fd.handle, p,
+						 len >> fp->i.fd.blocklg2);
+		if (!ncopy)
+		    return -1;
+		p += ncopy;
+		len -= ncopy;
+		continue;
+	    }
+
+	    if (__file_get_block(fp))
+		return -1;
+	}
+
+	ncopy = min(len, fp->i.nbytes);
+	memcpy(p, fp->i.datap, ncopy);
+	fp->i.datap += ncopy;
+	fp->i.nbytes -= ncopy;
+	p += ncopy;
+	len -= ncopy;
+    }
+
+    return 0;
+}
+
+/* Throw away LEN bytes of the underlying file; only used for small things */
+int __file_skip_bytes(struct file_info *fp, size_t len)
+{
+    size_t ncopy;
+
+    while (len) {
+	if (!fp->i.nbytes && __file_get_block(fp))
+	    return -1;
+
+	ncopy = min(len, fp->i.nbytes);
+	fp->i.datap += ncopy;
+	fp->i.nbytes -= ncopy;
+	len -= ncopy;
+    }
+
+    return 0;
+}
@@ -0,0 +1,443 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2026 The Syslinux Authors - All Rights Reserved
+ *
+ *   Permission is hereby granted, free of charge, to any person
+ *   obtaining a copy of this software and associated documentation
+ *   files (the "Software"), to deal in the Software without
+ *   restriction, including without limitation the rights to use,
+ *   copy, modify, merge, publish, distribute, sublicense, and/or
+ *   sell copies of the Software, and to permit persons to whom
+ *   the Software is furnished to do so, subject to the following
+ *   conditions:
+ *
+ *   The above copyright notice and this permission notice shall
+ *   be included in all copies or substantial portions of the Software.
+ *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *   OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ *   HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ *   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ *   OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * lz4file.c
+ *
+ * Streaming decompressor for lz4 files, both the frame format written
+ * by the lz4 tool and the legacy format used for Linux kernels and
+ * initramfs images ("lz4 -l").
+ *
+ * Data is unpacked a block at a time as it comes off the disk or the
+ * network.  When the blocks are independent and the caller asks for at
+ * least a whole block, it is unpacked straight into the caller's
+ * buffer; otherwise it goes through our own buffer, which also keeps
+ * the 64K of history that linked blocks may refer back to.
+ *
+ * Block and content checksums are skipped, not verified.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <minmax.h>
+
+#include "file.h"
+
+#define LZ4_MAGIC		0x184d2204
+#define LZ4_LEGACY_MAGIC	0x184c2102
+#define LZ4_SKIP_MAGIC		0x184d2a50	/* Low 4 bits are free */
+
+#define LZ4_WINDOW		(64U << 10)
+#define LZ4_LEGACY_BLOCK	(8U << 20)
+/* Worst-case compressed size of a legacy block */
+#define LZ4_LEGACY_BOUND	(LZ4_LEGACY_BLOCK + LZ4_LEGACY_BLOCK/255 + 16)
+
+/* Frame descriptor flags */
+#define FLG_VERSION_MASK	0xc0
+#define FLG_VERSION		0x40
+#define FLG_BLOCK_INDEP		0x20
+#define FLG_BLOCK_CHECKSUM	0x10
+#define FLG_CONTENT_SIZE	0x08
+#define FLG_CONTENT_CHECKSUM	0x04
+#define FLG_DICT_ID		0x01
+
+#define BLOCK_UNCOMPRESSED	0x80000000
+
+int __file_get_bytes(struct file_info *fp, void *buf, size_t len);
+int __file_skip_bytes(struct file_info *fp, size_t len);
+int __file_close(struct file_info *fp);
+
+static ssize_t lz4_file_read(struct file_info *, void *, size_t);
+static int lz4_file_close(struct file_info *);
+
+static const struct input_dev lz4_file_dev = {
+    .dev_magic = __DEV_MAGIC,
+    .flags = __DEV_FILE | __DEV_INPUT,
+    .fileflags = O_RDONLY,
+    .read = lz4_file_read,
+    .close = lz4_file_close,
+    .open = NULL,
+};
+
+struct lz4_state {
+    bool legacy;		/* Legacy format */
+    bool in_frame;		/* Between a frame header and its end mark */
+    bool eof;
+    bool error;
+    uint8_t flags;		/* Frame descriptor flags */
+    size_t block_max;		/* Largest block in this frame */
+
+    uint8_t *in;		/* Compressed block */
+    size_t in_size;
+
+    uint8_t *out;		/* History plus the current block */
+    size_t out_size;
+    size_t pos, end;		/* Decoded data not yet handed out */
+};
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] + (p[1] << 8) + (p[2] << 16) + ((uint32_t)p[3] << 24);
+}
+
+static bool lz4_input_eof(const struct file_info *fp)
+{
+    return !fp->i.nbytes && !fp->i.fd.handle;
+}
+
+static int lz4_alloc(uint8_t **buf, size_t *size, size_t need)
+{
+    if (*size >= need)
+	return 0;
+
+    free(*buf);
+    *buf = malloc(need);
+    *size = *buf ? need : 0;
+    return *buf ? 0 : -1;
+}
+
+/*
+ * Unpack one block to base + start, where the bytes before it are the
+ * history that matches may refer to.  Returns the number of bytes
+ * unpacked, or -1 if the block is corrupt or does not fit.
+ */
+static ssize_t lz4_block(const uint8_t *ip, size_t ilen,
+			 uint8_t *base, size_t start, size_t cap)
+{
+    const uint8_t *iend = ip + ilen;
+    uint8_t *op = base + start, *oend = base + cap;
+    const uint8_t *match;
+    size_t len, off;
+    unsigned int token;
+
+    for (;;) {
+	if (ip >= iend)
+	    return -1;
+	token = *ip++;
+
+	/* Literals */
+	len = token >> 4;
+	if (len == 15) {
+	    do {
+		if (ip >= iend)
+		    return -1;
+		len += *ip;
+	    } while (*ip++ == 255);
+	}
+	if (len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+	    return -1;
+	memcpy(op, ip, len);
+	op += len;
+	ip += len;
+
+	if (ip == iend)
+	    break;		/* The last sequence has no match */
+
+	/* Match */
+	if (iend - ip < 2)
+	    return -1;
+	off = ip[0] + (ip[1] << 8);
+	ip += 2;
+	if (!off || off > (size_t)(op - base))
+	    return -1;
+
+	len = token & 15;
+	if (len == 15) {
+	    do {
+		if (ip >= iend)
+		    return -1;
+		len += *ip;
+	    } while (*ip++ == 255);
+	}
+	len += 4;
+	if (len > (size_t)(oend - op))
+	    return -1;
+
+	match = op - off;
+	if (off >= len) {
+	    memcpy(op, match, len);
+	    op += len;
+	} else {
+	    /* Overlapping match: a repeating pattern */
+	    while (len--)
+		*op++ = *match++;
+	}
+    }
+
+    return op - (base + start);
+}
+
+/*
+ * Read a frame header, or for the legacy format, just the magic.
+ * Returns 1 at the end of the file.
+ */
+static int lz4_frame_header(struct file_info *fp, struct lz4_state *st)
+{
+    uint8_t hdr[4];
+    uint32_t magic;
+
+    for (;;) {
+	if (lz4_input_eof(fp))
+	    return 1;
+
+	if (__file_get_bytes(fp, hdr, 4))
+	    return -1;
+	magic = get_le32(hdr);
+
+	if (magic == LZ4_LEGACY_MAGIC) {
+	    st->legacy = true;
+	    st->flags = FLG_BLOCK_INDEP;
+	    st->block_max = LZ4_LEGACY_BLOCK;
+	    return lz4_alloc(&st->in, &st->in_size, LZ4_LEGACY_BOUND);
+	} else if (magic == LZ4_MAGIC) {
+	    break;
+	} else if ((magic & ~0xf) == LZ4_SKIP_MAGIC) {
+	    if (__file_get_bytes(fp, hdr, 4) ||
+		__file_skip_bytes(fp, get_le32(hdr)))
+		return -1;
+	} else {
+	    return -1;
+	}
+    }
+
+    /* FLG, BD */
+    if (__file_get_bytes(fp, hdr, 2))
+	return -1;
+    st->flags = hdr[0];
+    if ((st->flags & FLG_VERSION_MASK) != FLG_VERSION ||
+	(st->flags & FLG_DICT_ID))
+	return -1;
+
+    switch ((hdr[1] >> 4) & 7) {
+    case 4:
+	st->block_max = 64 << 10;
+	break;
+    case 5:
+	st->block_max = 256 << 10;
+	break;
+    case 6:
+	st->block_max = 1 << 20;
+	break;
+    case 7:
+	st->block_max = 4 << 20;
+	break;
+    default:
+	return -1;
+    }
+
+    /* Content size (already reported by __lz4_file_init), header checksum */
+    if (__file_skip_bytes(fp, (st->flags & FLG_CONTENT_SIZE ? 8 : 0) + 1))
+	return -1;
+
+    st->legacy = false;
+    st->in_frame = true;
+    return lz4_alloc(&st->in, &st->in_size, st->block_max);
+}
+
+/*
+ * Unpack the next block, either into the caller's buffer if it is big
+ * enough and the block does not need any history, or into our own.
+ * Returns the number of bytes put in the caller's buffer.
+ */
+static ssize_t lz4_next_block(struct file_info *fp, struct lz4_state *st,
+			      void *ptr, size_t n)
+{
+    uint8_t hdr[4];
+    uint32_t bsize;
+    uint8_t *base;
+    size_t start, cap, keep, need;
+    ssize_t bytes;
+    bool raw;
+    int rv;
+
+    /* Find the next block */
+    for (;;) {
+	if (!st->legacy && !st->in_frame) {
+	    rv = lz4_frame_header(fp, st);
+	    if (rv) {
+		st->eof = rv > 0;
+		return rv > 0 ? 0 : -1;
+	    }
+	}
+
+	if (st->legacy && lz4_input_eof(fp)) {
+	    st->eof = true;
+	    return 0;
+	}
+
+	if (__file_get_bytes(fp, hdr, 4))
+	    return -1;
+	bsize = get_le32(hdr);
+
+	if (st->legacy) {
+	    if (bsize == LZ4_LEGACY_MAGIC)
+		continue;	/* Concatenated legacy streams */
+	    if (bsize > LZ4_LEGACY_BOUND) {
+		/* Not a block; whatever follows the legacy stream */
+		st->eof = true;
+		return 0;
+	    }
+	    raw = false;
+	    break;
+	}
+
+	if (bsize) {
+	    raw = !!(bsize & BLOCK_UNCOMPRESSED);
+	    bsize &= ~BLOCK_UNCOMPRESSED;
+	    if (bsize > st->block_max)
+		return -1;
+	    break;
+	}
+
+	/* End mark */
+	st->in_frame = false;
+	if ((st->flags & FLG_CONTENT_CHECKSUM) && __file_skip_bytes(fp, 4))
+	    return -1;
+    }
+
+    /* Where does it go? */
+    if ((st->flags & FLG_BLOCK_INDEP) && n >= st->block_max) {
+	base = ptr;
+	start = 0;
+	cap = n;
+    } else {
+	need = LZ4_WINDOW + st->block_max;
+	if (st->out_size < need) {
+	    base = realloc(st->out, need);
+	    if (!base)
+		return -1;
+	    st->out = base;
+	    st->out_size = need;
+	}
+
+	keep = (st->flags & FLG_BLOCK_INDEP) ? 0 : min(st->end, LZ4_WINDOW);
+	memmove(st->out, st->out + st->end - keep, keep);
+	base = st->out;
+	start = st->pos = st->end = keep;
+	cap = st->out_size;
+    }
+
+    if (raw) {
+	if (bsize > cap - start || __file_get_bytes(fp, base + start, bsize))
+	    return -1;
+	bytes = bsize;
+    } else {
+	if (__file_get_bytes(fp, st->in, bsize))
+	    return -1;
+	bytes = lz4_block(st->in, bsize, base, start, cap);
+	if (bytes < 0)
+	    return -1;
+    }
+
+    if ((st->flags & FLG_BLOCK_CHECKSUM) && __file_skip_bytes(fp, 4))
+	return -1;
+
+    if (base == ptr)
+	return bytes;
+
+    st->end += bytes;
+    return 0;
+}
+
+static ssize_t lz4_file_read(struct file_info *fp, void *ptr, size_t n)
+{
+    struct lz4_state *st = fp->i.pvt;
+    unsigned char *p = ptr;
+    ssize_t nout = 0;
+    ssize_t bytes;
+
+    while (n) {
+	if (st->pos < st->end) {
+	    bytes = min(n, st->end - st->pos);
+	    memcpy(p, st->out + st->pos, bytes);
+	    st->pos += bytes;
+	} else if (st->eof) {
+	    break;
+	} else {
+	    bytes = lz4_next_block(fp, st, p, n);
+	    if (bytes < 0) {
+		st->eof = st->error = true;
+		break;
+	    }
+	}
+
+	p += bytes;
+	n -= bytes;
+	nout += bytes;
+    }
+
+    fp->i.offset += nout;
+
+    if (!nout && st->error) {
+	errno = EIO;
+	return -1;
+    }
+    return nout;
+}
+
+static int lz4_file_close(struct file_info *fp)
+{
+    struct lz4_state *st = fp->i.pvt;
+
+    free(st->in);
+    free(st->out);
+    free(st);
+    return __file_close(fp);
+}
+
+/*
+ * Called from zopen() with the first block of the file in the buffer.
+ * If the frame header gives the unpacked size, that becomes the size
+ * of the file; this assumes the file is a single frame, as the lz4
+ * tool writes it.
+ */
+int __lz4_file_init(struct file_info *fp)
+{
+    struct lz4_state *st = calloc(1, sizeof *st);
+    const uint8_t *hdr = (const uint8_t *)fp->i.datap;
+    uint32_t size_lo, size_hi;
+
+    if (!st)
+	return -1;
+
+    fp->i.pvt = st;
+    fp->i.fd.size = -1;		/* Unknown */
+
+    if (get_le32(hdr) == LZ4_MAGIC && (hdr[4] & FLG_CONTENT_SIZE) &&
+	fp->i.nbytes >= 14) {
+	size_lo = get_le32(hdr + 6);
+	size_hi = get_le32(hdr + 10);
+	if (!size_hi && size_lo != (uint32_t)-1)
+	    fp->i.fd.size = size_lo;
+    }
+
+    fp->iop = &lz4_file_dev;
+    return 0;
+}
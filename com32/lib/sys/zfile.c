@@ -39,11 +39,15 @@
  * zopen.c
  *
  * Open an ordinary file, possibly compressed; if so, insert
- * an appropriate decompressor.
+ * an appropriate decompressor.  The decompressors unpack the file as
+ * it is read, so the I/O and the unpacking are interleaved a block at
+ * a time.
  */
 
 int __file_get_block(struct file_info *fp);
 int __file_close(struct file_info *fp);
+int __lz4_file_init(struct file_info *fp);
+int __zstd_file_init(struct file_info *fp);
 
 static ssize_t gzip_file_read(struct file_info *, void *, size_t);
 static int gzip_file_close(struct file_info *);
@@ -103,6 +107,7 @@ static ssize_t gzip_file_read(struct file_info *fp, void *ptr, size_t n)
 	rv = inflate(zs, Z_SYNC_FLUSH);
 
 	bytes = n - zs->avail_out;
+	fp->i.offset += bytes;
 	nout += bytes;
 	p += bytes;
 	n -= bytes;
@@ -137,10 +142,33 @@ static int gzip_file_close(struct file_info *fp)
     return __file_close(fp);
 }
 
+/*
+ * Formats we can unpack, recognized by their magic number.  xz files,
+ * and formats the caller didn't ask for, are passed through as they are.
+ */
+static const struct zformat {
+    const char *magic;
+    size_t magic_len;
+    size_t min_len;		/* Shortest possible header */
+    unsigned int format;	/* ZIO_* */
+    int (*init)(struct file_info *);
+} zformats[] = {
+    {"\037\213\010", 3, 14, ZIO_GZIP, gzip_file_init},	/* gzip, deflate */
+    {"\004\042\115\030", 4, 7, ZIO_LZ4, __lz4_file_init},	/* lz4 */
+    {"\002\041\114\030", 4, 8, ZIO_LZ4, __lz4_file_init},	/* lz4 legacy */
+    {"\050\265\057\375", 4, 6, ZIO_ZSTD, __zstd_file_init}, /* zstd */
+};
+
 int zopen(const char *pathname, int flags, ...)
+{
+    return zopen_formats(pathname, flags, ZIO_GZIP);
+}
+
+int zopen_formats(const char *pathname, int flags, unsigned int formats)
 {
     int fd, rv;
     struct file_info *fp;
+    const struct zformat *zf;
 
     /* We don't actually give a hoot about the creation bits... */
     fd = open(pathname, flags, 0);
@@ -154,13 +182,14 @@ int zopen(const char *pathname, int flags, ...)
     if (__file_get_block(fp))
 	goto err;
 
-    if (fp->i.nbytes >= 14 &&
-	(uint8_t) fp->i.buf[0] == 037 &&
-	(uint8_t) fp->i.buf[1] == 0213 &&	/* gzip */
-	fp->i.buf[2] == 8)	/* deflate */
-	rv = gzip_file_init(fp);
-    else
-	rv = 0;			/* Plain file */
+    rv = 0;			/* Plain file */
+    for (zf = zformats; zf < zformats + sizeof zformats / sizeof *zf; zf++) {
+	if ((zf->format & formats) && fp->i.nbytes >= zf->min_len &&
+	    !memcmp(fp->i.buf, zf->magic, zf->magic_len)) {
+	    rv = zf->init(fp);
+	    break;
+	}
+    }
 
     if (!rv)
 	return fd;
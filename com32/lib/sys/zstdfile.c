@@ -0,0 +1,1154 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2026 The Syslinux Authors - All Rights Reserved
+ *
+ *   Permission is hereby granted, free of charge, to any person
+ *   obtaining a copy of this software and associated documentation
+ *   files (the "Software"), to deal in the Software without
+ *   restriction, including without limitation the rights to use,
+ *   copy, modify, merge, publish, distribute, sublicense, and/or
+ *   sell copies of the Software, and to permit persons to whom
+ *   the Software is furnished to do so, subject to the following
+ *   conditions:
+ *
+ *   The above copyright notice and this permission notice shall
+ *   be included in all copies or substantial portions of the Software.
+ *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *   OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ *   HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ *   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ *   OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * zstdfile.c
+ *
+ * Streaming decompressor for zstd files (RFC 8878), as written by the
+ * zstd tool and by the kernel's initramfs tooling.
+ *
+ * Data is unpacked a block (at most 128K) at a time as it comes off the
+ * disk or the network.  When the frame header gives the unpacked size
+ * and the caller asks for all of it at once, as floadfile() does, the
+ * whole frame is unpacked straight into the caller's buffer, which then
+ * doubles as the history window.  Otherwise it goes through our own
+ * buffer, which keeps the window that matches may refer back to.
+ *
+ * Dictionaries are not supported.  The content checksum is skipped, not
+ * verified.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <minmax.h>
+
+#include "file.h"
+
+#define ZSTD_MAGIC		0xfd2fb528
+#define ZSTD_SKIP_MAGIC		0x184d2a50	/* Low 4 bits are free */
+
+#define ZSTD_BLOCK_MAX		(128U << 10)
+#define ZSTD_WINDOW_MAX		(128U << 20)	/* Same as the zstd tool */
+
+/* Frame header descriptor */
+#define FHD_FCS_SHIFT		6
+#define FHD_SINGLE_SEGMENT	0x20
+#define FHD_RESERVED		0x08
+#define FHD_CHECKSUM		0x04
+#define FHD_DICT_ID_MASK	0x03
+
+/* Block types */
+#define BLOCK_RAW		0
+#define BLOCK_RLE		1
+#define BLOCK_COMPRESSED	2
+
+/* Literals section types */
+#define LIT_RAW			0
+#define LIT_RLE			1
+#define LIT_COMPRESSED		2
+#define LIT_TREELESS		3
+
+/* Sequence table modes */
+#define SEQ_PREDEFINED		0
+#define SEQ_RLE			1
+#define SEQ_COMPRESSED		2
+#define SEQ_REPEAT		3
+
+#define HUF_MAX_BITS		11
+#define HUF_MAX_SYMBOLS		256
+#define FSE_MAX_LOG		9
+#define FSE_MAX_SYMBOLS		256
+
+#define LL_MAX_SYMBOL		35
+#define ML_MAX_SYMBOL		52
+#define OF_MAX_SYMBOL		31
+#define LL_MAX_LOG		9
+#define ML_MAX_LOG		9
+#define OF_MAX_LOG		8
+#define HUF_WEIGHT_MAX_LOG	6
+
+int __file_get_bytes(struct file_info *fp, void *buf, size_t len);
+int __file_skip_bytes(struct file_info *fp, size_t len);
+int __file_close(struct file_info *fp);
+
+static ssize_t zstd_file_read(struct file_info *, void *, size_t);
+static int zstd_file_close(struct file_info *);
+
+static const struct input_dev zstd_file_dev = {
+    .dev_magic = __DEV_MAGIC,
+    .flags = __DEV_FILE | __DEV_INPUT,
+    .fileflags = O_RDONLY,
+    .read = zstd_file_read,
+    .close = zstd_file_close,
+    .open = NULL,
+};
+
+/* An FSE decoding table; the state is an index into it */
+struct zstd_fse {
+    int log;
+    uint8_t symbol[1 << FSE_MAX_LOG];
+    uint8_t nbits[1 << FSE_MAX_LOG];
+    uint16_t base[1 << FSE_MAX_LOG];
+};
+
+struct zstd_state {
+    bool in_frame;		/* Between a frame header and its last block */
+    bool eof;
+    bool error;
+    uint8_t fhd;		/* Frame header descriptor */
+    uint64_t window;		/* Window size of this frame */
+    uint64_t content_size;	/* Unpacked size, or -1 if unknown */
+    uint64_t frame_out;		/* Bytes unpacked in this frame so far */
+    size_t block_max;		/* Largest block in this frame */
+
+    /* Carried from block to block within a frame */
+    uint32_t rep[3];		/* Repeat offsets */
+    bool have_huf;		/* huf_* valid for treeless literals */
+    bool have_fse[3];		/* fse[] valid for repeat mode */
+
+    int huf_log;
+    uint8_t huf_symbol[1 << HUF_MAX_BITS];
+    uint8_t huf_nbits[1 << HUF_MAX_BITS];
+    struct zstd_fse fse[3];	/* Literal length, offset, match length */
+    struct zstd_fse fse_huf;	/* Huffman weights, only while reading them */
+
+    uint8_t *in;		/* Compressed block */
+    uint8_t *lit;		/* Unpacked literals */
+
+    uint8_t *out;		/* History plus the current block */
+    size_t out_size;
+    size_t pos, end;		/* Decoded data not yet handed out */
+};
+
+/* Literal length and match length codes: baseline and extra bits */
+static const uint32_t ll_base[LL_MAX_SYMBOL + 1] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048,
+    4096, 8192, 16384, 32768, 65536
+};
+static const uint8_t ll_bits[LL_MAX_SYMBOL + 1] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11,
+    12, 13, 14, 15, 16
+};
+static const uint32_t ml_base[ML_MAX_SYMBOL + 1] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+    19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+    35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027,
+    2051, 4099, 8195, 16387, 32771, 65539
+};
+static const uint8_t ml_bits[ML_MAX_SYMBOL + 1] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10,
+    11, 12, 13, 14, 15, 16
+};
+
+/* Predefined distributions, used when a table is not sent */
+static const int16_t ll_default[LL_MAX_SYMBOL + 1] = {
+    4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+    -1, -1, -1, -1
+};
+static const int16_t ml_default[ML_MAX_SYMBOL + 1] = {
+    1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+    -1, -1, -1, -1, -1
+};
+static const int16_t of_default[29] = {
+    1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1
+};
+
+static uint32_t get_le16(const uint8_t *p)
+{
+    return p[0] + (p[1] << 8);
+}
+
+static uint32_t get_le24(const uint8_t *p)
+{
+    return p[0] + (p[1] << 8) + (p[2] << 16);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] + (p[1] << 8) + (p[2] << 16) + ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+    return get_le32(p) + ((uint64_t)get_le32(p + 4) << 32);
+}
+
+static inline int highbit(uint32_t x)
+{
+    return 31 - __builtin_clz(x);
+}
+
+static bool zstd_input_eof(const struct file_info *fp)
+{
+    return !fp->i.nbytes && !fp->i.fd.handle;
+}
+
+/*
+ * Bitstreams other than the table descriptions are read backwards,
+ * starting from the marker bit in the last byte.  Reading past the
+ * start yields zeroes; pos then goes negative, which the callers check.
+ */
+struct zbits {
+    const uint8_t *p;
+    size_t len;
+    int pos;			/* Bits not yet read */
+};
+
+static int zbits_init(struct zbits *br, const uint8_t *p, size_t len)
+{
+    if (!len || !p[len - 1])
+	return -1;
+
+    br->p = p;
+    br->len = len;
+    br->pos = (len - 1) * 8 + highbit(p[len - 1]);
+    return 0;
+}
+
+/* Up to 8 bytes starting at byte I, little endian */
+static uint64_t zbits_load(const struct zbits *br, size_t i)
+{
+    uint64_t v;
+    size_t k;
+
+    if (br->len - i >= 8) {
+	memcpy(&v, br->p + i, 8);	/* x86 is little endian */
+	return v;
+    }
+
+    v = 0;
+    for (k = br->len; k > i; k--)
+	v = (v << 8) | br->p[k - 1];
+    return v;
+}
+
+/* The next N (at most 32) bits, without consuming them */
+static uint32_t zbits_peek(const struct zbits *br, int n)
+{
+    int pos = br->pos - n;
+    uint64_t mask = ((uint64_t)1 << n) - 1;
+
+    if (pos >= 0)
+	return (zbits_load(br, pos >> 3) >> (pos & 7)) & mask;
+    else if (pos > -n)
+	return (zbits_load(br, 0) << -pos) & mask;
+    else
+	return 0;
+}
+
+static uint32_t zbits_get(struct zbits *br, int n)
+{
+    uint32_t v = zbits_peek(br, n);
+
+    br->pos -= n;
+    return v;
+}
+
+/*
+ * Build an FSE decoding table from a normalized distribution; -1 is a
+ * "less than one" probability, which gets a single slot at the top.
+ */
+static int fse_build(struct zstd_fse *t, const int16_t *norm, int nsym,
+		     int log)
+{
+    uint16_t next[FSE_MAX_SYMBOLS];
+    int size = 1 << log;
+    int high = size;
+    int step = (size >> 1) + (size >> 3) + 3;
+    int mask = size - 1;
+    int pos = 0;
+    int s, i, nb;
+
+    for (s = 0; s < nsym; s++) {
+	if (norm[s] == -1) {
+	    t->symbol[--high] = s;
+	    next[s] = 1;
+	}
+    }
+
+    for (s = 0; s < nsym; s++) {
+	if (norm[s] <= 0)
+	    continue;
+	next[s] = norm[s];
+	for (i = 0; i < norm[s]; i++) {
+	    t->symbol[pos] = s;
+	    do {
+		pos = (pos + step) & mask;
+	    } while (pos >= high);
+	}
+    }
+    if (pos)
+	return -1;
+
+    for (i = 0; i < size; i++) {
+	s = next[t->symbol[i]]++;
+	nb = log - highbit(s);
+	t->nbits[i] = nb;
+	t->base[i] = (s << nb) - size;
+    }
+
+    t->log = log;
+    return 0;
+}
+
+/* Table descriptions are read forwards: up to 25 bits from BITPOS */
+static uint32_t fwd_peek(const uint8_t *ip, size_t ilen, size_t bitpos)
+{
+    size_t i = bitpos >> 3;
+    uint32_t v = 0;
+    int k;
+
+    for (k = 3; k >= 0; k--)
+	v = (v << 8) | (i + k < ilen ? ip[i + k] : 0);
+    return v >> (bitpos & 7);
+}
+
+/*
+ * Read an FSE table description and build the table.  Returns the
+ * number of bytes used, or -1.
+ */
+static ssize_t fse_read_table(struct zstd_fse *t, const uint8_t *ip,
+			      size_t ilen, int max_symbol, int max_log)
+{
+    int16_t norm[FSE_MAX_SYMBOLS];
+    size_t bitpos, bitlen = ilen * 8;
+    int log, remaining, nsym, nb, repeat, i;
+    uint32_t val, lower, threshold;
+
+    if (!ilen)
+	return -1;
+
+    log = (ip[0] & 15) + 5;
+    if (log > max_log)
+	return -1;
+    bitpos = 4;
+
+    remaining = 1 << log;
+    nsym = 0;
+    while (remaining > 0 && nsym <= max_symbol) {
+	/* Values that can't occur any more take one bit less */
+	nb = highbit(remaining + 1) + 1;
+	lower = (1U << (nb - 1)) - 1;
+	threshold = (1U << nb) - 1 - (remaining + 1);
+
+	val = fwd_peek(ip, ilen, bitpos) & ((1U << nb) - 1);
+	if ((val & lower) < threshold) {
+	    val &= lower;
+	    bitpos += nb - 1;
+	} else {
+	    if (val > lower)
+		val -= threshold;
+	    bitpos += nb;
+	}
+
+	norm[nsym] = (int)val - 1;
+	remaining -= norm[nsym] < 0 ? 1 : norm[nsym];
+	nsym++;
+
+	if (val == 1) {
+	    /* Zero probability, followed by a count of more zeroes */
+	    do {
+		repeat = fwd_peek(ip, ilen, bitpos) & 3;
+		bitpos += 2;
+		if (nsym + repeat > max_symbol + 1)
+		    return -1;
+		for (i = 0; i < repeat; i++)
+		    norm[nsym++] = 0;
+	    } while (repeat == 3);
+	}
+
+	if (bitpos > bitlen)
+	    return -1;
+    }
+
+    if (remaining || fse_build(t, norm, nsym, log))
+	return -1;
+
+    return (bitpos + 7) >> 3;
+}
+
+/*
+ * Read the Huffman tree description at the start of the compressed
+ * literals, and build the decoding table.  Returns the number of bytes
+ * used, or -1.
+ */
+static ssize_t huf_read_table(struct zstd_state *st, const uint8_t *ip,
+			      size_t ilen)
+{
+    uint8_t w[HUF_MAX_SYMBOLS];
+    uint32_t start[HUF_MAX_BITS + 1];
+    struct zstd_fse *t = &st->fse_huf;
+    struct zbits br;
+    uint32_t total, rest, s1, s2, pos;
+    uint32_t *last;
+    size_t used, len;
+    ssize_t n;
+    int nw, i, nb, log;
+
+    if (!ilen)
+	return -1;
+
+    if (ip[0] < 128) {
+	/* Weights are FSE compressed, with two interleaved states */
+	used = 1 + ip[0];
+	if (used > ilen)
+	    return -1;
+	n = fse_read_table(t, ip + 1, ip[0], HUF_MAX_BITS + 1,
+			   HUF_WEIGHT_MAX_LOG);
+	if (n < 0 || zbits_init(&br, ip + 1 + n, ip[0] - n))
+	    return -1;
+
+	s1 = zbits_get(&br, t->log);
+	s2 = zbits_get(&br, t->log);
+	nw = 0;
+	for (;;) {
+	    if (nw >= HUF_MAX_SYMBOLS - 1)
+		return -1;
+	    w[nw++] = t->symbol[s1];
+	    s1 = t->base[s1] + zbits_get(&br, t->nbits[s1]);
+	    if (br.pos < 0) {
+		last = &s2;
+		break;
+	    }
+	    if (nw >= HUF_MAX_SYMBOLS - 1)
+		return -1;
+	    w[nw++] = t->symbol[s2];
+	    s2 = t->base[s2] + zbits_get(&br, t->nbits[s2]);
+	    if (br.pos < 0) {
+		last = &s1;
+		break;
+	    }
+	}
+	/* Once the input runs out, the other state has one more */
+	if (nw >= HUF_MAX_SYMBOLS - 1)
+	    return -1;
+	w[nw++] = t->symbol[*last];
+    } else {
+	/* Weights are stored directly, four bits each */
+	nw = ip[0] - 127;
+	used = 1 + (nw + 1) / 2;
+	if (used > ilen)
+	    return -1;
+	for (i = 0; i < nw; i++)
+	    w[i] = i & 1 ? ip[1 + i/2] & 15 : ip[1 + i/2] >> 4;
+    }
+
+    /* The weight of the last symbol is implied by the others */
+    total = 0;
+    for (i = 0; i < nw; i++) {
+	if (w[i] > HUF_MAX_BITS)
+	    return -1;
+	if (w[i])
+	    total += 1 << (w[i] - 1);
+    }
+    if (!total)
+	return -1;
+    log = highbit(total) + 1;
+    rest = (1 << log) - total;
+    if (log > HUF_MAX_BITS || (rest & (rest - 1)))
+	return -1;
+    w[nw++] = highbit(rest) + 1;
+
+    /* Longest codes first, then by symbol */
+    memset(start, 0, sizeof start);
+    for (i = 0; i < nw; i++) {
+	if (w[i])
+	    start[log + 1 - w[i]] += 1 << (w[i] - 1);
+    }
+    pos = 0;
+    for (nb = log; nb >= 1; nb--) {
+	len = start[nb];
+	start[nb] = pos;
+	pos += len;
+    }
+
+    for (i = 0; i < nw; i++) {
+	if (!w[i])
+	    continue;
+	nb = log + 1 - w[i];
+	len = 1 << (w[i] - 1);
+	memset(st->huf_symbol + start[nb], i, len);
+	memset(st->huf_nbits + start[nb], nb, len);
+	start[nb] += len;
+    }
+
+    st->huf_log = log;
+    st->have_huf = true;
+    return used;
+}
+
+/* Unpack one Huffman coded literals stream of N symbols */
+static int huf_stream(const struct zstd_state *st, const uint8_t *ip,
+		      size_t ilen, uint8_t *op, size_t n)
+{
+    struct zbits br;
+    int log = st->huf_log;
+    uint32_t idx;
+
+    if (zbits_init(&br, ip, ilen))
+	return -1;
+
+    while (n--) {
+	idx = zbits_peek(&br, log);
+	*op++ = st->huf_symbol[idx];
+	br.pos -= st->huf_nbits[idx];
+    }
+
+    return br.pos ? -1 : 0;
+}
+
+/*
+ * Decode the literals section.  Raw literals are used where they are;
+ * others are unpacked into st->lit.  Returns the number of bytes used,
+ * or -1.
+ */
+static ssize_t zstd_literals(struct zstd_state *st, const uint8_t *ip,
+			     size_t ilen, const uint8_t **lit, size_t *nlit)
+{
+    int type, format, streams;
+    size_t hlen, regen, csize, used, seg, s[4];
+    const uint8_t *p;
+    ssize_t n;
+    uint32_t v;
+    int i;
+
+    if (!ilen)
+	return -1;
+
+    type = ip[0] & 3;
+    format = (ip[0] >> 2) & 3;
+
+    if (type == LIT_RAW || type == LIT_RLE) {
+	switch (format) {
+	case 1:
+	    hlen = 2;
+	    break;
+	case 3:
+	    hlen = 3;
+	    break;
+	default:
+	    hlen = 1;
+	    break;
+	}
+	if (hlen + (type == LIT_RLE) > ilen)
+	    return -1;
+
+	switch (hlen) {
+	case 1:
+	    regen = ip[0] >> 3;
+	    break;
+	case 2:
+	    regen = get_le16(ip) >> 4;
+	    break;
+	default:
+	    regen = get_le24(ip) >> 4;
+	    break;
+	}
+	if (regen > st->block_max)
+	    return -1;
+
+	if (type == LIT_RAW) {
+	    if (hlen + regen > ilen)
+		return -1;
+	    *lit = ip + hlen;
+	    *nlit = regen;
+	    return hlen + regen;
+	} else {
+	    memset(st->lit, ip[hlen], regen);
+	    *lit = st->lit;
+	    *nlit = regen;
+	    return hlen + 1;
+	}
+    }
+
+    streams = format ? 4 : 1;
+    hlen = format < 2 ? 3 : format + 2;
+    if (hlen > ilen)
+	return -1;
+
+    switch (hlen) {
+    case 3:
+	v = get_le24(ip);
+	regen = (v >> 4) & 0x3ff;
+	csize = v >> 14;
+	break;
+    case 4:
+	v = get_le32(ip);
+	regen = (v >> 4) & 0x3fff;
+	csize = v >> 18;
+	break;
+    default:
+	v = get_le32(ip);
+	regen = (v >> 4) & 0x3ffff;
+	csize = (v >> 22) + (ip[4] << 10);
+	break;
+    }
+    used = hlen + csize;
+    if (regen > st->block_max || used > ilen)
+	return -1;
+
+    p = ip + hlen;
+    if (type == LIT_COMPRESSED) {
+	n = huf_read_table(st, p, csize);
+	if (n < 0)
+	    return -1;
+	p += n;
+	csize -= n;
+    } else if (!st->have_huf) {
+	return -1;
+    }
+
+    if (streams == 1) {
+	if (huf_stream(st, p, csize, st->lit, regen))
+	    return -1;
+    } else {
+	/* A jump table, then four streams of a quarter each */
+	if (csize < 6)
+	    return -1;
+	s[0] = get_le16(p);
+	s[1] = get_le16(p + 2);
+	s[2] = get_le16(p + 4);
+	p += 6;
+	csize -= 6;
+	if (s[0] + s[1] + s[2] > csize)
+	    return -1;
+	s[3] = csize - s[0] - s[1] - s[2];
+
+	seg = (regen + 3) / 4;
+	if (3 * seg > regen)
+	    return -1;
+	for (i = 0; i < 4; i++) {
+	    if (huf_stream(st, p, s[i], st->lit + i * seg,
+			   i < 3 ? seg : regen - 3 * seg))
+		return -1;
+	    p += s[i];
+	}
+    }
+
+    *lit = st->lit;
+    *nlit = regen;
+    return used;
+}
+
+/* Set up the FSE table for literal lengths, offsets or match lengths */
+static int zstd_seq_table(struct zstd_state *st, int which, int mode,
+			  const uint8_t **ip, const uint8_t *iend)
+{
+    static const struct {
+	const int16_t *norm;
+	int nsym, log;
+	int max_symbol, max_log;
+    } info[3] = {
+	{ ll_default, LL_MAX_SYMBOL + 1, 6, LL_MAX_SYMBOL, LL_MAX_LOG },
+	{ of_default, 29, 5, OF_MAX_SYMBOL, OF_MAX_LOG },
+	{ ml_default, ML_MAX_SYMBOL + 1, 6, ML_MAX_SYMBOL, ML_MAX_LOG },
+    };
+    struct zstd_fse *t = &st->fse[which];
+    ssize_t n;
+
+    switch (mode) {
+    case SEQ_PREDEFINED:
+	if (fse_build(t, info[which].norm, info[which].nsym, info[which].log))
+	    return -1;
+	break;
+    case SEQ_RLE:
+	if (*ip >= iend || **ip > info[which].max_symbol)
+	    return -1;
+	t->log = 0;
+	t->symbol[0] = *(*ip)++;
+	t->nbits[0] = 0;
+	t->base[0] = 0;
+	break;
+    case SEQ_COMPRESSED:
+	n = fse_read_table(t, *ip, iend - *ip, info[which].max_symbol,
+			   info[which].max_log);
+	if (n < 0)
+	    return -1;
+	*ip += n;
+	break;
+    default:
+	if (!st->have_fse[which])
+	    return -1;
+	break;
+    }
+
+    st->have_fse[which] = true;
+    return 0;
+}
+
+/*
+ * Decode the sequences section and carry out each sequence as it is
+ * decoded: copy literals, then copy a match from the history.  The
+ * block goes to base + start, with the history before it.  Returns the
+ * number of bytes unpacked, or -1.
+ */
+static ssize_t zstd_sequences(struct zstd_state *st, const uint8_t *ip,
+			      size_t ilen, const uint8_t *lit, size_t nlit,
+			      uint8_t *base, size_t start, size_t cap)
+{
+    const uint8_t *iend = ip + ilen;
+    const uint8_t *lend = lit + nlit;
+    uint8_t *op = base + start;
+    uint8_t *oend = base + min(cap, start + st->block_max);
+    struct zstd_fse *ll = &st->fse[0], *of = &st->fse[1], *ml = &st->fse[2];
+    uint32_t ll_state, of_state, ml_state;
+    uint32_t nseq, ofval, llen, mlen, off, idx;
+    const uint8_t *match;
+    struct zbits br;
+    int modes;
+
+    if (ip >= iend)
+	return -1;
+    nseq = *ip++;
+    if (nseq >= 128) {
+	if (nseq == 255) {
+	    if (iend - ip < 2)
+		return -1;
+	    nseq = get_le16(ip) + 0x7f00;
+	    ip += 2;
+	} else {
+	    if (ip >= iend)
+		return -1;
+	    nseq = ((nseq - 128) << 8) + *ip++;
+	}
+    }
+
+    if (nseq) {
+	if (ip >= iend)
+	    return -1;
+	modes = *ip++;
+	if ((modes & 3) ||
+	    zstd_seq_table(st, 0, modes >> 6, &ip, iend) ||
+	    zstd_seq_table(st, 1, (modes >> 4) & 3, &ip, iend) ||
+	    zstd_seq_table(st, 2, (modes >> 2) & 3, &ip, iend) ||
+	    zbits_init(&br, ip, iend - ip))
+	    return -1;
+
+	ll_state = zbits_get(&br, ll->log);
+	of_state = zbits_get(&br, of->log);
+	ml_state = zbits_get(&br, ml->log);
+
+	while (nseq--) {
+	    idx = of->symbol[of_state];
+	    ofval = (1U << idx) + zbits_get(&br, idx);
+	    idx = ml->symbol[ml_state];
+	    mlen = ml_base[idx] + zbits_get(&br, ml_bits[idx]);
+	    idx = ll->symbol[ll_state];
+	    llen = ll_base[idx] + zbits_get(&br, ll_bits[idx]);
+
+	    if (ofval > 3) {
+		off = ofval - 3;
+		st->rep[2] = st->rep[1];
+		st->rep[1] = st->rep[0];
+		st->rep[0] = off;
+	    } else {
+		/* A repeat offset; which one depends on llen */
+		idx = ofval - 1 + !llen;
+		if (!idx) {
+		    off = st->rep[0];
+		} else {
+		    off = idx < 3 ? st->rep[idx] : st->rep[0] - 1;
+		    if (idx > 1)
+			st->rep[2] = st->rep[1];
+		    st->rep[1] = st->rep[0];
+		    st->rep[0] = off;
+		}
+	    }
+
+	    if (nseq) {
+		ll_state = ll->base[ll_state] +
+		    zbits_get(&br, ll->nbits[ll_state]);
+		ml_state = ml->base[ml_state] +
+		    zbits_get(&br, ml->nbits[ml_state]);
+		of_state = of->base[of_state] +
+		    zbits_get(&br, of->nbits[of_state]);
+	    }
+
+	    /* Literals */
+	    if (llen > (size_t)(lend - lit) || llen > (size_t)(oend - op))
+		return -1;
+	    memcpy(op, lit, llen);
+	    op += llen;
+	    lit += llen;
+
+	    /* Match */
+	    if (!off || off > (size_t)(op - base) ||
+		mlen > (size_t)(oend - op))
+		return -1;
+	    match = op - off;
+	    if (off >= mlen) {
+		memcpy(op, match, mlen);
+		op += mlen;
+	    } else {
+		/* Overlapping match: a repeating pattern */
+		while (mlen--)
+		    *op++ = *match++;
+	    }
+	}
+
+	if (br.pos)
+	    return -1;
+    } else if (ip != iend) {
+	return -1;
+    }
+
+    /* Whatever literals are left over */
+    llen = lend - lit;
+    if (llen > (size_t)(oend - op))
+	return -1;
+    memcpy(op, lit, llen);
+    op += llen;
+
+    return op - (base + start);
+}
+
+/*
+ * Read a frame header, skipping any skippable frames.  Returns 1 at the
+ * end of the file.
+ */
+static int zstd_frame_header(struct file_info *fp, struct zstd_state *st)
+{
+    static const uint8_t dict_id_len[4] = { 0, 1, 2, 4 };
+    static const uint8_t fcs_len[4] = { 0, 2, 4, 8 };
+    uint8_t hdr[14], *p;
+    uint64_t window, content_size;
+    bool single;
+    int fcs, len, i;
+
+    for (;;) {
+	if (zstd_input_eof(fp))
+	    return 1;
+
+	if (__file_get_bytes(fp, hdr, 4))
+	    return -1;
+
+	if (get_le32(hdr) == ZSTD_MAGIC)
+	    break;
+	else if ((get_le32(hdr) & ~0xf) == ZSTD_SKIP_MAGIC) {
+	    if (__file_get_bytes(fp, hdr, 4) ||
+		__file_skip_bytes(fp, get_le32(hdr)))
+		return -1;
+	} else {
+	    return -1;
+	}
+    }
+
+    if (__file_get_bytes(fp, hdr, 1))
+	return -1;
+    st->fhd = hdr[0];
+    if (st->fhd & FHD_RESERVED)
+	return -1;
+
+    single = !!(st->fhd & FHD_SINGLE_SEGMENT);
+    fcs = st->fhd >> FHD_FCS_SHIFT;
+    len = !single + dict_id_len[st->fhd & FHD_DICT_ID_MASK] +
+	(fcs ? fcs_len[fcs] : single);
+    if (__file_get_bytes(fp, hdr, len))
+	return -1;
+    p = hdr;
+
+    window = 0;
+    if (!single) {
+	window = (uint64_t)1 << (10 + (*p >> 3));
+	window += (window >> 3) * (*p & 7);
+	p++;
+    }
+
+    /* We have no dictionaries to offer */
+    for (i = 0; i < dict_id_len[st->fhd & FHD_DICT_ID_MASK]; i++) {
+	if (*p++)
+	    return -1;
+    }
+
+    switch (fcs ? fcs_len[fcs] : single) {
+    case 1:
+	content_size = p[0];
+	break;
+    case 2:
+	content_size = get_le16(p) + 256;
+	break;
+    case 4:
+	content_size = get_le32(p);
+	break;
+    case 8:
+	content_size = get_le64(p);
+	break;
+    default:
+	content_size = -1;	/* Unknown */
+	break;
+    }
+
+    if (single)
+	window = content_size;
+    if (window > ZSTD_WINDOW_MAX)
+	return -1;
+
+    if (!st->in) {
+	st->in = malloc(ZSTD_BLOCK_MAX);
+	st->lit = malloc(ZSTD_BLOCK_MAX);
+	if (!st->in || !st->lit)
+	    return -1;
+    }
+
+    st->window = window;
+    st->content_size = content_size;
+    st->frame_out = 0;
+    st->block_max = min(window, ZSTD_BLOCK_MAX);
+    st->rep[0] = 1;
+    st->rep[1] = 4;
+    st->rep[2] = 8;
+    st->have_huf = false;
+    memset(st->have_fse, 0, sizeof st->have_fse);
+    st->in_frame = true;
+    return 0;
+}
+
+/*
+ * Unpack the next block of the frame to base + start, with the history
+ * before it.  Returns the number of bytes unpacked, or -1.
+ */
+static ssize_t zstd_next_block(struct file_info *fp, struct zstd_state *st,
+			       uint8_t *base, size_t start, size_t cap)
+{
+    uint8_t hdr[3];
+    uint32_t bhdr, bsize;
+    const uint8_t *lit;
+    size_t nlit;
+    ssize_t bytes;
+
+    if (__file_get_bytes(fp, hdr, 3))
+	return -1;
+    bhdr = get_le24(hdr);
+    bsize = bhdr >> 3;
+    if (bsize > st->block_max)
+	return -1;
+
+    switch ((bhdr >> 1) & 3) {
+    case BLOCK_RAW:
+	if (bsize > cap - start || __file_get_bytes(fp, base + start, bsize))
+	    return -1;
+	bytes = bsize;
+	break;
+    case BLOCK_RLE:
+	if (bsize > cap - start || __file_get_bytes(fp, hdr, 1))
+	    return -1;
+	memset(base + start, hdr[0], bsize);
+	bytes = bsize;
+	break;
+    case BLOCK_COMPRESSED:
+	if (__file_get_bytes(fp, st->in, bsize))
+	    return -1;
+	bytes = zstd_literals(st, st->in, bsize, &lit, &nlit);
+	if (bytes < 0)
+	    return -1;
+	bytes = zstd_sequences(st, st->in + bytes, bsize - bytes, lit, nlit,
+			       base, start, cap);
+	if (bytes < 0)
+	    return -1;
+	break;
+    default:
+	return -1;
+    }
+
+    st->frame_out += bytes;
+
+    if (bhdr & 1) {
+	/* Last block */
+	st->in_frame = false;
+	if ((st->fhd & FHD_CHECKSUM) && __file_skip_bytes(fp, 4))
+	    return -1;
+	if (st->content_size != (uint64_t)-1 &&
+	    st->frame_out != st->content_size)
+	    return -1;
+    }
+
+    return bytes;
+}
+
+/*
+ * Unpack some more: a whole frame straight into the caller's buffer if
+ * its size is known and it fits, or else the next block into our own.
+ * Returns the number of bytes put in the caller's buffer.
+ */
+static ssize_t zstd_next(struct file_info *fp, struct zstd_state *st,
+			 void *ptr, size_t n)
+{
+    size_t done, keep, hist, need;
+    ssize_t bytes;
+    int rv;
+
+    if (!st->in_frame) {
+	rv = zstd_frame_header(fp, st);
+	if (rv) {
+	    st->eof = rv > 0;
+	    return rv > 0 ? 0 : -1;
+	}
+
+	if (st->content_size <= n) {
+	    for (done = 0; st->in_frame; done += bytes) {
+		bytes = zstd_next_block(fp, st, ptr, done, n);
+		if (bytes < 0)
+		    return -1;
+	    }
+	    return done;
+	}
+
+	/*
+	 * Room for twice the window, so that the history only has to be
+	 * moved down once per window's worth of data.  The window need
+	 * not be bigger than the frame.
+	 */
+	hist = min(st->window, st->content_size);
+	need = 2 * hist + st->block_max;
+	if (st->out_size < need) {
+	    free(st->out);
+	    st->out = malloc(need);
+	    st->out_size = st->out ? need : 0;
+	    if (!st->out)
+		return -1;
+	}
+	st->pos = st->end = 0;	/* Matches never reach into earlier frames */
+    }
+
+    if (st->end + st->block_max > st->out_size) {
+	keep = min(st->end, st->window);
+	memmove(st->out, st->out + st->end - keep, keep);
+	st->pos = st->end = keep;
+    }
+
+    bytes = zstd_next_block(fp, st, st->out, st->end, st->out_size);
+    if (bytes < 0)
+	return -1;
+
+    st->end += bytes;
+    return 0;
+}
+
+static ssize_t zstd_file_read(struct file_info *fp, void *ptr, size_t n)
+{
+    struct zstd_state *st = fp->i.pvt;
+    unsigned char *p = ptr;
+    ssize_t nout = 0;
+    ssize_t bytes;
+
+    while (n) {
+	if (st->pos < st->end) {
+	    bytes = min(n, st->end - st->pos);
+	    memcpy(p, st->out + st->pos, bytes);
+	    st->pos += bytes;
+	} else if (st->eof) {
+	    break;
+	} else {
+	    bytes = zstd_next(fp, st, p, n);
+	    if (bytes < 0) {
+		st->eof = st->error = true;
+		break;
+	    }
+	}
+
+	p += bytes;
+	n -= bytes;
+	nout += bytes;
+    }
+
+    fp->i.offset += nout;
+
+    if (!nout && st->error) {
+	errno = EIO;
+	return -1;
+    }
+    return nout;
+}
+
+static int zstd_file_close(struct file_info *fp)
+{
+    struct zstd_state *st = fp->i.pvt;
+
+    free(st->in);
+    free(st->lit);
+    free(st->out);
+    free(st);
+    return __file_close(fp);
+}
+
+/*
+ * Called from zopen() with the first block of the file in the buffer.
+ * If the frame header gives the unpacked size, that becomes the size
+ * of the file; this assumes the file is a single frame, as the zstd
+ * tool writes it.
+ */
+int __zstd_file_init(struct file_info *fp)
+{
+    static const uint8_t dict_id_len[4] = { 0, 1, 2, 4 };
+    struct zstd_state *st = calloc(1, sizeof *st);
+    const uint8_t *hdr = (const uint8_t *)fp->i.datap;
+    size_t off;
+    int fhd;
+
+    if (!st)
+	return -1;
+
+    fp->i.pvt = st;
+    fp->i.fd.size = -1;		/* Unknown */
+
+    fhd = hdr[4];
+    off = 5 + !(fhd & FHD_SINGLE_SEGMENT) +
+	dict_id_len[fhd & FHD_DICT_ID_MASK];
+    switch (fhd >> FHD_FCS_SHIFT) {
+    case 0:
+	if ((fhd & FHD_SINGLE_SEGMENT) && fp->i.nbytes > off)
+	    fp->i.fd.size = hdr[off];
+	break;
+    case 1:
+	if (fp->i.nbytes >= off + 2)
+	    fp->i.fd.size = get_le16(hdr + off) + 256;
+	break;
+    case 2:
+	if (fp->i.nbytes >= off + 4 && get_le32(hdr + off) != (uint32_t)-1)
+	    fp->i.fd.size = get_le32(hdr + off);
+	break;
+    case 3:
+	if (fp->i.nbytes >= off + 8 && !get_le32(hdr + off + 4) &&
+	    get_le32(hdr + off) != (uint32_t)-1)
+	    fp->i.fd.size = get_le32(hdr + off);
+	break;
+    }
+
+    fp->iop = &zstd_file_dev;
+    return 0;
+}
@@ -66,8 +66,10 @@ int floadfile(FILE * f, void **ptr, size_t * len, const void *prefix,
 	    memcpy(data, prefix, prefix_len);
 	}
 
+	/* Grow geometrically, so the copying done by realloc stays linear */
 	do {
-	    alen += INCREMENTAL_CHUNK;
+	    alen = alen < INCREMENTAL_CHUNK ? alen + INCREMENTAL_CHUNK
+					    : alen << 1;
 	    dp = realloc(data, alen);
 	    if (!dp)
 		goto err;
@@ -179,24 +179,31 @@ static int map_initramfs(struct syslinux_movelist **fraglist,
     return 0;
 }
 
-int syslinux_boot_linux(void *kernel_buf, size_t kernel_size,
-			struct initramfs *initramfs, char *cmdline)
-{
-    struct linux_header hdr, *whdr;
+/*
+ * Where everything goes: the result of looking at the kernel header
+ * and the memory map, before anything is written anywhere.
+ */
+struct linux_layout {
+    struct linux_header hdr;
+    uint16_t video_mode;
+    size_t cmdline_size, cmdline_offset;
     size_t real_mode_size, prot_mode_size;
     addr_t real_mode_base, prot_mode_base;
-    addr_t irf_size;
-    size_t cmdline_size, cmdline_offset;
-    struct syslinux_rm_regs regs;
-    struct syslinux_movelist *fraglist = NULL;
-    struct syslinux_memmap *mmap = NULL;
-    struct syslinux_memmap *amap = NULL;
+    struct syslinux_memmap *mmap;	/* Memory map for shuffle_boot */
+    struct syslinux_memmap *amap;	/* Keep track of available memory */
+};
+
+static int linux_layout(struct linux_layout *ll, const void *kernel_buf,
+			size_t kernel_size, const char *cmdline)
+{
+    struct linux_header *hdr = &ll->hdr;
     bool ok;
     uint32_t memlimit = 0;
-    uint16_t video_mode = 0;
     const char *arg;
 
-    cmdline_size = strlen(cmdline) + 1;
+    ll->mmap = ll->amap = NULL;
+    ll->video_mode = 0;
+    ll->cmdline_size = strlen(cmdline) + 1;
 
     if (kernel_size < 2 * 512)
 	goto bail;
@@ -208,69 +215,63 @@ int syslinux_boot_linux(void *kernel_buf, size_t kernel_size,
     if ((arg = find_argument(cmdline, "vga="))) {
 	switch (arg[0] | 0x20) {
 	case 'a':		/* "ask" */
-	    video_mode = 0xfffd;
+	    ll->video_mode = 0xfffd;
 	    break;
 	case 'e':		/* "ext" */
-	    video_mode = 0xfffe;
+	    ll->video_mode = 0xfffe;
 	    break;
 	case 'n':		/* "normal" */
-	    video_mode = 0xffff;
+	    ll->video_mode = 0xffff;
 	    break;
 	case 'c':		/* "current" */
-	    video_mode = 0x0f04;
+	    ll->video_mode = 0x0f04;
 	    break;
 	default:
-	    video_mode = strtoul(arg, NULL, 0);
+	    ll->video_mode = strtoul(arg, NULL, 0);
 	    break;
 	}
     }
 
     /* Copy the header into private storage */
-    /* Use whdr to modify the actual kernel header */
-    memcpy(&hdr, kernel_buf, sizeof hdr);
-    whdr = (struct linux_header *)kernel_buf;
+    memcpy(hdr, kernel_buf, sizeof *hdr);
 
-    if (hdr.boot_flag != BOOT_MAGIC)
+    if (hdr->boot_flag != BOOT_MAGIC)
 	goto bail;
 
-    if (hdr.header != LINUX_MAGIC) {
-	hdr.version = 0x0100;	/* Very old kernel */
-	hdr.loadflags = 0;
+    if (hdr->header != LINUX_MAGIC) {
+	hdr->version = 0x0100;	/* Very old kernel */
+	hdr->loadflags = 0;
     }
 
-    whdr->vid_mode = video_mode;
+    if (!hdr->setup_sects)
+	hdr->setup_sects = 4;
 
-    if (!hdr.setup_sects)
-	hdr.setup_sects = 4;
+    if (hdr->version < 0x0203)
+	hdr->initrd_addr_max = 0x37ffffff;
 
-    if (hdr.version < 0x0203)
-	hdr.initrd_addr_max = 0x37ffffff;
+    if (!memlimit && memlimit - 1 > hdr->initrd_addr_max)
+	memlimit = hdr->initrd_addr_max + 1;	/* Zero for no limit */
 
-    if (!memlimit && memlimit - 1 > hdr.initrd_addr_max)
-	memlimit = hdr.initrd_addr_max + 1;	/* Zero for no limit */
+    if (hdr->version < 0x0205 || !(hdr->loadflags & LOAD_HIGH))
+	hdr->relocatable_kernel = 0;
 
-    if (hdr.version < 0x0205 || !(hdr.loadflags & LOAD_HIGH))
-	hdr.relocatable_kernel = 0;
+    if (hdr->version < 0x0206)
+	hdr->cmdline_max_len = 256;
 
-    if (hdr.version < 0x0206)
-	hdr.cmdline_max_len = 256;
+    if (ll->cmdline_size > hdr->cmdline_max_len)
+	ll->cmdline_size = hdr->cmdline_max_len;
 
-    if (cmdline_size > hdr.cmdline_max_len) {
-	cmdline_size = hdr.cmdline_max_len;
-	cmdline[cmdline_size - 1] = '\0';
-    }
-
-    if (hdr.version < 0x0202 || !(hdr.loadflags & 0x01))
-	cmdline_offset = (0x9ff0 - cmdline_size) & ~15;
+    if (hdr->version < 0x0202 || !(hdr->loadflags & 0x01))
+	ll->cmdline_offset = (0x9ff0 - ll->cmdline_size) & ~15;
     else
-	cmdline_offset = 0x10000;
+	ll->cmdline_offset = 0x10000;
 
-    real_mode_size = (hdr.setup_sects + 1) << 9;
-    real_mode_base = (hdr.loadflags & LOAD_HIGH) ? 0x10000 : 0x90000;
-    prot_mode_base = (hdr.loadflags & LOAD_HIGH) ? 0x100000 : 0x10000;
-    prot_mode_size = kernel_size - real_mode_size;
+    ll->real_mode_size = (hdr->setup_sects + 1) << 9;
+    ll->real_mode_base = (hdr->loadflags & LOAD_HIGH) ? 0x10000 : 0x90000;
+    ll->prot_mode_base = (hdr->loadflags & LOAD_HIGH) ? 0x100000 : 0x10000;
+    ll->prot_mode_size = kernel_size - ll->real_mode_size;
 
-    if (hdr.version < 0x020a) {
+    if (hdr->version < 0x020a) {
 	/*
 	 * The 3* here is a total fudge factor... it's supposed to
 	 * account for the fact that the kernel needs to be
@@ -278,59 +279,40 @@ int syslinux_boot_linux(void *kernel_buf, size_t kernel_size,
 	 * This doesn't, however, account for the fact that the kernel
 	 * is decompressed into a whole other place, either.
 	 */
-	hdr.init_size = 3 * prot_mode_size;
+	hdr->init_size = 3 * ll->prot_mode_size;
     }
 
-    if (!(hdr.loadflags & LOAD_HIGH) && prot_mode_size > 512 * 1024)
+    if (!(hdr->loadflags & LOAD_HIGH) && ll->prot_mode_size > 512 * 1024)
 	goto bail;		/* Kernel cannot be loaded low */
 
-    if (initramfs && hdr.version < 0x0200)
-	goto bail;		/* initrd/initramfs not supported */
-
-    if (hdr.version >= 0x0200) {
-	whdr->type_of_loader = 0x30;	/* SYSLINUX unknown module */
-	if (hdr.version >= 0x0201) {
-	    whdr->heap_end_ptr = cmdline_offset - 0x0200;
-	    whdr->loadflags |= CAN_USE_HEAP;
-	}
-	if (hdr.version >= 0x0202) {
-	    whdr->cmd_line_ptr = real_mode_base + cmdline_offset;
-	} else {
-	    whdr->old_cmd_line_magic = OLD_CMDLINE_MAGIC;
-	    whdr->old_cmd_line_offset = cmdline_offset;
-	    /* Be paranoid and round up to a multiple of 16 */
-	    whdr->setup_move_size = (cmdline_offset + cmdline_size + 15) & ~15;
-	}
-    }
-
     /* Get the memory map */
-    mmap = syslinux_memory_map();	/* Memory map for shuffle_boot */
-    amap = syslinux_dup_memmap(mmap);	/* Keep track of available memory */
-    if (!mmap || !amap)
+    ll->mmap = syslinux_memory_map();
+    ll->amap = syslinux_dup_memmap(ll->mmap);
+    if (!ll->mmap || !ll->amap)
 	goto bail;
 
     dprintf("Initial memory map:\n");
-    syslinux_dump_memmap(mmap);
+    syslinux_dump_memmap(ll->mmap);
 
     /* If the user has specified a memory limit, mark that as unavailable.
        Question: should we mark this off-limit in the mmap as well (meaning
        it's unavailable to the boot loader, which probably has already touched
        some of it), or just in the amap? */
     if (memlimit)
-	if (syslinux_add_memmap(&amap, memlimit, -memlimit, SMT_RESERVED))
+	if (syslinux_add_memmap(&ll->amap, memlimit, -memlimit, SMT_RESERVED))
 	    goto bail;
 
     /* Place the kernel in memory */
 
     /* First, find a suitable place for the protected-mode code */
-    if (syslinux_memmap_type(amap, prot_mode_base, prot_mode_size)
+    if (syslinux_memmap_type(ll->amap, ll->prot_mode_base, ll->prot_mode_size)
 	!= SMT_FREE) {
 	const struct syslinux_memmap *mp;
-	if (!hdr.relocatable_kernel)
+	if (!hdr->relocatable_kernel)
 	    goto bail;		/* Can't relocate - no hope */
 
 	ok = false;
-	for (mp = amap; mp; mp = mp->next) {
+	for (mp = ll->amap; mp; mp = mp->next) {
 	    addr_t start, end;
 	    start = mp->start;
 	    end = mp->next->start;
@@ -338,19 +320,18 @@ int syslinux_boot_linux(void *kernel_buf, size_t kernel_size,
 	    if (mp->type != SMT_FREE)
 		continue;
 
-	    if (end <= prot_mode_base)
+	    if (end <= ll->prot_mode_base)
 		continue;	/* Only relocate upwards */
 
-	    if (start <= prot_mode_base)
-		start = prot_mode_base;
+	    if (start <= ll->prot_mode_base)
+		start = ll->prot_mode_base;
 
-	    start = ALIGN_UP(start, hdr.kernel_alignment);
+	    start = ALIGN_UP(start, hdr->kernel_alignment);
 	    if (start >= end)
 		continue;
 
-	    if (end - start >= hdr.init_size) {
-		whdr->code32_start += start - prot_mode_base;
-		prot_mode_base = start;
+	    if (end - start >= hdr->init_size) {
+		ll->prot_mode_base = start;
 		ok = true;
 		break;
 	    }
@@ -361,12 +342,13 @@ int syslinux_boot_linux(void *kernel_buf, size_t kernel_size,
     }
 
     /* Real mode code */
-    if (syslinux_memmap_type(amap, real_mode_base,
-			     cmdline_offset + cmdline_size) != SMT_FREE) {
+    if (syslinux_memmap_type(ll->amap, ll->real_mode_base,
+			     ll->cmdline_offset + ll->cmdline_size)
+	!= SMT_FREE) {
 	const struct syslinux_memmap *mp;
 
 	ok = false;
-	for (mp = amap; mp; mp = mp->next) {
+	for (mp = ll->amap; mp; mp = mp->next) {
 	    addr_t start, end;
 	    start = mp->start;
 	    end = mp->next->start;
@@ -374,8 +356,8 @@ int syslinux_boot_linux(void *kernel_buf, size_t kernel_size,
 	    if (mp->type != SMT_FREE)
 		continue;
 
-	    if (start < real_mode_base)
-		start = real_mode_base;	/* Lowest address we'll use */
+	    if (start < ll->real_mode_base)
+		start = ll->real_mode_base;	/* Lowest address we'll use */
 	    if (end > 640 * 1024)
 		end = 640 * 1024;
 
@@ -383,94 +365,189 @@ int syslinux_boot_linux(void *kernel_buf, size_t kernel_size,
 	    if (start > 0x90000 || start >= end)
 		continue;
 
-	    if (end - start >= cmdline_offset + cmdline_size) {
-		real_mode_base = start;
+	    if (end - start >= ll->cmdline_offset + ll->cmdline_size) {
+		ll->real_mode_base = start;
 		ok = true;
 		break;
 	    }
 	}
     }
 
-    if (syslinux_add_movelist(&fraglist, real_mode_base, (addr_t) kernel_buf,
-			      real_mode_size))
+    if (syslinux_add_memmap(&ll->amap, ll->real_mode_base,
+			    ll->cmdline_offset + ll->cmdline_size, SMT_ALLOC))
+	goto bail;
+    if (syslinux_add_memmap(&ll->amap, ll->prot_mode_base,
+			    ll->prot_mode_size, SMT_ALLOC))
 	goto bail;
-    if (syslinux_add_memmap
-	(&amap, real_mode_base, cmdline_offset + cmdline_size, SMT_ALLOC))
+
+    return 0;
+
+bail:
+    syslinux_free_memmap(ll->mmap);
+    syslinux_free_memmap(ll->amap);
+    ll->mmap = ll->amap = NULL;
+    return -1;
+}
+
+/*
+ * Figure out where to put the initramfs.  We should put it at the
+ * highest possible address which is <= hdr.initrd_addr_max, which
+ * fits the entire initramfs.
+ */
+static addr_t place_initramfs(struct syslinux_memmap *amap, addr_t irf_size)
+{
+    addr_t best_addr = 0;
+    struct syslinux_memmap *ml;
+    const addr_t align_mask = INITRAMFS_MAX_ALIGN - 1;
+
+    for (ml = amap; ml->type != SMT_END; ml = ml->next) {
+	addr_t adj_start = (ml->start + align_mask) & ~align_mask;
+	addr_t adj_end = ml->next->start & ~align_mask;
+	if (ml->type == SMT_FREE && adj_end - adj_start >= irf_size)
+	    best_addr = (adj_end - irf_size) & ~align_mask;
+    }
+
+    return best_addr;
+}
+
+/*
+ * Find out where syslinux_boot_linux() is going to put _initramfs_,
+ * so its contents can be loaded there directly and need not be moved
+ * again.  The initramfs chunks only need to have their final sizes,
+ * and only the first LINUX_HEADER_SIZE bytes of the kernel image need
+ * to be in _kernel_buf_ yet; _kernel_size_ and the command line must
+ * be what will be passed to syslinux_boot_linux().  Returns NULL if
+ * the kernel can't be loaded or there is no room.
+ */
+void *syslinux_linux_initramfs_addr(const void *kernel_buf,
+				    size_t kernel_size,
+				    struct initramfs *initramfs,
+				    const char *cmdline)
+{
+    struct linux_layout ll;
+    addr_t irf_size, addr = 0;
+
+    irf_size = initramfs_size(initramfs);
+    if (!irf_size)
+	return NULL;
+
+    if (linux_layout(&ll, kernel_buf, kernel_size, cmdline))
+	return NULL;
+
+    if (ll.hdr.version >= 0x0200)
+	addr = place_initramfs(ll.amap, irf_size);
+
+    syslinux_free_memmap(ll.mmap);
+    syslinux_free_memmap(ll.amap);
+    return (void *)addr;
+}
+
+int syslinux_boot_linux(void *kernel_buf, size_t kernel_size,
+			struct initramfs *initramfs, char *cmdline)
+{
+    struct linux_layout ll;
+    struct linux_header *whdr;
+    addr_t irf_size, irf_addr;
+    struct syslinux_rm_regs regs;
+    struct syslinux_movelist *fraglist = NULL;
+
+    if (linux_layout(&ll, kernel_buf, kernel_size, cmdline))
+	return -1;
+
+    if (initramfs && ll.hdr.version < 0x0200)
+	goto bail;		/* initrd/initramfs not supported */
+
+    /* Use whdr to modify the actual kernel header */
+    whdr = (struct linux_header *)kernel_buf;
+
+    whdr->vid_mode = ll.video_mode;
+
+    if (ll.hdr.relocatable_kernel)
+	whdr->code32_start += ll.prot_mode_base - 0x100000;
+
+    cmdline[ll.cmdline_size - 1] = '\0';
+
+    if (ll.hdr.version >= 0x0200) {
+	whdr->type_of_loader = 0x30;	/* SYSLINUX unknown module */
+	if (ll.hdr.version >= 0x0201) {
+	    whdr->heap_end_ptr = ll.cmdline_offset - 0x0200;
+	    whdr->loadflags |= CAN_USE_HEAP;
+	}
+	if (ll.hdr.version >= 0x0202) {
+	    whdr->cmd_line_ptr = ll.real_mode_base + ll.cmdline_offset;
+	} else {
+	    whdr->old_cmd_line_magic = OLD_CMDLINE_MAGIC;
+	    whdr->old_cmd_line_offset = ll.cmdline_offset;
+	    /* Be paranoid and round up to a multiple of 16 */
+	    whdr->setup_move_size =
+		(ll.cmdline_offset + ll.cmdline_size + 15) & ~15;
+	}
+    }
+
+    if (syslinux_add_movelist(&fraglist, ll.real_mode_base,
+			      (addr_t) kernel_buf, ll.real_mode_size))
 	goto bail;
 
     /* Zero region between real mode code and cmdline */
-    if (syslinux_add_memmap(&mmap, real_mode_base + real_mode_size,
-			    cmdline_offset - real_mode_size, SMT_ZERO))
+    if (syslinux_add_memmap(&ll.mmap, ll.real_mode_base + ll.real_mode_size,
+			    ll.cmdline_offset - ll.real_mode_size, SMT_ZERO))
 	goto bail;
 
     /* Command line */
-    if (syslinux_add_movelist(&fraglist, real_mode_base + cmdline_offset,
-			      (addr_t) cmdline, cmdline_size))
+    if (syslinux_add_movelist(&fraglist, ll.real_mode_base + ll.cmdline_offset,
+			      (addr_t) cmdline, ll.cmdline_size))
 	goto bail;
 
     /* Protected-mode code */
-    if (syslinux_add_movelist(&fraglist, prot_mode_base,
-			      (addr_t) kernel_buf + real_mode_size,
-			      prot_mode_size))
+    if (syslinux_add_movelist(&fraglist, ll.prot_mode_base,
+			      (addr_t) kernel_buf + ll.real_mode_size,
+			      ll.prot_mode_size))
 	goto bail;
-    if (syslinux_add_memmap(&amap, prot_mode_base, prot_mode_size, SMT_ALLOC))
-	goto bail;
-
-    /* Figure out the size of the initramfs, and where to put it.
-       We should put it at the highest possible address which is
-       <= hdr.initrd_addr_max, which fits the entire initramfs. */
 
+    /*
+     * If the initramfs was loaded with the help of
+     * syslinux_linux_initramfs_addr(), it already sits where it is
+     * going, and the shuffler drops those moves.
+     */
     irf_size = initramfs_size(initramfs);	/* Handles initramfs == NULL */
 
     if (irf_size) {
-	addr_t best_addr = 0;
-	struct syslinux_memmap *ml;
-	const addr_t align_mask = INITRAMFS_MAX_ALIGN - 1;
-
-	if (irf_size) {
-	    for (ml = amap; ml->type != SMT_END; ml = ml->next) {
-		addr_t adj_start = (ml->start + align_mask) & ~align_mask;
-		addr_t adj_end = ml->next->start & ~align_mask;
-		if (ml->type == SMT_FREE && adj_end - adj_start >= irf_size)
-		    best_addr = (adj_end - irf_size) & ~align_mask;
-	    }
-
-	    if (!best_addr)
-		goto bail;	/* Insufficient memory for initramfs */
+	irf_addr = place_initramfs(ll.amap, irf_size);
+	if (!irf_addr)
+	    goto bail;		/* Insufficient memory for initramfs */
 
-	    whdr->ramdisk_image = best_addr;
-	    whdr->ramdisk_size = irf_size;
+	whdr->ramdisk_image = irf_addr;
+	whdr->ramdisk_size = irf_size;
 
-	    if (syslinux_add_memmap(&amap, best_addr, irf_size, SMT_ALLOC))
-		goto bail;
+	if (syslinux_add_memmap(&ll.amap, irf_addr, irf_size, SMT_ALLOC))
+	    goto bail;
 
-	    if (map_initramfs(&fraglist, &mmap, initramfs, best_addr))
-		goto bail;
-	}
+	if (map_initramfs(&fraglist, &ll.mmap, initramfs, irf_addr))
+	    goto bail;
     }
 
     /* Set up the registers on entry */
     memset(&regs, 0, sizeof regs);
-    regs.es = regs.ds = regs.ss = regs.fs = regs.gs = real_mode_base >> 4;
-    regs.cs = (real_mode_base >> 4) + 0x20;
+    regs.es = regs.ds = regs.ss = regs.fs = regs.gs = ll.real_mode_base >> 4;
+    regs.cs = (ll.real_mode_base >> 4) + 0x20;
     /* regs.ip = 0; */
     /* Linux is OK with sp = 0 = 64K, but perhaps other things aren't... */
-    regs.esp.w[0] = min(cmdline_offset, (size_t) 0xfff0);
+    regs.esp.w[0] = min(ll.cmdline_offset, (size_t) 0xfff0);
 
     dprintf("Final memory map:\n");
-    syslinux_dump_memmap(mmap);
+    syslinux_dump_memmap(ll.mmap);
 
     dprintf("Final available map:\n");
-    syslinux_dump_memmap(amap);
+    syslinux_dump_memmap(ll.amap);
 
     dprintf("Initial movelist:\n");
     syslinux_dump_movelist(fraglist);
 
-    syslinux_shuffle_boot_rm(fraglist, mmap, 0, &regs);
+    syslinux_shuffle_boot_rm(fraglist, ll.mmap, 0, &regs);
 
 bail:
     syslinux_free_movelist(fraglist);
-    syslinux_free_memmap(mmap);
-    syslinux_free_memmap(amap);
+    syslinux_free_memmap(ll.mmap);
+    syslinux_free_memmap(ll.amap);
     return -1;
 }
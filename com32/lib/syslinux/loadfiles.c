@@ -0,0 +1,221 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2026 The Syslinux Authors - All Rights Reserved
+ *
+ *   Permission is hereby granted, free of charge, to any person
+ *   obtaining a copy of this software and associated documentation
+ *   files (the "Software"), to deal in the Software without
+ *   restriction, including without limitation the rights to use,
+ *   copy, modify, merge, publish, distribute, sublicense, and/or
+ *   sell copies of the Software, and to permit persons to whom
+ *   the Software is furnished to do so, subject to the following
+ *   conditions:
+ *
+ *   The above copyright notice and this permission notice shall
+ *   be included in all copies or substantial portions of the Software.
+ *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *   OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ *   HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ *   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ *   OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * loadfiles.c
+ *
+ * Read the contents of several data files into malloc'd buffers, or
+ * where the caller wants them, letting the core interleave the
+ * transfers if it knows how.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <com32.h>
+#include <syslinux/pmapi.h>
+
+#include <syslinux/loadfile.h>
+
+#define UNKNOWN_SIZE	((size_t)(uint32_t)-1)
+
+/* Read the partial block at the end of a placed file */
+static int read_tail(struct com32_readfile *rf, size_t len, int blocklg2)
+{
+    size_t bsize = (size_t)1 << blocklg2;
+    size_t bytes;
+    char *tmp;
+
+    tmp = malloc(bsize);
+    if (!tmp)
+	return -1;
+
+    bytes = __com32.cs_pm->read_file(&rf->handle, tmp, 1);
+    if (bytes > len - rf->bytes)
+	bytes = len - rf->bytes;
+    memcpy((char *)rf->buf + rf->bytes, tmp, bytes);
+    rf->bytes += bytes;
+
+    free(tmp);
+    return 0;
+}
+
+/*
+ * Like loadfiles(), but once the sizes are known _place_ gets to say
+ * where the files should go, by filling in ptrs[] and returning 0.
+ * Placed files are read without touching anything past lens[i] bytes,
+ * and without the zero padding loadfile() gives.  If there is no
+ * _place_, it declines, or not all sizes are known in advance, the
+ * files end up in malloc'd buffers as with loadfiles().
+ *
+ * Returns 1 if the files were placed, 0 if they were malloc'd, and -1
+ * on error; nothing that _place_ handed out is freed.
+ */
+int loadfiles_placed(const char **names, void **ptrs, size_t *lens,
+		     int count, loadfiles_place_t place, void *arg)
+{
+    struct com32_readfile *rf;
+    struct com32_filedata fd;
+    int *blocklg2;
+    size_t align;
+    bool placed = false;
+    int i, e;
+
+    if (__com32.cs_pm->__pmapi_size <
+	offsetof(struct com32_pmapi, read_files) + sizeof(void *)) {
+	/* Old core, one file at a time */
+	for (i = 0; i < count; i++) {
+	    if (loadfile(names[i], &ptrs[i], &lens[i]))
+		goto err_loaded;
+	}
+	return 0;
+    }
+
+    rf = calloc(count, sizeof *rf);
+    blocklg2 = calloc(count, sizeof *blocklg2);
+    if (!rf || !blocklg2) {
+	free(rf);
+	free(blocklg2);
+	return -1;
+    }
+
+    for (i = 0; i < count; i++)
+	ptrs[i] = NULL;
+
+    /* Open everything first, so all the transfers can get going */
+    for (i = 0; i < count; i++) {
+	if (__com32.cs_pm->open_file(names[i], &fd) < 0) {
+	    errno = ENOENT;
+	    goto err;
+	}
+
+	if (fd.size == UNKNOWN_SIZE) {
+	    /* Size unknown, leave it for loadfile() below */
+	    __com32.cs_pm->close_file(fd.handle);
+	    place = NULL;
+	    continue;
+	}
+
+	lens[i] = fd.size;
+	rf[i].handle = fd.handle;
+	blocklg2[i] = fd.blocklg2;
+    }
+
+    if (place && !place(arg, ptrs, lens, count)) {
+	/* Whole blocks go straight in; the rest is done by read_tail() */
+	placed = true;
+	for (i = 0; i < count; i++) {
+	    rf[i].buf = ptrs[i];
+	    rf[i].size = lens[i] & ~(((size_t)1 << blocklg2[i]) - 1);
+	}
+    } else {
+	for (i = 0; i < count; i++) {
+	    ptrs[i] = NULL;
+	    if (!rf[i].handle)
+		continue;
+
+	    /* Whole blocks only, and the zero padding loadfile() promises */
+	    align = (size_t)1 << blocklg2[i];
+	    if (align < LOADFILE_ZERO_PAD)
+		align = LOADFILE_ZERO_PAD;
+
+	    rf[i].size = (lens[i] + align - 1) & ~(align - 1);
+	    rf[i].buf = ptrs[i] = malloc(rf[i].size);
+	    if (!ptrs[i]) {
+		errno = ENOMEM;
+		goto err;
+	    }
+	}
+    }
+
+    if (__com32.cs_pm->read_files(rf, count)) {
+	errno = EIO;
+	goto err;
+    }
+
+    for (i = 0; i < count; i++) {
+	if (!ptrs[i])
+	    continue;
+
+	if (placed && rf[i].handle && rf[i].bytes < lens[i] &&
+	    read_tail(&rf[i], lens[i], blocklg2[i])) {
+	    errno = ENOMEM;
+	    goto err;
+	}
+
+	if (rf[i].handle) {
+	    __com32.cs_pm->close_file(rf[i].handle);
+	    rf[i].handle = 0;
+	}
+
+	if (rf[i].bytes < lens[i]) {
+	    errno = EIO;
+	    goto err;
+	}
+
+	if (!placed)
+	    memset((char *)ptrs[i] + lens[i], 0, rf[i].size - lens[i]);
+    }
+
+    for (i = 0; i < count; i++) {
+	if (!ptrs[i] && loadfile(names[i], &ptrs[i], &lens[i]))
+	    goto err;
+    }
+
+    free(rf);
+    free(blocklg2);
+    return placed;
+
+err:
+    e = errno;
+    for (i = 0; i < count; i++) {
+	if (rf[i].handle)
+	    __com32.cs_pm->close_file(rf[i].handle);
+    }
+    free(rf);
+    free(blocklg2);
+    errno = e;
+    if (placed)
+	return -1;
+    i = count;
+err_loaded:
+    e = errno;
+    while (i--) {
+	free(ptrs[i]);
+	ptrs[i] = NULL;
+    }
+    errno = e;
+    return -1;
+}
+
+int loadfiles(const char **names, void **ptrs, size_t *lens, int count)
+{
+    return loadfiles_placed(names, ptrs, lens, count, NULL, NULL) < 0
+	? -1 : 0;
+}
@@ -42,6 +42,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 #include <setjmp.h>
 #include <minmax.h>
@@ -52,6 +53,10 @@
 
 static jmp_buf new_movelist_bail;
 
+/*
+ * Move list entries that go to the caller are malloc'd one by one,
+ * since that is what syslinux_free_movelist() expects.
+ */
 static struct syslinux_movelist *new_movelist(addr_t dst, addr_t src,
 					      addr_t len)
 {
@@ -68,12 +73,63 @@ static struct syslinux_movelist *new_movelist(addr_t dst, addr_t src,
     return ml;
 }
 
+/*
+ * The fragments we are working on get split all the time, so they come
+ * out of a pool instead, which is freed in one go.  Nothing is returned
+ * to the pool before then, so a dead fragment can safely stay in the
+ * index below.
+ */
+#define FRAG_CHUNK	64
+
+struct frag_chunk {
+    struct frag_chunk *next;
+    unsigned int used;
+    struct syslinux_movelist frag[FRAG_CHUNK];
+};
+
+static struct frag_chunk *frag_chunks;
+
+static struct syslinux_movelist *new_frag(addr_t dst, addr_t src, addr_t len)
+{
+    struct syslinux_movelist *ml;
+    struct frag_chunk *fc = frag_chunks;
+
+    if (!fc || fc->used == FRAG_CHUNK) {
+	fc = malloc(sizeof *fc);
+	if (!fc)
+	    longjmp(new_movelist_bail, 1);
+
+	fc->next = frag_chunks;
+	fc->used = 0;
+	frag_chunks = fc;
+    }
+
+    ml = &fc->frag[fc->used++];
+
+    ml->dst = dst;
+    ml->src = src;
+    ml->len = len;
+    ml->next = NULL;
+
+    return ml;
+}
+
+static void free_frags(void)
+{
+    struct frag_chunk *fc;
+
+    while ((fc = frag_chunks)) {
+	frag_chunks = fc->next;
+	free(fc);
+    }
+}
+
 static struct syslinux_movelist *dup_movelist(struct syslinux_movelist *src)
 {
     struct syslinux_movelist *dst = NULL, **dstp = &dst, *ml;
 
     while (src) {
-	ml = new_movelist(src->dst, src->src, src->len);
+	ml = new_frag(src->dst, src->src, src->len);
 	*dstp = ml;
 	dstp = &ml->next;
 	src = src->next;
@@ -82,12 +138,269 @@ static struct syslinux_movelist *dup_movelist(struct syslinux_movelist *src)
     return dst;
 }
 
-static void
-add_freelist(struct syslinux_memmap **mmap, addr_t start,
-	     addr_t len, enum syslinux_memmap_types type)
+/*
+ * The planner's own picture of memory.  It holds the same information
+ * as a struct syslinux_memmap, but as a sorted array, so finding the
+ * zone an address is in is a binary search rather than a list walk.
+ * Zone i runs from zone[i].start up to zone[i+1].start; the last entry
+ * marks the end of memory at 4 GB.  As in a memmap, adjacent zones
+ * never have the same type.
+ */
+struct freezone {
+    uint64_t start;
+    enum syslinux_memmap_types type;
+};
+
+struct freerange {
+    addr_t start, len;
+};
+
+struct freemap {
+    struct freezone *zone;
+    size_t count;		/* Including the end marker */
+    size_t alloc;
+
+    /* Ranges freed since the planner last looked */
+    struct freerange *freed;
+    size_t nfreed;
+    size_t freed_alloc;
+};
+
+#define FREEMAP_END	((uint64_t)1 << 32)
+
+static void freemap_grow(struct freemap *fm, size_t count)
+{
+    struct freezone *zone;
+    size_t alloc;
+
+    if (count <= fm->alloc)
+	return;
+
+    alloc = fm->alloc ? fm->alloc : 32;
+    while (alloc < count)
+	alloc <<= 1;
+
+    zone = realloc(fm->zone, alloc * sizeof *zone);
+    if (!zone)
+	longjmp(new_movelist_bail, 1);
+
+    fm->zone = zone;
+    fm->alloc = alloc;
+}
+
+/* Index of the zone containing addr */
+static size_t freemap_find(const struct freemap *fm, uint64_t addr)
+{
+    size_t lo = 0, hi = fm->count - 1, mid;
+
+    while (hi - lo > 1) {
+	mid = (lo + hi) >> 1;
+	if (fm->zone[mid].start <= addr)
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+
+    return lo;
+}
+
+static uint64_t zone_len(const struct freemap *fm, size_t i)
+{
+    return fm->zone[i+1].start - fm->zone[i].start;
+}
+
+/*
+ * Mark a range as a certain type, like syslinux_add_memmap()
+ */
+static void add_freelist(struct freemap *fm, addr_t start, addr_t len,
+			 enum syslinux_memmap_types type)
+{
+    struct freezone nz[3];
+    uint64_t end = (uint64_t)start + len;
+    size_t i, j, k, n, first, last;
+
+    dprintf("F: 0x%08x bytes at 0x%08x -> %d\n", len, start, type);
+
+    if (!len)
+	return;
+
+    if (type == SMT_FREE) {
+	if (fm->nfreed == fm->freed_alloc) {
+	    struct freerange *freed;
+	    size_t alloc = fm->freed_alloc ? fm->freed_alloc << 1 : 32;
+
+	    freed = realloc(fm->freed, alloc * sizeof *freed);
+	    if (!freed)
+		longjmp(new_movelist_bail, 1);
+	    fm->freed = freed;
+	    fm->freed_alloc = alloc;
+	}
+	fm->freed[fm->nfreed].start = start;
+	fm->freed[fm->nfreed++].len = len;
+    }
+
+    i = freemap_find(fm, start);
+    j = freemap_find(fm, end - 1);
+
+    /* Zones i..j are replaced by up to three new ones */
+    n = 0;
+    if (fm->zone[i].start < start) {
+	nz[n].start = fm->zone[i].start;
+	nz[n++].type = fm->zone[i].type;
+    }
+    nz[n].start = start;
+    nz[n++].type = type;
+    if (end < fm->zone[j+1].start) {
+	nz[n].start = end;
+	nz[n++].type = fm->zone[j].type;
+    }
+
+    freemap_grow(fm, fm->count + n);
+    memmove(&fm->zone[i+n], &fm->zone[j+1],
+	    (fm->count - (j+1)) * sizeof *fm->zone);
+    memcpy(&fm->zone[i], nz, n * sizeof *nz);
+    fm->count += n - (j+1-i);
+
+    /* Merge with the neighbours where the types now match */
+    first = i ? i : 1;
+    last = i + n;
+    for (k = first; k <= last && k < fm->count - 1; ) {
+	if (fm->zone[k].type == fm->zone[k-1].type) {
+	    memmove(&fm->zone[k], &fm->zone[k+1],
+		    (fm->count - (k+1)) * sizeof *fm->zone);
+	    fm->count--;
+	    last--;
+	} else {
+	    k++;
+	}
+    }
+}
+
+static void init_freelist(struct freemap *fm,
+			  const struct syslinux_memmap *memmap)
+{
+    const struct syslinux_memmap *mm;
+    enum syslinux_memmap_types type;
+
+    memset(fm, 0, sizeof *fm);
+
+    /* Anything that is SMT_FREE or SMT_ZERO is fair game */
+    for (mm = memmap; mm->type != SMT_END; mm = mm->next) {
+	type = mm->type == SMT_ZERO ? SMT_FREE : mm->type;
+	if (fm->count && fm->zone[fm->count-1].type == type)
+	    continue;
+	freemap_grow(fm, fm->count + 2);
+	fm->zone[fm->count].start = mm->start;
+	fm->zone[fm->count++].type = type;
+    }
+
+    freemap_grow(fm, fm->count + 1);
+    fm->zone[fm->count].start = FREEMAP_END;
+    fm->zone[fm->count++].type = SMT_END;
+}
+
+/*
+ * An index of the fragments by destination, so that when some memory
+ * is freed we can find the fragments that may now be able to move
+ * without walking the whole list.  Live fragments never have
+ * overlapping destinations, and a fragment that has been moved is
+ * marked dead by setting its length to zero.
+ *
+ * Fragments split off while planning are appended unsorted and merged
+ * into the sorted part in batches.
+ */
+#define INDEX_TAIL	64
+
+static struct syslinux_movelist **frag_index;
+static size_t index_count, index_sorted, index_alloc;
+
+static int cmp_dst(const void *a, const void *b)
+{
+    const struct syslinux_movelist *const *ma = a, *const *mb = b;
+
+    return (*ma)->dst < (*mb)->dst ? -1 : (*ma)->dst > (*mb)->dst;
+}
+
+static void index_grow(size_t count)
 {
-    if (syslinux_add_memmap(mmap, start, len, type))
+    struct syslinux_movelist **idx;
+    size_t alloc;
+
+    if (count <= index_alloc)
+	return;
+
+    alloc = index_alloc ? index_alloc : 64;
+    while (alloc < count)
+	alloc <<= 1;
+
+    idx = realloc(frag_index, alloc * sizeof *idx);
+    if (!idx)
 	longjmp(new_movelist_bail, 1);
+
+    frag_index = idx;
+    index_alloc = alloc;
+}
+
+/* Merge the unsorted tail into the sorted part, dropping dead fragments */
+static void index_merge(void)
+{
+    struct syslinux_movelist *tail[INDEX_TAIL], **v = frag_index;
+    size_t nt = 0, ns = 0, i, j, k;
+
+    for (i = index_sorted; i < index_count; i++)
+	if (v[i]->len)
+	    tail[nt++] = v[i];
+    qsort(tail, nt, sizeof *tail, cmp_dst);
+
+    for (i = 0; i < index_sorted; i++)
+	if (v[i]->len)
+	    v[ns++] = v[i];
+
+    /* Merge from the top down */
+    i = ns, j = nt, k = ns + nt;
+    while (j) {
+	if (i && v[i-1]->dst > tail[j-1]->dst)
+	    v[--k] = v[--i];
+	else
+	    v[--k] = tail[--j];
+    }
+
+    index_count = index_sorted = ns + nt;
+}
+
+static void index_add(struct syslinux_movelist *f)
+{
+    if (index_count - index_sorted == INDEX_TAIL)
+	index_merge();
+
+    index_grow(index_count + 1);
+    frag_index[index_count++] = f;
+}
+
+static void index_init(struct syslinux_movelist *frags)
+{
+    struct syslinux_movelist *f;
+
+    index_count = index_sorted = 0;
+    for (f = frags; f; f = f->next) {
+	index_grow(index_count + 1);
+	frag_index[index_count++] = f;
+    }
+    qsort(frag_index, index_count, sizeof *frag_index, cmp_dst);
+    index_sorted = index_count;
+}
+
+static void index_free(void)
+{
+    free(frag_index);
+    frag_index = NULL;
+    index_count = index_sorted = index_alloc = 0;
+}
+
+static bool frag_hits(const struct syslinux_movelist *f,
+			     addr_t start, uint64_t end)
+{
+    return f->len && f->dst < end && (uint64_t)f->dst + f->len > start;
 }
 
 /*
@@ -107,7 +420,8 @@ static struct syslinux_movelist **split_movelist(addr_t start, addr_t len,
     if (start > ml->src) {
 	addr_t l = start - ml->src;
 
-	m = new_movelist(ml->dst + l, start, ml->len - l);
+	m = new_frag(ml->dst + l, start, ml->len - l);
+	index_add(m);
 	m->next = ml->next;
 	ml->len = l;
 	ml->next = m;
@@ -120,7 +434,8 @@ static struct syslinux_movelist **split_movelist(addr_t start, addr_t len,
     if (ml->len > len) {
 	addr_t l = ml->len - len;
 
-	m = new_movelist(ml->dst + len, ml->src + len, l);
+	m = new_frag(ml->dst + len, ml->src + len, l);
+	index_add(m);
 	m->next = ml->next;
 	ml->len = len;
 	ml->next = m;
@@ -131,89 +446,124 @@ static struct syslinux_movelist **split_movelist(addr_t start, addr_t len,
 
 static void delete_movelist(struct syslinux_movelist **parentptr)
 {
-    struct syslinux_movelist *o = *parentptr;
-    *parentptr = o->next;
-    free(o);
-}
-
-static void free_movelist(struct syslinux_movelist **parentptr)
-{
-    while (*parentptr)
-	delete_movelist(parentptr);
+    *parentptr = (*parentptr)->next;
 }
 
 /*
- * Scan the freelist looking for a particular chunk of memory
+ * Check if a particular chunk of memory is free; returns the index of
+ * the free zone it is in, or -1.
  */
-static const struct syslinux_memmap *is_free_zone(const struct syslinux_memmap
-						  *list, addr_t start,
-						  addr_t len)
+static int is_free_zone(const struct freemap *fm, addr_t start, addr_t len)
 {
+    size_t i;
+
     dprintf("f: 0x%08x bytes at 0x%08x\n", len, start);
 
-    addr_t last, llast;
+    i = freemap_find(fm, start);
+    if (fm->zone[i].type != SMT_FREE ||
+	fm->zone[i+1].start < (uint64_t)start + len)
+	return -1;
 
-    last = start + len - 1;
+    dprintf("F: 0x%08llx bytes at 0x%08llx\n",
+	    zone_len(fm, i), fm->zone[i].start);
+    return i;
+}
 
-    while (list->type != SMT_END) {
-	llast = list->next->start - 1;
-	if (list->start <= start) {
-	    if (llast >= last) {
-		/* Chunk has a single, well-defined type */
-		if (list->type == SMT_FREE) {
-		    dprintf("F: 0x%08x bytes at 0x%08x\n",
-			    list->next->start, list->start);
-		    return list;	/* It's free */
-		}
-		return NULL;	/* Not free */
-	    } else if (llast >= start) {
-		return NULL;	/* Crosses region boundary */
-	    }
+/*
+ * Scan the freelist looking for the smallest chunk of memory which
+ * can fit X bytes; returns the length of the block on success.
+ */
+static addr_t free_area(const struct freemap *fm, addr_t len, addr_t *start)
+{
+    uint64_t slen, best_len = 0;
+    size_t i;
+
+    for (i = 0; i < fm->count - 1; i++) {
+	if (fm->zone[i].type != SMT_FREE)
+	    continue;
+	slen = zone_len(fm, i);
+	if (slen >= len && (!best_len || best_len > slen)) {
+	    *start = fm->zone[i].start;
+	    best_len = slen;
 	}
-	list = list->next;
     }
 
-    return NULL;		/* Internal error? */
+    return min(best_len, (uint64_t)0xffffffff);
 }
 
 /*
- * Scan the freelist looking for the smallest chunk of memory which
- * can fit X bytes; returns the length of the block on success.
+ * Find the largest free zone; returns -1 if there is none.
  */
-static addr_t free_area(const struct syslinux_memmap *mmap,
-			addr_t len, addr_t * start)
+static int largest_free_area(const struct freemap *fm,
+			     addr_t *start, addr_t *len)
 {
-    const struct syslinux_memmap *best = NULL;
-    const struct syslinux_memmap *s;
-    addr_t slen, best_len = -1;
+    uint64_t slen, best_len = 0;
+    size_t i;
 
-    for (s = mmap; s->type != SMT_END; s = s->next) {
-	if (s->type != SMT_FREE)
+    for (i = 0; i < fm->count - 1; i++) {
+	if (fm->zone[i].type != SMT_FREE)
 	    continue;
-	slen = s->next->start - s->start;
-	if (slen >= len) {
-	    if (!best || best_len > slen) {
-		best = s;
-		best_len = slen;
-	    }
+	slen = zone_len(fm, i);
+	if (slen > best_len) {
+	    *start = fm->zone[i].start;
+	    best_len = slen;
 	}
     }
 
-    if (best) {
-	*start = best->start;
-	return best_len;
-    } else {
-	return 0;
-    }
+    if (!best_len)
+	return -1;
+
+    *len = min(best_len, (uint64_t)0xffffffff);
+    return 0;
 }
 
 /*
  * Remove a chunk from the freelist
  */
-static void
-allocate_from(struct syslinux_memmap **mmap, addr_t start, addr_t len)
+static void allocate_from(struct freemap *fm, addr_t start, addr_t len)
+{
+    add_freelist(fm, start, len, SMT_ALLOC);
+}
+
+static int cmp_src(const void *a, const void *b)
+{
+    const struct syslinux_movelist *const *ma = a, *const *mb = b;
+
+    return (*ma)->src < (*mb)->src ? -1 : (*ma)->src > (*mb)->src;
+}
+
+/*
+ * Do any of the sources overlap?  Sorted by address, if any two do,
+ * then so do two neighbours.
+ */
+static bool sources_overlap(struct syslinux_movelist *frags)
 {
-    syslinux_add_memmap(mmap, start, len, SMT_ALLOC);
+    struct syslinux_movelist *f, **fv;
+    size_t i, n = 0;
+    bool overlap = false;
+
+    for (f = frags; f; f = f->next)
+	n++;
+    if (n < 2)
+	return false;
+
+    fv = malloc(n * sizeof *fv);
+    if (!fv)
+	longjmp(new_movelist_bail, 1);
+
+    for (i = 0, f = frags; f; f = f->next)
+	fv[i++] = f;
+    qsort(fv, n, sizeof *fv, cmp_src);
+
+    for (i = 1; i < n; i++) {
+	if ((uint64_t)fv[i-1]->src + fv[i-1]->len > fv[i]->src) {
+	    overlap = true;
+	    break;
+	}
+    }
+
+    free(fv);
+    return overlap;
 }
 
 /*
@@ -233,6 +583,10 @@ static void shuffle_dealias(struct syslinux_movelist **fraglist,
 
     *postcopy = NULL;
 
+    /* The common case is no aliasing at all, which is cheap to find out */
+    if (!sources_overlap(*fraglist))
+	return;
+
     /*
      * Note: as written, this is an O(n^2) algorithm; by producing a list
      * sorted by destination address we could reduce it to O(n log n).
@@ -261,8 +615,8 @@ static void shuffle_dealias(struct syslinux_movelist **fraglist,
 
 	    if (pe > xe) {
 		delta = pe - xe;
-		np = new_movelist(mp->dst + mp->len - delta,
-				  mp->src + mp->len - delta, delta);
+		np = new_frag(mp->dst + mp->len - delta,
+			      mp->src + mp->len - delta, delta);
 		mp->len -= delta;
 		pe = xe;
 		np->next = *mpp;
@@ -271,7 +625,7 @@ static void shuffle_dealias(struct syslinux_movelist **fraglist,
 	    }
 	    if (ps < xs) {
 		delta = xs - ps;
-		np = new_movelist(mp->dst, ps, delta);
+		np = new_frag(mp->dst, ps, delta);
 		mp->src += delta;
 		ps = mp->src;
 		mp->dst += delta;
@@ -307,31 +661,78 @@ restart:
 }
 
 /*
- * The code to actually emit moving of a chunk into its final place.
+ * What a fragment needs before it can be moved into place: the part of
+ * its destination it does not already occupy itself.
  */
-static void
-move_chunk(struct syslinux_movelist ***moves,
-	   struct syslinux_memmap **mmap,
-	   struct syslinux_movelist **fp, addr_t copylen)
+static void frag_need(const struct syslinux_movelist *f, addr_t *needbase,
+		      addr_t *needlen, int *reverse, addr_t *cbyte)
 {
-    addr_t copydst, copysrc;
-    addr_t freebase, freelen;
-    addr_t needlen;
-    int reverse;
-    struct syslinux_movelist *f = *fp, *mv;
-
     if (f->src < f->dst && (f->dst - f->src) < f->len) {
 	/* "Shift up" type overlap */
-	needlen = f->dst - f->src;
-	reverse = 1;
+	*needlen = f->dst - f->src;
+	*needbase = f->dst + (f->len - *needlen);
+	*reverse = 1;
+	*cbyte = f->dst + f->len - 1;
     } else if (f->src > f->dst && (f->src - f->dst) < f->len) {
 	/* "Shift down" type overlap */
-	needlen = f->src - f->dst;
-	reverse = 0;
+	*needlen = f->src - f->dst;
+	*needbase = f->dst;
+	*reverse = 0;
+	*cbyte = f->dst;	/* "Critical byte" */
     } else {
-	needlen = f->len;
-	reverse = 0;
+	*needlen = f->len;
+	*needbase = f->dst;
+	*reverse = 0;
+	*cbyte = f->dst;	/* "Critical byte" */
     }
+}
+
+/*
+ * Emit the move of an entire fragment to its destination, and give back
+ * the memory it no longer needs.  The caller has already claimed the
+ * memory it needs.
+ */
+static void emit_move(struct syslinux_movelist ***moves, struct freemap *fm,
+		      struct syslinux_movelist *f)
+{
+    struct syslinux_movelist *mv;
+    addr_t freebase, freelen;
+
+    mv = new_movelist(f->dst, f->src, f->len);
+    dprintf("A: 0x%08x bytes at 0x%08x -> 0x%08x\n", mv->len, mv->src, mv->dst);
+    **moves = mv;
+    *moves = &mv->next;
+
+    /* Figure out what memory we just freed up */
+    if (f->dst > f->src) {
+	freebase = f->src;
+	freelen = min(f->len, f->dst - f->src);
+    } else if (f->src >= f->dst + f->len) {
+	freebase = f->src;
+	freelen = f->len;
+    } else {
+	freelen = f->src - f->dst;
+	freebase = f->dst + f->len;
+    }
+
+    dprintf("F: 0x%08x bytes at 0x%08x\n", freelen, freebase);
+
+    add_freelist(fm, freebase, freelen, SMT_FREE);
+}
+
+/*
+ * The code to actually emit moving of a chunk into its final place.
+ */
+static void
+move_chunk(struct syslinux_movelist ***moves, struct freemap *fm,
+	   struct syslinux_movelist **fp, addr_t copylen)
+{
+    addr_t copydst, copysrc;
+    addr_t needbase, needlen, cbyte;
+    int reverse;
+    struct syslinux_movelist *f = *fp;
+
+    frag_need(f, &needbase, &needlen, &reverse, &cbyte);
 
     copydst = f->dst;
     copysrc = f->src;
@@ -352,28 +753,82 @@ move_chunk(struct syslinux_movelist ***moves,
 	f = *fp;
     }
 
-    mv = new_movelist(f->dst, f->src, f->len);
-    dprintf("A: 0x%08x bytes at 0x%08x -> 0x%08x\n", mv->len, mv->src, mv->dst);
-    **moves = mv;
-    *moves = &mv->next;
+    emit_move(moves, fm, f);
+    f->len = 0;			/* Still in the index; don't move it again */
+    delete_movelist(fp);
+}
 
-    /* Figure out what memory we just freed up */
-    if (f->dst > f->src) {
-	freebase = f->src;
-	freelen = min(f->len, f->dst - f->src);
-    } else if (f->src >= f->dst + f->len) {
-	freebase = f->src;
-	freelen = f->len;
-    } else {
-	freelen = f->src - f->dst;
-	freebase = f->dst + f->len;
+/*
+ * Move a fragment straight to its final destination if it can go there
+ * without further ado, and mark it dead.
+ */
+static void try_move(struct syslinux_movelist ***moves, struct freemap *fm,
+		     struct syslinux_movelist *f)
+{
+    addr_t needbase, needlen, cbyte;
+    int reverse;
+
+    if (!f->len)
+	return;
+
+    if (f->src == f->dst) {
+	f->len = 0;		/* Nothing to do */
+	return;
     }
 
-    dprintf("F: 0x%08x bytes at 0x%08x\n", freelen, freebase);
+    frag_need(f, &needbase, &needlen, &reverse, &cbyte);
 
-    add_freelist(mmap, freebase, freelen, SMT_FREE);
+    if (is_free_zone(fm, needbase, needlen) < 0)
+	return;
 
-    delete_movelist(fp);
+    dprintf("!: 0x%08x bytes at 0x%08x -> 0x%08x\n", f->len, f->src, f->dst);
+    allocate_from(fm, needbase, needlen);
+    emit_move(moves, fm, f);
+    f->len = 0;
+}
+
+/*
+ * Go through the memory freed since we last looked, and move whatever
+ * fragments it lets go into place.  Those free up more memory in turn.
+ */
+static void move_freed(struct syslinux_movelist ***moves, struct freemap *fm)
+{
+    struct syslinux_movelist **v = frag_index;
+    struct freerange r;
+    uint64_t end;
+    size_t lo, hi, mid, i;
+
+    while (fm->nfreed) {
+	r = fm->freed[--fm->nfreed];
+	end = (uint64_t)r.start + r.len;
+
+	/* The first sorted fragment with a destination above r.start */
+	lo = 0, hi = index_sorted;
+	while (lo < hi) {
+	    mid = (lo + hi) >> 1;
+	    if (v[mid]->dst <= r.start)
+		lo = mid + 1;
+	    else
+		hi = mid;
+	}
+
+	/* The live fragment before it may reach into the range */
+	for (i = lo; i-- > 0;) {
+	    if (v[i]->len) {
+		if (frag_hits(v[i], r.start, end))
+		    try_move(moves, fm, v[i]);
+		break;
+	    }
+	}
+
+	for (i = lo; i < index_sorted && v[i]->dst < end; i++)
+	    if (frag_hits(v[i], r.start, end))
+		try_move(moves, fm, v[i]);
+
+	for (i = index_sorted; i < index_count; i++)
+	    if (frag_hits(v[i], r.start, end))
+		try_move(moves, fm, v[i]);
+    }
 }
 
 /*
@@ -385,8 +840,7 @@ syslinux_compute_movelist(struct syslinux_movelist **moves,
 			  struct syslinux_movelist *ifrags,
 			  struct syslinux_memmap *memmap)
 {
-    struct syslinux_memmap *mmap = NULL;
-    const struct syslinux_memmap *mm, *ep;
+    struct freemap fm;
     struct syslinux_movelist *frags = NULL;
     struct syslinux_movelist *postcopy = NULL;
     struct syslinux_movelist *mv;
@@ -396,14 +850,18 @@ syslinux_compute_movelist(struct syslinux_movelist **moves,
     addr_t avail;
     addr_t fstart, flen;
     addr_t cbyte;
-    addr_t ep_len;
+    addr_t ep_start, ep_len;
+    int ep;
     int rv = -1;
     int reverse;
+    struct syslinux_movelist *evicted;
 
     dprintf("entering syslinux_compute_movelist()...\n");
 
+    fm.zone = NULL;
+    fm.freed = NULL;
+
     if (setjmp(new_movelist_bail)) {
-nomem:
 	dprintf("Out of working memory!\n");
 	goto bail;
     }
@@ -412,75 +870,37 @@ nomem:
 
     /* Create our memory map.  Anything that is SMT_FREE or SMT_ZERO is
        fair game, but mark anything used by source material as SMT_ALLOC. */
-    mmap = syslinux_init_memmap();
-    if (!mmap)
-	goto nomem;
+    init_freelist(&fm, memmap);
 
     frags = dup_movelist(ifrags);
 
     /* Process one-to-many conditions */
     shuffle_dealias(&frags, &postcopy);
 
-    for (mm = memmap; mm->type != SMT_END; mm = mm->next)
-	add_freelist(&mmap, mm->start, mm->next->start - mm->start,
-		     mm->type == SMT_ZERO ? SMT_FREE : mm->type);
+    for (f = frags; f; f = f->next)
+	add_freelist(&fm, f->src, f->len, SMT_ALLOC);
 
+    index_init(frags);
+
+    /* Move whatever can go straight into place */
     for (f = frags; f; f = f->next)
-	add_freelist(&mmap, f->src, f->len, SMT_ALLOC);
+	try_move(&moves, &fm, f);
 
     /* As long as there are unprocessed fragments in the chain... */
-    while ((fp = &frags, f = *fp)) {
+    for (;;) {
+	/* Memory we freed may have unblocked others */
+	move_freed(&moves, &fm);
 
-	dprintf("Current free list:\n");
-	syslinux_dump_memmap(mmap);
-	dprintf("Current frag list:\n");
-	syslinux_dump_movelist(frags);
+	while ((f = frags) && !f->len)
+	    frags = f->next;	/* Already done */
+	if (!f)
+	    break;
 
-	/* Scan for fragments which can be discarded without action. */
-	if (f->src == f->dst) {
-	    delete_movelist(fp);
-	    continue;
-	}
-	op = &f->next;
-	while ((o = *op)) {
-	    if (o->src == o->dst)
-		delete_movelist(op);
-	    else
-		op = &o->next;
-	}
+	fp = &frags;
+	evicted = NULL;
 
-	/* Scan for fragments which can be immediately moved
-	   to their final destination, if so handle them now */
-	for (op = fp; (o = *op); op = &o->next) {
-	    if (o->src < o->dst && (o->dst - o->src) < o->len) {
-		/* "Shift up" type overlap */
-		needlen = o->dst - o->src;
-		needbase = o->dst + (o->len - needlen);
-		reverse = 1;
-		cbyte = o->dst + o->len - 1;
-	    } else if (o->src > o->dst && (o->src - o->dst) < o->len) {
-		/* "Shift down" type overlap */
-		needlen = o->src - o->dst;
-		needbase = o->dst;
-		reverse = 0;
-		cbyte = o->dst;	/* "Critical byte" */
-	    } else {
-		needlen = o->len;
-		needbase = o->dst;
-		reverse = 0;
-		cbyte = o->dst;	/* "Critical byte" */
-	    }
-
-	    if (is_free_zone(mmap, needbase, needlen)) {
-		fp = op, f = o;
-		dprintf("!: 0x%08x bytes at 0x%08x -> 0x%08x\n",
-			f->len, f->src, f->dst);
-		copysrc = f->src;
-		copylen = needlen;
-		allocate_from(&mmap, needbase, copylen);
-		goto move_chunk;
-	    }
-	}
+	dprintf("Current frag list:\n");
+	syslinux_dump_movelist(frags);
 
 	/* Ok, bother.  Need to do real work at least with one chunk. */
 
@@ -491,36 +911,20 @@ nomem:
 	   the destination, or in the case of partial overlap, the
 	   missing portion. */
 
-	if (f->src < f->dst && (f->dst - f->src) < f->len) {
-	    /* "Shift up" type overlap */
-	    needlen = f->dst - f->src;
-	    needbase = f->dst + (f->len - needlen);
-	    reverse = 1;
-	    cbyte = f->dst + f->len - 1;
-	} else if (f->src > f->dst && (f->src - f->dst) < f->len) {
-	    /* "Shift down" type overlap */
-	    needlen = f->src - f->dst;
-	    needbase = f->dst;
-	    reverse = 0;
-	    cbyte = f->dst;	/* "Critical byte" */
-	} else {
-	    needlen = f->len;
-	    needbase = f->dst;
-	    reverse = 0;
-	    cbyte = f->dst;
-	}
+	frag_need(f, &needbase, &needlen, &reverse, &cbyte);
 
 	dprintf("need: base = 0x%08x, len = 0x%08x, "
 		"reverse = %d, cbyte = 0x%08x\n",
 		needbase, needlen, reverse, cbyte);
 
-	ep = is_free_zone(mmap, cbyte, 1);
-	if (ep) {
-	    ep_len = ep->next->start - ep->start;
+	ep = is_free_zone(&fm, cbyte, 1);
+	if (ep >= 0) {
+	    ep_start = fm.zone[ep].start;
+	    ep_len = min(zone_len(&fm, ep), (uint64_t)0xffffffff);
 	    if (reverse)
-		avail = needbase + needlen - ep->start;
+		avail = needbase + needlen - ep_start;
 	    else
-		avail = ep_len - (needbase - ep->start);
+		avail = ep_len - (needbase - ep_start);
 	} else {
 	    avail = 0;
 	}
@@ -529,13 +933,13 @@ nomem:
 	    /* We can move at least part of this chunk into place without
 	       further ado */
 	    dprintf("space: start 0x%08x, len 0x%08x, free 0x%08x\n",
-		    ep->start, ep_len, avail);
+		    ep_start, ep_len, avail);
 	    copylen = min(needlen, avail);
 
 	    if (reverse)
-		allocate_from(&mmap, needbase + needlen - copylen, copylen);
+		allocate_from(&fm, needbase + needlen - copylen, copylen);
 	    else
-		allocate_from(&mmap, needbase, copylen);
+		allocate_from(&fm, needbase, copylen);
 
 	    goto move_chunk;
 	}
@@ -544,7 +948,11 @@ nomem:
 	   Find the object occupying the critical byte of our target space,
 	   and move it out (the whole object if we can, otherwise a subset.)
 	   Then move a chunk of ourselves into place. */
-	for (op = &f->next, o = *op; o; op = &o->next, o = *op) {
+	for (op = &f->next; (o = *op); op = &o->next) {
+	    while (o && !o->len)
+		o = *op = o->next;	/* Already done */
+	    if (!o)
+		break;
 
 	    dprintf("O: 0x%08x bytes at 0x%08x -> 0x%08x\n",
 		    o->len, o->src, o->dst);
@@ -554,19 +962,19 @@ nomem:
 
 	    /* Find somewhere to put it... */
 
-	    if (is_free_zone(mmap, o->dst, o->len)) {
+	    if (is_free_zone(&fm, o->dst, o->len) >= 0) {
 		/* Score!  We can move it into place directly... */
 		copydst = o->dst;
 		copysrc = o->src;
 		copylen = o->len;
-	    } else if (free_area(mmap, o->len, &fstart)) {
+	    } else if (free_area(&fm, o->len, &fstart)) {
 		/* We can move the whole chunk */
 		copydst = fstart;
 		copysrc = o->src;
 		copylen = o->len;
 	    } else {
 		/* Well, copy as much as we can... */
-		if (syslinux_memmap_largest(mmap, SMT_FREE, &fstart, &flen)) {
+		if (largest_free_area(&fm, &fstart, &flen)) {
 		    dprintf("No free memory at all!\n");
 		    goto bail;	/* Stuck! */
 		}
@@ -581,7 +989,7 @@ nomem:
 		    copylen = min(flen, o->len - (cbyte - o->src));
 		}
 	    }
-	    allocate_from(&mmap, copydst, copylen);
+	    allocate_from(&fm, copydst, copylen);
 
 	    if (copylen < o->len) {
 		op = split_movelist(copysrc, copylen, op);
@@ -595,18 +1003,22 @@ nomem:
 	    moves = &mv->next;
 
 	    o->src = copydst;
-
-	    if (copylen > needlen) {
-		/* We don't need all the memory we freed up.  Mark it free. */
-		if (copysrc < needbase) {
-		    add_freelist(&mmap, copysrc, needbase - copysrc, SMT_FREE);
-		    copylen -= (needbase - copysrc);
-		}
-		if (copylen > needlen) {
-		    add_freelist(&mmap, copysrc + needlen, copylen - needlen,
-				 SMT_FREE);
-		    copylen = needlen;
-		}
+	    evicted = o;
+
+	    /* We may not need all the memory we freed up.  Mark the
+	       rest free; what is left includes the critical byte, and
+	       so runs from the start of the area we need (or to its
+	       end, if we're filling it from the top). */
+	    if (copysrc < needbase) {
+		add_freelist(&fm, copysrc, needbase - copysrc, SMT_FREE);
+		copylen -= (needbase - copysrc);
+		copysrc = needbase;
+	    }
+	    if (copysrc + copylen > needbase + needlen) {
+		add_freelist(&fm, needbase + needlen,
+			     copysrc + copylen - (needbase + needlen),
+			     SMT_FREE);
+		copylen = needbase + needlen - copysrc;
 	    }
 	    reverse = 0;
 	    goto move_chunk;
@@ -615,28 +1027,330 @@ nomem:
 	goto bail;		/* Stuck! */
 
 move_chunk:
-	move_chunk(&moves, &mmap, fp, copylen);
+	move_chunk(&moves, &fm, fp, copylen);
+
+	/* What we evicted may be able to go straight into place now */
+	if (evicted)
+	    try_move(&moves, &fm, evicted);
     }
 
     /* Finally, append the postcopy chain to the end of the moves list */
-    for (op = moves; (o = *op); op = &o->next) ;	/* Locate the end of the list */
-    *op = postcopy;
-    postcopy = NULL;
+    for (f = postcopy; f; f = f->next) {
+	mv = new_movelist(f->dst, f->src, f->len);
+	*moves = mv;
+	moves = &mv->next;
+    }
 
     rv = 0;
 bail:
-    if (mmap)
-	syslinux_free_memmap(mmap);
-    if (frags)
-	free_movelist(&frags);
-    if (postcopy)
-	free_movelist(&postcopy);
+    free(fm.zone);
+    free(fm.freed);
+    index_free();
+    free_frags();
     return rv;
 }
 
 #ifdef TEST
 
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Usage: movebits file
+ *        movebits -b [max_frags]
+ *        movebits -r [seeds]
+ *
+ * The first form reads a list of "src dst len" lines (dst == 0 means
+ * free memory, src == -1 means zeroed memory) and prints the move list.
+ * The second form benchmarks the planner on a scrambled set of small
+ * fragments, doubling the fragment count each round, and checks that
+ * carrying out the moves gives the right result.  The third form
+ * checks the result for a number of random, tightly packed layouts,
+ * which exercise the eviction paths; it exits nonzero on the first
+ * wrong one.
+ */
+
+#define BENCH_BLOCK	256
+#define BENCH_BASE	0x100000
+#define BENCH_MEM	0x1000000
+
+static void dump_moves(const struct syslinux_movelist *ml)
+{
+    for (; ml; ml = ml->next)
+	printf("%08x %08x %08x\n", ml->src, ml->dst, ml->len);
+}
+
+static uint8_t bench_byte(unsigned int blk, unsigned int off)
+{
+    return (blk * 131 + off * 7 + (blk >> 8)) & 0xff;
+}
+
+static int bench_one(unsigned int nfrags, unsigned int seed)
+{
+    struct syslinux_movelist *frags = NULL, **fep = &frags;
+    struct syslinux_movelist *moves, *mv;
+    struct syslinux_memmap *memmap;
+    unsigned int *perm, i, j, t, nmoves;
+    uint8_t *mem;
+    clock_t start, end;
+    int err = 0;
+
+    perm = malloc(nfrags * sizeof *perm);
+    mem = malloc(BENCH_MEM);
+    if (!perm || !mem)
+	return -1;
+
+    srand(seed);
+    for (i = 0; i < nfrags; i++)
+	perm[i] = i;
+    for (i = nfrags - 1; i > 0; i--) {
+	j = rand() % (i + 1);
+	t = perm[i], perm[i] = perm[j], perm[j] = t;
+    }
+
+    memmap = syslinux_init_memmap();
+    syslinux_add_memmap(&memmap, 0x10000, BENCH_MEM - 0x10000, SMT_FREE);
+
+    memset(mem, 0, BENCH_MEM);
+    for (i = 0; i < nfrags; i++) {
+	mv = new_movelist(BENCH_BASE + perm[i] * BENCH_BLOCK,
+			  BENCH_BASE + i * BENCH_BLOCK, BENCH_BLOCK);
+	*fep = mv;
+	fep = &mv->next;
+	for (j = 0; j < BENCH_BLOCK; j++)
+	    mem[BENCH_BASE + i * BENCH_BLOCK + j] = bench_byte(i, j);
+    }
+
+    start = clock();
+    if (syslinux_compute_movelist(&moves, frags, memmap)) {
+	printf("%8u: failed to compute a move sequence\n", nfrags);
+	return -1;
+    }
+    end = clock();
+
+    nmoves = 0;
+    for (mv = moves; mv; mv = mv->next) {
+	if (mv->dst < 0x10000 || mv->dst + mv->len > BENCH_MEM)
+	    err = 1;
+	else
+	    memmove(mem + mv->dst, mem + mv->src, mv->len);
+	nmoves++;
+    }
+    for (i = 0; i < nfrags && !err; i++)
+	for (j = 0; j < BENCH_BLOCK; j++)
+	    if (mem[BENCH_BASE + perm[i] * BENCH_BLOCK + j] != bench_byte(i, j))
+		err = 1;
+
+    printf("%8u fragments: %10.3f ms, %8u moves%s\n", nfrags,
+	   (end - start) * 1000.0 / CLOCKS_PER_SEC, nmoves,
+	   err ? ", WRONG RESULT" : "");
+
+    syslinux_free_movelist(moves);
+    syslinux_free_movelist(frags);
+    syslinux_free_memmap(memmap);
+    free(mem);
+    free(perm);
+    return err ? -1 : 0;
+}
+
+static int bench(unsigned int max_frags)
+{
+    unsigned int n;
+    int err = 0;
+
+    if (max_frags > (BENCH_MEM - BENCH_BASE) / BENCH_BLOCK / 2)
+	max_frags = (BENCH_MEM - BENCH_BASE) / BENCH_BLOCK / 2;
+
+    for (n = 16; n <= max_frags; n <<= 1)
+	err |= bench_one(n, n);
+
+    return err ? 1 : 0;
+}
+
+#define CHECK_BASE	0x10000
+#define CHECK_MEM	0x20000
+
+static uint8_t check_byte(addr_t addr)
+{
+    return (addr * 2654435761u) >> 24;
+}
+
+/*
+ * Carry out the moves for a layout, and check that they only write
+ * to free memory or to where the sources were, that no move is made
+ * twice, and that they give the right result.
+ */
+static int check_layout(const char *what, struct syslinux_movelist *frags,
+			struct syslinux_memmap *memmap)
+{
+    struct syslinux_movelist *moves, *mv, *m2, *f;
+    struct syslinux_memmap *mp;
+    static uint8_t mem[CHECK_MEM], writable[CHECK_MEM];
+    addr_t i;
+    int err = 0;
+
+    memset(writable, 0, sizeof writable);
+    for (mp = memmap; mp->type != SMT_END; mp = mp->next)
+	if (mp->type == SMT_FREE)
+	    memset(writable + mp->start, 1, mp->next->start - mp->start);
+    for (f = frags; f; f = f->next)
+	memset(writable + f->src, 1, f->len);
+
+    for (i = 0; i < CHECK_MEM; i++)
+	mem[i] = check_byte(i);
+
+    if (syslinux_compute_movelist(&moves, frags, memmap)) {
+	/* Not enough room is a legitimate answer */
+	syslinux_free_movelist(frags);
+	syslinux_free_memmap(memmap);
+	return 0;
+    }
+
+    for (mv = moves; mv && !err; mv = mv->next) {
+	for (m2 = mv->next; m2; m2 = m2->next)
+	    if (m2->src == mv->src && m2->dst == mv->dst &&
+		m2->len == mv->len)
+		err = 1;
+	for (i = 0; i < mv->len; i++)
+	    if (mv->dst + i >= CHECK_MEM || !writable[mv->dst + i])
+		err = 1;
+	if (!err)
+	    memmove(mem + mv->dst, mem + mv->src, mv->len);
+    }
+    for (f = frags; f && !err; f = f->next)
+	for (i = 0; i < f->len; i++)
+	    if (mem[f->dst + i] != check_byte(f->src + i))
+		err = 1;
+
+    if (err) {
+	printf("%s: WRONG RESULT\n", what);
+	for (f = frags; f; f = f->next)
+	    printf("%08x %08x %08x\n", f->src, f->dst, f->len);
+	printf("moves:\n");
+	dump_moves(moves);
+    }
+
+    syslinux_free_movelist(moves);
+    syslinux_free_movelist(frags);
+    syslinux_free_memmap(memmap);
+    return err ? -1 : 0;
+}
+
+/*
+ * A few fragments with random lengths, whose destinations and
+ * sources are each laid out in a random order, a little apart.  The
+ * destinations are free memory, and so, at random, are the gaps
+ * between them and a little memory beyond; the sources either share
+ * that region or sit above it, outside free memory.
+ */
+static int check_one(unsigned int seed)
+{
+    struct syslinux_movelist *frags = NULL, **fep = &frags;
+    struct syslinux_movelist *mv, *f;
+    struct syslinux_memmap *memmap;
+    unsigned int nfrags, perm[16], i, j, t;
+    addr_t len, gap, dst, src, top;
+    char what[32];
+
+    srand(seed);
+    nfrags = 1 + rand() % 16;
+    for (i = 0; i < nfrags; i++)
+	perm[i] = i;
+    for (i = nfrags - 1; i > 0; i--) {
+	j = rand() % (i + 1);
+	t = perm[i], perm[i] = perm[j], perm[j] = t;
+    }
+
+    memmap = syslinux_init_memmap();
+
+    dst = CHECK_BASE + rand() % 0x100;
+    for (i = 0; i < nfrags; i++) {
+	len = 1 + rand() % 0x400;
+	mv = new_movelist(dst, 0, len);
+	*fep = mv;
+	fep = &mv->next;
+	gap = rand() % 0x40;
+	if (rand() & 1)
+	    len += gap;		/* Free gap after it */
+	syslinux_add_memmap(&memmap, dst, len, SMT_FREE);
+	dst += mv->len + gap;
+    }
+    top = dst + rand() % 0x400;
+    syslinux_add_memmap(&memmap, dst, top - dst, SMT_FREE);
+
+    src = ((rand() & 3) ? CHECK_BASE : top) + rand() % 0x100;
+    for (i = 0; i < nfrags; i++) {
+	for (f = frags, j = perm[i]; j; j--)
+	    f = f->next;
+	f->src = src;
+	src += f->len + rand() % 0x40;
+    }
+
+    sprintf(what, "seed %u", seed);
+    return check_layout(what, frags, memmap);
+}
+
+/*
+ * Layouts which have gone wrong before: src, dst, len for each
+ * fragment, then start, len for each free zone.
+ */
+static const addr_t regress_double_move[][3] = {
+    /* A fragment moved by move_chunk() was left live in the index, and
+       was moved into place a second time, from a stale source. */
+    {0x10172, 0x10088, 0x1a4}, {0x10787, 0x1026a, 0x33c},
+    {0x10ef0, 0x105db, 0x30f}, {0x1001c, 0x10912, 0x144},
+    {0x10ae3, 0x10a7b, 0x0b9}, {0x10df4, 0x10b3e, 0x047},
+    {0x1034e, 0x10b8e, 0x3a6}, {0x11223, 0x10f36, 0x1ea},
+    {0x11417, 0x11148, 0x084}, {0x114c9, 0x111f6, 0x078},
+    {0x10706, 0x11276, 0x04d}, {0x11567, 0x112f5, 0x15b},
+    {0x10bb2, 0x1148b, 0x229}, {0x10e3b, 0x116b7, 0x095},
+};
+
+static const addr_t regress_double_move_free[][2] = {
+    {0x10088, 0x51e}, {0x105db, 0x30f}, {0x10912, 0x144},
+    {0x10a7b, 0x0b9}, {0x10b3e, 0x047}, {0x10b8e, 0x3a6},
+    {0x10f36, 0x1ea}, {0x11148, 0x126}, {0x11276, 0x04d},
+    {0x112f5, 0x457}, {0x11763, 0x1d4},
+};
+
+static int check_regress(void)
+{
+    struct syslinux_movelist *frags = NULL, **fep = &frags, *mv;
+    struct syslinux_memmap *memmap;
+    size_t i;
+
+    memmap = syslinux_init_memmap();
+    for (i = 0; i < sizeof regress_double_move / sizeof *regress_double_move;
+	 i++) {
+	mv = new_movelist(regress_double_move[i][1],
+			  regress_double_move[i][0],
+			  regress_double_move[i][2]);
+	*fep = mv;
+	fep = &mv->next;
+    }
+    for (i = 0; i < sizeof regress_double_move_free /
+	 sizeof *regress_double_move_free; i++)
+	syslinux_add_memmap(&memmap, regress_double_move_free[i][0],
+			    regress_double_move_free[i][1], SMT_FREE);
+
+    return check_layout("double move", frags, memmap);
+}
+
+static int check(unsigned int seeds)
+{
+    unsigned int seed;
+
+    if (check_regress())
+	return 1;
+
+    for (seed = 1; seed <= seeds; seed++)
+	if (check_one(seed))
+	    return 1;
+
+    printf("%u random layouts OK\n", seeds);
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
@@ -648,11 +1362,25 @@ int main(int argc, char *argv[])
     struct syslinux_memmap *memmap;
     char line[BUFSIZ];
 
-    (void)argc;
+    if (argc > 1 && !strcmp(argv[1], "-b"))
+	return bench(argc > 2 ? strtoul(argv[2], NULL, 0) : 16384);
+
+    if (argc > 1 && !strcmp(argv[1], "-r"))
+	return check(argc > 2 ? strtoul(argv[2], NULL, 0) : 20000);
+
+    if (argc < 2) {
+	fprintf(stderr, "Usage: %s file | -b [max_frags] | -r [seeds]\n",
+		argv[0]);
+	return 1;
+    }
 
     memmap = syslinux_init_memmap();
 
     f = fopen(argv[1], "r");
+    if (!f) {
+	perror(argv[1]);
+	return 1;
+    }
     while (fgets(line, sizeof line, f) != NULL) {
 	if (sscanf(line, "%lx %lx %lx", &s, &d, &l) == 3) {
 	    if (d) {
@@ -682,7 +1410,7 @@ int main(int argc, char *argv[])
 	return 1;
     } else {
 	dprintf("Final move list:\n");
-	syslinux_dump_movelist(stdout, moves);
+	dump_moves(moves);
 	return 0;
     }
 }
@@ -0,0 +1,65 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2026 The Syslinux Authors - All Rights Reserved
+ *
+ *   Permission is hereby granted, free of charge, to any person
+ *   obtaining a copy of this software and associated documentation
+ *   files (the "Software"), to deal in the Software without
+ *   restriction, including without limitation the rights to use,
+ *   copy, modify, merge, publish, distribute, sublicense, and/or
+ *   sell copies of the Software, and to permit persons to whom
+ *   the Software is furnished to do so, subject to the following
+ *   conditions:
+ *
+ *   The above copyright notice and this permission notice shall
+ *   be included in all copies or substantial portions of the Software.
+ *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *   OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ *   HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ *   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ *   OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * stats.c
+ *
+ * Fetch one of the core's statistics structures: INT 22h function
+ * _func_ copies at most CX bytes of it to ES:BX.
+ */
+
+#include <string.h>
+#include <com32.h>
+
+#include "stats.h"
+
+/* Returns 0 on success, or -1 if the core doesn't have it */
+int __syslinux_get_stats(uint16_t func, void *stats, size_t size)
+{
+    com32sys_t regs;
+    void *lstats;
+
+    lstats = lzalloc(size);
+    if (!lstats)
+	return -1;
+
+    memset(&regs, 0, sizeof regs);
+    regs.eax.w[0] = func;
+    regs.es = SEG(lstats);
+    regs.ebx.w[0] = OFFS(lstats);
+    regs.ecx.w[0] = size;
+
+    __intcall(0x22, &regs, &regs);
+
+    memcpy(stats, lstats, size);
+    lfree(lstats);
+
+    if (regs.eflags.l & EFLAGS_CF)
+	return -1;
+
+    return 0;
+}
@@ -43,17 +43,33 @@
 
 #define INCREMENTAL_CHUNK 1024*1024
 
-int zloadfile(const char *filename, void **ptr, size_t * len)
+/*
+ * Like zloadfile(), but unpack the ZIO_* _formats_ given rather than
+ * only gzip.
+ */
+int zloadfile_formats(const char *filename, void **ptr, size_t * len,
+		      unsigned int formats)
 {
     FILE *f;
-    int rv;
+    int fd, rv;
+
+    fd = zopen_formats(filename, O_RDONLY, formats);
+    if (fd < 0)
+	return -1;
 
-    f = zfopen(filename, "r");
-    if (!f)
+    f = fdopen(fd, "r");
+    if (!f) {
+	close(fd);
 	return -1;
+    }
 
     rv = floadfile(f, ptr, len, NULL, 0);
     fclose(f);
 
     return rv;
 }
+
+int zloadfile(const char *filename, void **ptr, size_t * len)
+{
+    return zloadfile_formats(filename, ptr, len, ZIO_GZIP);
+}
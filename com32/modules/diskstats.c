@@ -0,0 +1,61 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2026 The Syslinux Authors - All Rights Reserved
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version; incorporated herein by reference.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * diskstats.c
+ *
+ * Print the disk I/O and block cache statistics of the boot device
+ *
+ * Usage: diskstats.c32
+ */
+
+#include <stdio.h>
+#include <console.h>
+#include <syslinux/disk_stats.h>
+
+static unsigned int percent(uint32_t part, uint32_t whole)
+{
+    return whole ? (unsigned int)((uint64_t)part * 100 / whole) : 0;
+}
+
+int main(void)
+{
+    struct disk_stats st;
+    const struct disk_io_stats *io = &st.io;
+    const struct disk_cache_stats *cs = &st.cache;
+
+    openconsole(&dev_null_r, &dev_stdcon_w);
+
+    if (syslinux_disk_stats(&st)) {
+	printf("diskstats: no disk statistics available\n");
+	return 1;
+    }
+
+    printf("Disk %02x: %s, %u-byte sectors, up to %u sectors per call\n",
+	   st.disk_number, st.ebios ? "EBIOS" : "CBIOS",
+	   st.sector_size, st.maxtransfer);
+    printf("INT 13h calls: %u, sectors: %u, time: %u ms\n",
+	   io->calls, io->sectors, io->time_total);
+    printf("Errors: %u, resets: %u, maxtransfer reductions: %u, "
+	   "CHS fallbacks: %u\n",
+	   io->errors, io->resets, io->downgrades, io->chs_fallbacks);
+    printf("Bounced transfers: %u (%u bytes), 64-bit buffer transfers: %u\n",
+	   io->bounces, io->bounce_bytes, io->flat);
+
+    printf("Cache: %u blocks of %u bytes\n", cs->entries, cs->block_size);
+    printf("Lookups: %u, hits: %u (%u%%), disk requests: %u\n",
+	   cs->lookups, cs->hits, percent(cs->hits, cs->lookups), cs->fills);
+    printf("Blocks read: %u (%u read ahead), evictions: %u\n",
+	   cs->blocks_read, cs->readahead, cs->evictions);
+
+    return 0;
+}
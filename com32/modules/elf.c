@@ -45,6 +45,7 @@
 #include <dprintf.h>
 
 #include <syslinux/loadfile.h>
+#include <syslinux/zio.h>
 #include <syslinux/movebits.h>
 #include <syslinux/bootpm.h>
 
@@ -270,7 +271,7 @@ int main(int argc, char *argv[])
 	return 1;
     }
 
-    if (zloadfile(argv[1], &data, &data_len)) {
+    if (zloadfile_formats(argv[1], &data, &data_len, ZIO_ALL)) {
 	error("Unable to load file\n");
 	return 1;
     }
@@ -108,18 +108,144 @@ static char *make_cmdline(char **argv)
     return cmdline;
 }
 
+/*
+ * Set up the initramfs for initrds of the given sizes, plus the DHCP
+ * info if wanted; the initrd data pointers are filled in later.
+ */
+static struct initramfs *make_initramfs(const size_t *lens, int count,
+					bool dhcpinfo)
+{
+    struct initramfs *initramfs;
+    void *dhcpdata;
+    size_t dhcplen;
+    int i;
+
+    initramfs = initramfs_init();
+    if (!initramfs)
+	return NULL;
+
+    for (i = 0; i < count; i++) {
+	if (initramfs_add_data(initramfs, NULL, lens[i], lens[i], 4))
+	    return NULL;
+    }
+
+    /* Append the DHCP info */
+    if (dhcpinfo &&
+	!pxe_get_cached_info(PXENV_PACKET_TYPE_DHCP_ACK, &dhcpdata, &dhcplen)) {
+	if (initramfs_add_file(initramfs, dhcpdata, dhcplen, dhcplen,
+			       "/dhcpinfo.dat", 0, 0755))
+	    return NULL;
+    }
+
+    return initramfs;
+}
+
+struct initrd_placement {
+    char hdr[LINUX_HEADER_SIZE];	/* Start of the kernel image */
+    const char *cmdline;
+    bool dhcpinfo;
+    struct initramfs *initramfs;
+};
+
+/*
+ * loadfiles_placed() callback: once the kernel and initrd sizes are
+ * known, find out where the initramfs is going to end up, and if that
+ * memory is ours to take, read the initrds straight into it so they
+ * don't have to be copied again when booting.  The kernel, ptrs[0],
+ * is moved into place by syslinux_boot_linux() and just gets a buffer.
+ */
+static int place_initrds(void *arg, void **ptrs, const size_t *lens,
+			 int count)
+{
+    struct initrd_placement *pl = arg;
+    struct initramfs *ip;
+    char *base;
+    size_t offset;
+    int i;
+
+    pl->initramfs = make_initramfs(lens + 1, count - 1, pl->dhcpinfo);
+    if (!pl->initramfs)
+	return -1;
+
+    base = syslinux_linux_initramfs_addr(pl->hdr, lens[0],
+					 pl->initramfs, pl->cmdline);
+    if (!base)
+	return -1;
+
+    /* Same layout as syslinux_boot_linux() */
+    offset = 0;
+    ip = pl->initramfs->next;
+    for (i = 1; i < count; i++) {
+	if (!lens[i]) {
+	    ptrs[i] = base;	/* Empty, has no chunk */
+	    continue;
+	}
+	offset = (offset + ip->align - 1) & ~(ip->align - 1);
+	ptrs[i] = base + offset;
+	offset += ip->len;
+	ip = ip->next;
+    }
+    for (; ip->len; ip = ip->next) {
+	offset = (offset + ip->align - 1) & ~(ip->align - 1);
+	offset += ip->len;
+    }
+
+    if (!malloc_at(base, offset))
+	return -1;
+
+    ptrs[0] = malloc(lens[0]);
+    if (!ptrs[0]) {
+	free(base);
+	return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Read the start of the kernel image, which is all that is needed to
+ * work out where the initramfs goes before the kernel itself is read.
+ */
+static int read_kernel_header(const char *kernel_name, char *hdr)
+{
+    FILE *f;
+    size_t bytes;
+
+    f = fopen(kernel_name, "r");
+    if (!f)
+	return -1;
+
+    bytes = fread(hdr, 1, LINUX_HEADER_SIZE, f);
+    fclose(f);
+
+    return bytes == LINUX_HEADER_SIZE ? 0 : -1;
+}
+
+static void print_loading(const char **names, int nfiles)
+{
+    int i;
+
+    printf("Loading");
+    for (i = 0; i < nfiles; i++)
+	printf(" %s", names[i]);
+    printf("... ");
+}
+
 int main(int argc, char *argv[])
 {
     const char *kernel_name;
-    struct initramfs *initramfs;
+    struct initramfs *initramfs, *ip;
+    struct initrd_placement pl;
+    loadfiles_place_t place;
     char *cmdline;
     char *boot_image;
-    void *kernel_data;
-    size_t kernel_len;
+    const char **names;
+    void **data;
+    size_t *lens;
+    char *initrds;
+    int i, nfiles;
     bool opt_dhcpinfo = false;
     bool opt_quiet = false;
-    void *dhcpdata;
-    size_t dhcplen;
     char **argp, *arg, *p;
 
     openconsole(&dev_null_r, &dev_stdcon_w);
@@ -157,59 +283,83 @@ int main(int argc, char *argv[])
     if (find_boolean(argp, "quiet"))
 	opt_quiet = true;
 
-    if (!opt_quiet)
-	printf("Loading %s... ", kernel_name);
-    if (loadfile(kernel_name, &kernel_data, &kernel_len)) {
-	if (opt_quiet)
-	    printf("Loading %s ", kernel_name);
-	printf("failed!\n");
-	goto bail;
-    }
-    if (!opt_quiet)
-	printf("ok\n");
-
     cmdline = make_cmdline(argp);
     if (!cmdline)
 	goto bail;
 
-    /* Initialize the initramfs chain */
-    initramfs = initramfs_init();
-    if (!initramfs)
-	goto bail;
-
+    /* Collect the kernel and initrd names, so they can be loaded together */
+    nfiles = 1;
+    initrds = NULL;
     if ((arg = find_argument(argp, "initrd="))) {
-	do {
-	    p = strchr(arg, ',');
-	    if (p)
-		*p = '\0';
-
-	    if (!opt_quiet)
-		printf("Loading %s... ", arg);
-	    if (initramfs_load_archive(initramfs, arg)) {
-		if (opt_quiet)
-		    printf("Loading %s ", kernel_name);
-		printf("failed!\n");
-		goto bail;
-	    }
-	    if (!opt_quiet)
-		printf("ok\n");
+	initrds = strdup(arg);
+	if (!initrds)
+	    goto bail;
+	for (p = initrds; *p; p++) {
+	    if (*p == ',')
+		nfiles++;
+	}
+	nfiles++;
+    }
+
+    names = malloc(nfiles * sizeof *names);
+    data  = malloc(nfiles * sizeof *data);
+    lens  = malloc(nfiles * sizeof *lens);
+    if (!names || !data || !lens)
+	goto bail;
 
+    names[0] = kernel_name;
+    if (initrds) {
+	p = initrds;
+	for (i = 1; i < nfiles; i++) {
+	    names[i] = p;
+	    p = strchr(p, ',');
 	    if (p)
-		*p++ = ',';
-	} while ((arg = p));
+		*p++ = '\0';
+	}
     }
 
-    /* Append the DHCP info */
-    if (opt_dhcpinfo &&
-	!pxe_get_cached_info(PXENV_PACKET_TYPE_DHCP_ACK, &dhcpdata, &dhcplen)) {
-	if (initramfs_add_file(initramfs, dhcpdata, dhcplen, dhcplen,
-			       "/dhcpinfo.dat", 0, 0755))
-	    goto bail;
+    /*
+     * Everything is read together, so the transfers can overlap; the
+     * initrds go straight to their final address if possible.
+     */
+    pl.cmdline = cmdline;
+    pl.dhcpinfo = opt_dhcpinfo;
+    pl.initramfs = NULL;
+
+    place = NULL;
+    if (nfiles > 1 && !read_kernel_header(kernel_name, pl.hdr))
+	place = place_initrds;
+
+    if (!opt_quiet)
+	print_loading(names, nfiles);
+    if (loadfiles_placed(names, data, lens, nfiles, place, &pl) < 0)
+	goto load_failed;
+    if (!opt_quiet)
+	printf("ok\n");
+
+    /* The initramfs chain may already exist, minus the data pointers */
+    initramfs = pl.initramfs;
+    if (!initramfs)
+	initramfs = make_initramfs(lens + 1, nfiles - 1, opt_dhcpinfo);
+    if (!initramfs)
+	goto bail;
+
+    ip = initramfs->next;
+    for (i = 1; i < nfiles; i++) {
+	if (lens[i]) {
+	    ip->data = data[i];
+	    ip = ip->next;
+	}
     }
 
     /* This should not return... */
-    syslinux_boot_linux(kernel_data, kernel_len, initramfs, cmdline);
+    syslinux_boot_linux(data[0], lens[0], initramfs, cmdline);
+    goto bail;
 
+load_failed:
+    if (opt_quiet)
+	print_loading(names, nfiles);
+    printf("failed!\n");
 bail:
     fprintf(stderr, "Kernel load failure (insufficient memory?)\n");
     return 1;
@@ -31,6 +31,7 @@
 #include <dprintf.h>
 
 #include <syslinux/loadfile.h>
+#include <syslinux/zio.h>
 #include <syslinux/movebits.h>
 #include <syslinux/bootrm.h>
 
@@ -170,7 +171,7 @@ int main(int argc, char *argv[])
     fputs("Loading ", stdout);
     fputs(argv[1], stdout);
     fputs("... ", stdout);
-    if (zloadfile(argv[1], &data, &data_len)) {
+    if (zloadfile_formats(argv[1], &data, &data_len, ZIO_ALL)) {
 	error("failed!\n");
 	return 1;
     }
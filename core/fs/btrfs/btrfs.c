@@ -57,6 +57,7 @@ static int bin_search(void *ptr, int item_size, void *cmp_item, cmp_func func,
 
 /* XXX: these should go into the filesystem instance structure */
 static struct btrfs_chunk_map chunk_map;
+static struct btrfs_chunk_map_item *last_chunk;	/* last lookup hit */
 static struct btrfs_super_block sb;
 static u64 fs_tree;
 
@@ -90,6 +91,7 @@ static void insert_map(struct btrfs_chunk_map_item *item)
 			chunk_map.cur_length, &slot);
 	if (ret == 0)/* already in map */
 		return;
+	last_chunk = NULL;	/* items are about to move */
 	if (chunk_map.cur_length == BTRFS_MAX_CHUNK_ENTRIES) {
 		/* should be impossible */
 		printf("too many chunk items\n");
@@ -110,6 +112,11 @@ static u64 logical_physical(u64 logical)
 	struct btrfs_chunk_map_item item;
 	int slot, ret;
 
+	/* Consecutive lookups nearly always fall in the same chunk */
+	if (last_chunk && logical >= last_chunk->logical &&
+	    logical < last_chunk->logical + last_chunk->length)
+		return last_chunk->physical + logical - last_chunk->logical;
+
 	item.logical = logical;
 	ret = bin_search(chunk_map.map, sizeof(*chunk_map.map), &item,
 			(cmp_func)btrfs_comp_chunk_map, 0,
@@ -121,8 +128,8 @@ static u64 logical_physical(u64 logical)
 	if (logical >=
 		chunk_map.map[slot-1].logical + chunk_map.map[slot-1].length)
 		return -1;
-	return chunk_map.map[slot-1].physical + logical -
-			chunk_map.map[slot-1].logical;
+	last_chunk = &chunk_map.map[slot-1];
+	return last_chunk->physical + logical - last_chunk->logical;
 }
 
 /* cache read from disk, offset and count are bytes */
@@ -284,6 +291,8 @@ static int search_tree(struct fs_info *fs, u64 loffset,
 		btrfs_read(fs, (char *)&path->data,
 			offset + sizeof(*header) + leaf->items[slot].offset,
 			leaf->items[slot].size);
+		if (path->leaf)
+			memcpy(path->leaf, buf, sb.leafsize);
 	}
 	return ret;
 }
@@ -512,13 +521,45 @@ static int btrfs_readdir(struct file *file, struct dirent *dirent)
 	return 0;
 }
 
+/*
+ * Turn a regular file extent item into a struct extent; holes and
+ * preallocated extents read as zeroes.
+ */
+static void btrfs_map_extent(struct fs_info *fs, u64 file_offset,
+			     const struct btrfs_file_extent_item *fe,
+			     struct extent *e)
+{
+	u32 sec_shift = SECTOR_SHIFT(fs);
+	u32 sec_size = SECTOR_SIZE(fs);
+
+	e->lstart = file_offset >> sec_shift;
+	e->len = (fe->num_bytes + sec_size - 1) >> sec_shift;
+	if (fe->type == BTRFS_FILE_EXTENT_PREALLOC || !fe->disk_bytenr)
+		e->pstart = EXTENT_ZERO;
+	else
+		e->pstart = logical_physical(fe->disk_bytenr + fe->offset)
+			>> sec_shift;
+}
+
+/*
+ * Map the file extent at _lstart_.  Rather than searching the tree
+ * again for every extent, all the following extents of the file in the
+ * same leaf go into the inode's extent map as well, so the tree is only
+ * searched once per leaf.
+ */
 static int btrfs_next_extent(struct inode *inode, uint32_t lstart)
 {
+	static u8 leaf_buf[BTRFS_MAX_LEAF_SIZE];
+	struct btrfs_leaf *leaf = (struct btrfs_leaf *)leaf_buf;
 	struct btrfs_disk_key search_key;
 	struct btrfs_file_extent_item extent_item;
+	const struct btrfs_file_extent_item *fe;
+	struct btrfs_item *item;
 	struct btrfs_path path;
-	int ret;
+	struct extent e;
+	int ret, slot;
 	u64 offset;
+	u32 delta;
 	struct fs_info *fs = inode->fs;
 	u32 sec_shift = SECTOR_SHIFT(fs);
 	u32 sec_size = SECTOR_SIZE(fs);
@@ -527,6 +568,7 @@ static int btrfs_next_extent(struct inode *inode, uint32_t lstart)
 	search_key.type = BTRFS_EXTENT_DATA_KEY;
 	search_key.offset = lstart << sec_shift;
 	clear_path(&path);
+	path.leaf = leaf_buf;
 	ret = search_tree(fs, fs_tree, &search_key, &path);
 	if (ret) { /* impossible */
 		printf("btrfs: search extent data error!\n");
@@ -550,14 +592,48 @@ static int btrfs_next_extent(struct inode *inode, uint32_t lstart)
 			+ offsetof(struct btrfs_file_extent_item, disk_bytenr);
 		inode->next_extent.len =
 			(inode->size + sec_size -1) >> sec_shift;
-	} else {
-		offset = extent_item.disk_bytenr + extent_item.offset;
-		inode->next_extent.len =
-			(extent_item.num_bytes + sec_size - 1) >> sec_shift;
+		inode->next_extent.pstart =
+			logical_physical(offset) >> sec_shift;
+		PVT(inode)->offset = offset;
+		return 0;
+	}
+
+	if (path.item.key.objectid != inode->ino ||
+	    path.item.key.type != BTRFS_EXTENT_DATA_KEY)
+		return -1;
+
+	btrfs_map_extent(fs, path.item.key.offset, &extent_item, &e);
+	delta = lstart - e.lstart;
+	if (lstart < e.lstart || delta >= e.len)
+		return -1;	/* lstart is past EOF */
+
+	inode->next_extent.pstart = EXTENT_SPECIAL(e.pstart) ?
+		e.pstart : e.pstart + delta;
+	inode->next_extent.len = e.len - delta;
+	PVT(inode)->offset = extent_item.disk_bytenr + extent_item.offset;
+
+	/* Now the rest of the leaf */
+	if (!extent_map_add(inode, &e))
+		return 0;
+
+	for (slot = path.slots[0] + 1; slot < (int)leaf->header.nritems;
+	     slot++) {
+		item = &leaf->items[slot];
+		if (item->key.objectid != inode->ino ||
+		    item->key.type != BTRFS_EXTENT_DATA_KEY)
+			break;
+
+		fe = (const struct btrfs_file_extent_item *)
+			(leaf_buf + sizeof(struct btrfs_header) + item->offset);
+		if (fe->type == BTRFS_FILE_EXTENT_INLINE ||
+		    fe->compression || fe->encryption)
+			break;	/* leave it for the checks above */
+
+		btrfs_map_extent(fs, item->key.offset, fe, &e);
+		if (!extent_map_add(inode, &e))
+			break;
 	}
-	inode->next_extent.pstart =
-		logical_physical(offset) >> sec_shift;
-	PVT(inode)->offset = offset;
+
 	return 0;
 }
 
@@ -651,6 +727,12 @@ static int btrfs_fs_init(struct fs_info *fs)
 	btrfs_read_super_block(fs);
 	if (strncmp((char *)(&sb.magic), BTRFS_MAGIC, sizeof(sb.magic)))
 		return -1;
+	if (sb.nodesize > BTRFS_MAX_LEAF_SIZE ||
+	    sb.leafsize > BTRFS_MAX_LEAF_SIZE) {
+		printf("btrfs: tree nodes over %u bytes are not supported\n",
+		       BTRFS_MAX_LEAF_SIZE);
+		return -1;
+	}
 	btrfs_read_sys_chunk_array();
 	btrfs_read_chunk_tree(fs);
 	btrfs_get_fs_tree(fs);
@@ -188,6 +188,8 @@ struct btrfs_path {
 	/* remember last slot's item and data */
 	struct btrfs_item item;
 	u8 data[BTRFS_MAX_LEAF_SIZE];
+	/* if set, search_tree() also copies the whole leaf here */
+	u8 *leaf;
 };
 
 /* store logical offset to physical offset mapping */
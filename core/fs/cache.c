@@ -6,9 +6,52 @@
 #include <stdio.h>
 #include <string.h>
 #include <dprintf.h>
+#include <ilog2.h>
 #include "core.h"
 #include "cache.h"
 
+/*
+ * The hash index maps a block number to its descriptor, so a lookup
+ * doesn't have to walk every descriptor.  Blocks are mostly accessed
+ * in runs, so the low bits make a perfectly good hash.
+ */
+static inline struct cache **cache_bucket(struct device *dev, block_t block)
+{
+    return &dev->cache_hash[(uint32_t)block & dev->cache_hash_mask];
+}
+
+static struct cache *cache_lookup(struct device *dev, block_t block)
+{
+    struct cache *cs;
+
+    for (cs = *cache_bucket(dev, block); cs; cs = cs->hnext) {
+	if (cs->block == block)
+	    break;
+    }
+    return cs;
+}
+
+static void cache_unhash(struct device *dev, struct cache *cs)
+{
+    struct cache **pp;
+
+    for (pp = cache_bucket(dev, cs->block); *pp; pp = &(*pp)->hnext) {
+	if (*pp == cs) {
+	    *pp = cs->hnext;
+	    break;
+	}
+    }
+    cs->hnext = NULL;
+}
+
+static void cache_hash(struct device *dev, struct cache *cs)
+{
+    struct cache **pp = cache_bucket(dev, cs->block);
+
+    cs->hnext = *pp;
+    *pp = cs;
+}
+
 
 /*
  * Initialize the cache data structres. the _block_size_shift_ specify
@@ -21,26 +64,39 @@ void cache_init(struct device *dev, int block_size_shift)
     struct cache *prev, *cur;
     char *data = dev->cache_data;
     struct cache *head, *cache;
-    int i;
+    int i, hash_size;
 
     dev->cache_block_size = 1 << block_size_shift;
+    dev->cache_stats.block_size = dev->cache_block_size;
 
-    if (dev->cache_size < dev->cache_block_size + 2*sizeof(struct cache)) {
+    if (dev->cache_size < dev->cache_block_size + 2*sizeof(struct cache)
+	+ sizeof(struct cache *)) {
 	dev->cache_head = NULL;
 	return;			/* Cache unusably small */
     }
 
-    /* We need one struct cache for the headnode plus one for each block */
+    /*
+     * We need one struct cache for the headnode plus one for each
+     * block, and at most one hash bucket per block.
+     */
     dev->cache_entries =
 	(dev->cache_size - sizeof(struct cache))/
-	(dev->cache_block_size + sizeof(struct cache));
+	(dev->cache_block_size + sizeof(struct cache) +
+	 sizeof(struct cache *));
+
+    dev->cache_stats.entries = dev->cache_entries;
 
     dev->cache_head = head = (struct cache *)
 	(data + (dev->cache_entries << block_size_shift));
     cache = dev->cache_head + 1; /* First cache descriptor */
 
+    /* The hash buckets follow the descriptors; use a power of 2 */
+    hash_size = 1 << ilog2(dev->cache_entries);
+    dev->cache_hash = (struct cache **)&cache[dev->cache_entries];
+    dev->cache_hash_mask = hash_size - 1;
+    memset(dev->cache_hash, 0, hash_size * sizeof(struct cache *));
+
     head->prev  = &cache[dev->cache_entries-1];
-    head->next->prev = dev->cache_head;
     head->block = -1;
     head->data  = NULL;
 
@@ -50,15 +106,59 @@ void cache_init(struct device *dev, int block_size_shift)
         cur = &cache[i];
         cur->data  = data;
         cur->block = -1;
+        cur->hnext = NULL;
         cur->prev  = prev;
         prev->next = cur;
         data += dev->cache_block_size;
         prev = cur++;
     }
+    prev->next = head;
+
+    /*
+     * Read-ahead is bounded by a quarter of the cache, so that blocks a
+     * caller is still holding on to are not evicted, and by what the
+     * disk can do in a single transfer.
+     */
+    dev->cache_ra_next   = -1;
+    dev->cache_ra_window = 1;
+    dev->cache_ra_max    = dev->cache_entries >> 2;
+    if (dev->cache_ra_max > CACHE_RA_MAX)
+	dev->cache_ra_max = CACHE_RA_MAX;
+    if (dev->disk) {
+	unsigned int sec_per_block =
+	    dev->cache_block_size >> dev->disk->sector_shift;
+
+	if (sec_per_block &&
+	    dev->cache_ra_max > dev->disk->maxtransfer / sec_per_block)
+	    dev->cache_ra_max = dev->disk->maxtransfer / sec_per_block;
+    }
+    if (!dev->cache_ra_max)
+	dev->cache_ra_max = 1;
+
+    /*
+     * Never read ahead off the end of the media: a failed read goes
+     * through all of diskio's retry and fallback machinery, and can
+     * leave maxtransfer lowered for good.
+     */
+    dev->cache_ra_limit = -1;
+    if (dev->disk && dev->disk->sectors > dev->disk->part_start)
+	dev->cache_ra_limit = (dev->disk->sectors - dev->disk->part_start)
+	    >> (block_size_shift - dev->disk->sector_shift);
 }
 
 /*
- * Lock a block permanently in the cache
+ * Tell the cache where the filesystem ends, if that is known to be
+ * short of the media; the partition size is not known down here.
+ */
+void cache_set_limit(struct device *dev, block_t blocks)
+{
+    if (blocks < dev->cache_ra_limit)
+	dev->cache_ra_limit = blocks;
+}
+
+/*
+ * Lock a block permanently in the cache.  The block stays in the hash
+ * index, so it can still be found; it just never becomes a victim.
  */
 void cache_lock_block(struct cache *cs)
 {
@@ -72,25 +172,27 @@ void cache_lock_block(struct cache *cs)
  * Check for a particular BLOCK in the block cache, 
  * and if it is already there, just do nothing and return;
  * otherwise pick a victim block and update the LRU link.
+ *
+ * A victim is removed from the hash index and marked invalid (-1);
+ * the caller is responsible for filling it and hashing it in again,
+ * see get_cache().
  */
 struct cache *_get_cache_block(struct device *dev, block_t block)
 {
     struct cache *head = dev->cache_head;
     struct cache *cs;
-    int i;
-
-    cs = dev->cache_head + 1;
 
-    for (i = 0; i < dev->cache_entries; i++) {
-	if (cs->block == block)
-	    goto found;
-	cs++;
+    cs = cache_lookup(dev, block);
+    if (!cs) {
+	/* Not found, pick a victim */
+	cs = head->next;
+	if (cs->block != (block_t)-1) {
+	    cache_unhash(dev, cs);
+	    cs->block = -1;
+	    dev->cache_stats.evictions++;
+	}
     }
-    
-    /* Not found, pick a victim */
-    cs = head->next;
 
-found:
     /* Move to the end of the LRU chain, unless the block is already locked */
     if (cs->next) {
 	cs->prev->next = cs->next;
@@ -105,6 +207,67 @@ found:
     return cs;
 }    
 
+/*
+ * Pick the number of blocks to fetch on a miss at BLOCK.  A miss right
+ * after the previous miss run means someone is scanning sequentially,
+ * so the window is doubled; anything else shrinks it back to one block.
+ */
+static int cache_ra_window(struct device *dev, block_t block)
+{
+    if (block == dev->cache_ra_next) {
+	if (dev->cache_ra_window < dev->cache_ra_max)
+	    dev->cache_ra_window <<= 1;
+	if (dev->cache_ra_window > dev->cache_ra_max)
+	    dev->cache_ra_window = dev->cache_ra_max;
+    } else {
+	dev->cache_ra_window = 1;
+    }
+
+    return dev->cache_ra_window;
+}
+
+/*
+ * Read a run of cache descriptors holding consecutive blocks.  The
+ * descriptors are split into groups whose buffers happen to be adjacent
+ * in memory, and each group is read with a single disk request.
+ */
+static void cache_fill(struct device *dev, struct cache **cv, int n)
+{
+    struct disk *disk = dev->disk;
+    int sec_per_block = dev->cache_block_size >> disk->sector_shift;
+    int i, j, k;
+    size_t done;
+
+    for (i = 0; i < n; i = j) {
+	for (j = i + 1; j < n; j++) {
+	    if ((char *)cv[j]->data !=
+		(char *)cv[j-1]->data + dev->cache_block_size)
+		break;
+	}
+
+	done = disk->rdwr_sectors(disk, cv[i]->data,
+				  cv[i]->block * sec_per_block,
+				  (j - i) * sec_per_block, 0);
+	dev->cache_stats.fills++;
+	dev->cache_stats.blocks_read += done / sec_per_block;
+	if (done < (size_t)(j - i) * sec_per_block) {
+	    /*
+	     * Don't keep blocks that didn't make it, except for the one
+	     * that was actually asked for; that is what getoneblk() always
+	     * did.  Reading ahead is likely what ran off the end of the
+	     * media, so stop doing that.
+	     */
+	    for (k = i + done / sec_per_block; k < j; k++) {
+		if (cv[k] == cv[0])
+		    continue;
+		cache_unhash(dev, cv[k]);
+		cv[k]->block = -1;
+	    }
+	    dev->cache_ra_max = dev->cache_ra_window = 1;
+	}
+    }
+}
+
 /*
  * Check for a particular BLOCK in the block cache, 
  * and if it is already there, just do nothing and return;
@@ -113,12 +276,40 @@ found:
  */
 const void *get_cache(struct device *dev, block_t block)
 {
+    struct cache *cv[CACHE_RA_MAX];
     struct cache *cs;
+    int n, window;
+
+    dev->cache_stats.lookups++;
 
     cs = _get_cache_block(dev, block);
-    if (cs->block != block) {
+    if (cs->block == block) {
+	dev->cache_stats.hits++;
+    } else {
 	cs->block = block;
-        getoneblk(dev->disk, cs->data, block, dev->cache_block_size);
+	cache_hash(dev, cs);
+	cv[0] = cs;
+
+	/*
+	 * Read ahead up to the window size, stopping at the first block
+	 * that is already cached.
+	 */
+	window = cache_ra_window(dev, block);
+	if (block >= dev->cache_ra_limit)
+	    window = 1;
+	else if (window > dev->cache_ra_limit - block)
+	    window = dev->cache_ra_limit - block;
+	for (n = 1; n < window; n++) {
+	    if (cache_lookup(dev, block + n))
+		break;
+	    cv[n] = _get_cache_block(dev, block + n);
+	    cv[n]->block = block + n;
+	    cache_hash(dev, cv[n]);
+	}
+	dev->cache_ra_next = block + n;
+	dev->cache_stats.readahead += n - 1;
+
+	cache_fill(dev, cv, n);
     }
 
     return cs->data;
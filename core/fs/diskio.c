@@ -1,6 +1,7 @@
 #include <dprintf.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <klibc/compiler.h>
 #include <core.h>
@@ -10,6 +11,25 @@
 
 #define RETRY_COUNT 6
 
+/*
+ * Issue an INT 13h read or write and account for it.  The clock is the
+ * BIOS timer, which advances ~55 ms at a time; that is useless for a
+ * single call, but the sum over many calls is still a fair estimate.
+ */
+static void disk_intcall(struct disk *disk, com32sys_t *ireg,
+			 com32sys_t *oreg)
+{
+    struct disk_io_stats *st = &disk->stats;
+    uint32_t t = ms_timer();
+
+    __intcall(0x13, ireg, oreg);
+
+    st->calls++;
+    st->time_total += ms_timer() - t;
+    if (oreg->eflags.l & EFLAGS_CF)
+	st->errors++;
+}
+
 static inline sector_t chs_max(const struct disk *disk)
 {
     return (sector_t)disk->secpercyl << 10;
@@ -46,7 +66,7 @@ static int chs_rdwr_sectors(struct disk *disk, void *buf,
 
 	freeseg = (0x10000 - ((size_t)ptr & 0xffff)) >> sector_shift;
 
-	if ((size_t)buf <= 0xf0000 && freeseg) {
+	if ((size_t)ptr <= 0xf0000 && freeseg) {
 	    /* Can do a direct load */
 	    tptr = ptr;
 	} else {
@@ -87,7 +107,7 @@ static int chs_rdwr_sectors(struct disk *disk, void *buf,
 			(ireg.eax.b[1] & 1) ? "<-" : "->",
 			ptr);
 
-		__intcall(0x13, &ireg, &oreg);
+		disk_intcall(disk, &ireg, &oreg);
 		if (!(oreg.eflags.l & EFLAGS_CF))
 		    break;
 
@@ -103,6 +123,7 @@ static int chs_rdwr_sectors(struct disk *disk, void *buf,
 		chunk >>= 1;
 		if (chunk) {
 		    maxtransfer = chunk;
+		    disk->stats.downgrades++;
 		    retry = RETRY_COUNT;
 		    ireg.eax.b[0] = chunk;
 		    continue;
@@ -118,8 +139,13 @@ static int chs_rdwr_sectors(struct disk *disk, void *buf,
 
 	bytes = chunk << sector_shift;
 
-	if (tptr != ptr && !is_write)
-	    memcpy(ptr, tptr, bytes);
+	if (tptr != ptr) {
+	    if (!is_write)
+		memcpy(ptr, tptr, bytes);
+	    disk->stats.bounces++;
+	    disk->stats.bounce_bytes += bytes;
+	}
+	disk->stats.sectors += chunk;
 
 	/* If we dropped maxtransfer, it eventually worked, so remember it */
 	disk->maxtransfer = maxtransfer;
@@ -138,12 +164,81 @@ struct edd_rdwr_packet {
     uint16_t blocks;
     far_ptr_t buf;
     uint64_t lba;
+    uint64_t buf64;		/* EDD 3.0: used if buf == FFFF:FFFF */
 };
 
+#define EDD_PKT_SIZE	offsetof(struct edd_rdwr_packet, buf64)
+#define EDD_FLAT_GUARD	((char *)0x10ffef)	/* Linear address of FFFF:FFFF */
+
+static __lowmem struct edd_rdwr_packet pkt;
+
+/*
+ * EDD 3.0 lets the buffer be given as a 64-bit flat address, which
+ * means we can load straight into high memory instead of going through
+ * core_xfer_buf 64K at a time.  Plenty of BIOSes that claim EDD 3.0
+ * don't really implement it, though, and would just write to FFFF:FFFF;
+ * that is about 64K into the protected-mode core.  So this is only
+ * tried if the EDDFLAT directive asks for it, and then once with a
+ * single sector, checking both the data and that nothing landed at
+ * FFFF:FFFF before trusting it.
+ */
+extern uint16_t EDDFlat;
+
+static bool edd_probe_flat(struct disk *disk, sector_t lba, void *buf)
+{
+    com32sys_t ireg, oreg;
+    char *ref   = core_xfer_buf;
+    char *guard = core_xfer_buf + 32768;
+    size_t bytes = disk->sector_size;
+    size_t i;
+    bool ok;
+
+    disk->edd_flat = -1;
+    if (bytes > 32768)
+	return false;
+
+    memset(&ireg, 0, sizeof ireg);
+    ireg.eax.b[1] = 0x42;
+    ireg.edx.b[0] = disk->disk_number;
+    ireg.ds       = SEG(&pkt);
+    ireg.esi.w[0] = OFFS(&pkt);
+
+    /* Reference copy, the old-fashioned way */
+    pkt.size   = EDD_PKT_SIZE;
+    pkt.blocks = 1;
+    pkt.buf    = FAR_PTR(ref);
+    pkt.lba    = lba;
+    disk_intcall(disk, &ireg, &oreg);
+    if (oreg.eflags.l & EFLAGS_CF)
+	return false;
+
+    for (i = 0; i < bytes; i++)
+	((char *)buf)[i] = ~ref[i];
+    memcpy(guard, EDD_FLAT_GUARD, bytes);
+
+    pkt.size    = sizeof pkt;
+    pkt.blocks  = 1;
+    pkt.buf.ptr = 0xffffffff;
+    pkt.lba     = lba;
+    pkt.buf64   = (size_t)buf;
+    disk_intcall(disk, &ireg, &oreg);
+
+    ok = !(oreg.eflags.l & EFLAGS_CF) && !memcmp(buf, ref, bytes);
+    if (memcmp(guard, EDD_FLAT_GUARD, bytes)) {
+	memcpy(EDD_FLAT_GUARD, guard, bytes);
+	ok = false;
+    }
+
+    dprintf("EDD[%02x]: 64-bit buffers %s\n", disk->disk_number,
+	    ok ? "work" : "don't work");
+
+    disk->edd_flat = ok ? 1 : -1;
+    return ok;
+}
+
 static int edd_rdwr_sectors(struct disk *disk, void *buf,
 			    sector_t lba, size_t count, bool is_write)
 {
-    static __lowmem struct edd_rdwr_packet pkt;
     char *ptr = buf;
     char *tptr;
     size_t chunk, freeseg;
@@ -152,6 +247,7 @@ static int edd_rdwr_sectors(struct disk *disk, void *buf,
     size_t done = 0;
     size_t bytes;
     int retry;
+    bool flat;
     uint32_t maxtransfer = disk->maxtransfer;
 
     memset(&ireg, 0, sizeof ireg);
@@ -170,10 +266,19 @@ static int edd_rdwr_sectors(struct disk *disk, void *buf,
 	    chunk = maxtransfer;
 
 	freeseg = (0x10000 - ((size_t)ptr & 0xffff)) >> sector_shift;
+	flat = false;
 
 	if ((size_t)ptr <= 0xf0000 && freeseg) {
 	    /* Can do a direct load */
 	    tptr = ptr;
+	} else if ((size_t)ptr > 0xf0000 &&
+		   (disk->edd_flat > 0 ||
+		    (!disk->edd_flat && EDDFlat && !is_write &&
+		     edd_probe_flat(disk, lba, ptr)))) {
+	    /* High memory, but the BIOS can take a 64-bit address */
+	    tptr = ptr;
+	    flat = true;
+	    freeseg = chunk;
 	} else {
 	    /* Either accessing high memory or we're crossing a 64K line */
 	    tptr = core_xfer_buf;
@@ -190,10 +295,16 @@ static int edd_rdwr_sectors(struct disk *disk, void *buf,
 	retry = RETRY_COUNT;
 
 	for (;;) {
-	    pkt.size   = sizeof pkt;
 	    pkt.blocks = chunk;
-	    pkt.buf    = FAR_PTR(tptr);
 	    pkt.lba    = lba;
+	    if (flat) {
+		pkt.size    = sizeof pkt;
+		pkt.buf.ptr = 0xffffffff;
+		pkt.buf64   = (size_t)tptr;
+	    } else {
+		pkt.size    = EDD_PKT_SIZE;
+		pkt.buf     = FAR_PTR(tptr);
+	    }
 
 	    dprintf("EDD[%02x]: %u @ %llu %04x:%04x %s %p\n",
 		    ireg.edx.b[0], pkt.blocks, pkt.lba,
@@ -201,12 +312,18 @@ static int edd_rdwr_sectors(struct disk *disk, void *buf,
 		    (ireg.eax.b[1] & 1) ? "<-" : "->",
 		    ptr);
 
-	    __intcall(0x13, &ireg, &oreg);
+	    disk_intcall(disk, &ireg, &oreg);
 	    if (!(oreg.eflags.l & EFLAGS_CF))
 		break;
 
 	    dprintf("EDD: error AX = %04x\n", oreg.eax.w[0]);
 
+	    if (flat) {
+		/* Passed the probe, but not this; stop using them */
+		disk->edd_flat = -1;
+		break;
+	    }
+
 	    if (retry--)
 		continue;
 
@@ -217,11 +334,13 @@ static int edd_rdwr_sectors(struct disk *disk, void *buf,
 	     * waiting for the floppy disk to spin up.
 	     */
 	    __intcall(0x13, &reset, NULL);
+	    disk->stats.resets++;
 
 	    /* For any starting value, this will always end with ..., 1, 0 */
 	    chunk >>= 1;
 	    if (chunk) {
 		maxtransfer = chunk;
+		disk->stats.downgrades++;
 		retry = RETRY_COUNT;
 		continue;
 	    }
@@ -235,6 +354,7 @@ static int edd_rdwr_sectors(struct disk *disk, void *buf,
 	     * Try to fall back to CHS.  If the LBA is absurd, the
 	     * chs_max() test in chs_rdwr_sectors() will catch it.
 	     */
+	    disk->stats.chs_fallbacks++;
 	    done = chs_rdwr_sectors(disk, buf, lba - disk->part_start,
 				    count, is_write);
 	    if (done == (count << sector_shift)) {
@@ -249,10 +369,20 @@ static int edd_rdwr_sectors(struct disk *disk, void *buf,
 	    return done;	/* Failure */
 	}
 
+	if (flat && disk->edd_flat < 0)
+	    continue;		/* Redo this chunk through core_xfer_buf */
+
 	bytes = chunk << sector_shift;
 
-	if (tptr != ptr && !is_write)
-	    memcpy(ptr, tptr, bytes);
+	if (tptr != ptr) {
+	    if (!is_write)
+		memcpy(ptr, tptr, bytes);
+	    disk->stats.bounces++;
+	    disk->stats.bounce_bytes += bytes;
+	}
+	if (flat)
+	    disk->stats.flat++;
+	disk->stats.sectors += chunk;
 
 	/* If we dropped maxtransfer, it eventually worked, so remember it */
 	disk->maxtransfer = maxtransfer;
@@ -306,8 +436,10 @@ struct disk *disk_init(uint8_t devno, bool cdrom, sector_t part_start,
     static __lowmem struct edd_disk_params edd_params;
     com32sys_t ireg, oreg;
     bool ebios;
+    int edd_flat = -1;
     int sector_size;
     unsigned int hard_max_transfer;
+    sector_t sectors = 0;
 
     memset(&ireg, 0, sizeof ireg);
     ireg.edx.b[0] = devno;
@@ -338,6 +470,9 @@ struct disk *disk_init(uint8_t devno, bool cdrom, sector_t part_start,
 	    if (!(oreg.eflags.l & EFLAGS_CF)) {
 		disk.h = oreg.edx.b[1] + 1;
 		disk.s = oreg.ecx.b[0] & 63;
+		/* Only what CHS can reach; EBIOS below may know better */
+		sectors = (sector_t)(((oreg.ecx.b[0] & 0xc0) << 2) +
+				     oreg.ecx.b[1] + 1) * disk.h * disk.s;
 	    }
 	}
 
@@ -353,6 +488,9 @@ struct disk *disk_init(uint8_t devno, bool cdrom, sector_t part_start,
 	    ebios = true;
 	    hard_max_transfer = 127;
 
+	    /* AH = major version; 30h is EDD 3.0 */
+	    edd_flat = oreg.eax.b[1] >= 0x30 ? 0 : -1;
+
 	    /* Query EBIOS parameters */
 	    /* The memset() is needed once this function can be called
 	       more than once */
@@ -372,6 +510,8 @@ struct disk *disk_init(uint8_t devno, bool cdrom, sector_t part_start,
 		if (edd_params.sector_size >= 512 &&
 		    is_power_of_2(edd_params.sector_size))
 		    sector_size = edd_params.sector_size;
+		if (edd_params.sectors)
+		    sectors = edd_params.sectors;
 	    }
 	}
 
@@ -381,7 +521,9 @@ struct disk *disk_init(uint8_t devno, bool cdrom, sector_t part_start,
     disk.sector_size   = sector_size;
     disk.sector_shift  = ilog2(sector_size);
     disk.part_start    = part_start;
+    disk.sectors       = sectors;
     disk.secpercyl     = disk.h * disk.s;
+    disk.edd_flat      = edd_flat;
     disk.rdwr_sectors  = ebios ? edd_rdwr_sectors : chs_rdwr_sectors;
 
     if (!MaxTransfer || MaxTransfer > hard_max_transfer)
@@ -389,14 +531,43 @@ struct disk *disk_init(uint8_t devno, bool cdrom, sector_t part_start,
 
     disk.maxtransfer   = MaxTransfer;
 
-    dprintf("disk %02x cdrom %d type %d sector %u/%u offset %llu limit %u\n",
-	    devno, cdrom, ebios, sector_size, disk.sector_shift,
-	    part_start, disk.maxtransfer);
+    dprintf("disk %02x cdrom %d type %d sector %u/%u offset %llu size %llu "
+	    "limit %u\n", devno, cdrom, ebios, sector_size, disk.sector_shift,
+	    part_start, sectors, disk.maxtransfer);
 
     return &disk;
 }
 
 
+/*
+ * INT 22h AX=0026h: copy the disk and cache statistics for the boot
+ * device to ES:BX, at most CX bytes; returns the full size in CX.
+ */
+void get_diskstats(com32sys_t *regs)
+{
+    static struct disk_stats stats;
+    struct device *dev = this_fs->fs_dev;
+    struct disk *disk = dev ? dev->disk : NULL;
+    void *buf = MK_PTR(regs->es, regs->ebx.w[0]);
+    size_t len = sizeof stats;
+
+    memset(&stats, 0, sizeof stats);
+    if (disk) {
+	stats.disk_number = disk->disk_number;
+	stats.ebios       = disk->rdwr_sectors == edd_rdwr_sectors;
+	stats.sector_size = disk->sector_size;
+	stats.maxtransfer = disk->maxtransfer;
+	stats.io          = disk->stats;
+    }
+    if (dev)
+	stats.cache = dev->cache_stats;
+
+    if (len > regs->ecx.w[0])
+	len = regs->ecx.w[0];
+    memcpy(buf, &stats, len);
+    regs->ecx.w[0] = sizeof stats;
+}
+
 /*
  * Initialize the device structure.
  *
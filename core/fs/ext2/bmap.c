@@ -79,6 +79,209 @@ bmap_extent(struct inode *inode, uint32_t block, size_t *nblocks)
     return start + block;
 }
 
+/*
+ * The extent iterator, used by ext2_next_extent() to walk the extent
+ * tree of a file in order: it keeps its position between calls, so
+ * a sequential read only descends the tree once per file and steps
+ * from one leaf to the next.
+ */
+static const struct ext4_extent_header *
+ext4_iter_node(struct inode *inode, int level)
+{
+    const struct ext4_extent_header *eh;
+
+    if (!level)
+	return &PVT(inode)->i_extent_hdr;
+
+    eh = get_cache(inode->fs->fs_dev, PVT(inode)->ext_blk[level]);
+    return eh->eh_magic == EXT4_EXT_MAGIC ? eh : NULL;
+}
+
+/* Descend from _level_ along the current index entries to the leaf */
+static int ext4_iter_descend(struct inode *inode, int level, block_t block,
+			     bool leftmost)
+{
+    struct ext2_pvt_inode *pvt = PVT(inode);
+    const struct ext4_extent_header *eh;
+    const struct ext4_extent_idx *index;
+    const struct ext4_extent *ext;
+    int i;
+
+    for (;;) {
+	eh = ext4_iter_node(inode, level);
+	if (!eh || eh->eh_depth != pvt->ext_depth - level)
+	    return -1;
+
+	if (level == pvt->ext_depth) {
+	    ext = EXT4_FIRST_EXTENT(eh);
+	    for (i = 0; !leftmost && i < (int)eh->eh_entries; i++) {
+		if (block < ext[i].ee_block)
+		    break;
+	    }
+	    /* Just before the first extent we want is a hole */
+	    pvt->ext_idx[level] = i && !leftmost ? i - 1 : 0;
+	    return 0;
+	}
+
+	index = EXT4_FIRST_INDEX(eh);
+	for (i = 0; !leftmost && i < (int)eh->eh_entries; i++) {
+	    if (block < index[i].ei_block)
+		break;
+	}
+	if (!leftmost && i)
+	    i--;
+	if (i >= (int)eh->eh_entries)
+	    return -1;
+
+	pvt->ext_idx[level] = i;
+	level++;
+	pvt->ext_blk[level] = ((block_t)index[i].ei_leaf_hi << 32) +
+	    index[i].ei_leaf_lo;
+    }
+}
+
+static int ext4_iter_seek(struct inode *inode, uint32_t block)
+{
+    struct ext2_pvt_inode *pvt = PVT(inode);
+
+    pvt->ext_valid = 0;
+    if (pvt->i_extent_hdr.eh_magic != EXT4_EXT_MAGIC ||
+	pvt->i_extent_hdr.eh_depth > EXT4_MAX_DEPTH)
+	return -1;
+
+    pvt->ext_depth = pvt->i_extent_hdr.eh_depth;
+    if (ext4_iter_descend(inode, 0, block, false))
+	return -1;
+
+    pvt->ext_next  = block;
+    pvt->ext_valid = 1;
+    return 0;
+}
+
+/*
+ * Move on to the next extent.  At the end of the file, the index
+ * in the leaf is left pointing past the last entry.
+ */
+static void ext4_iter_advance(struct inode *inode)
+{
+    struct ext2_pvt_inode *pvt = PVT(inode);
+    const struct ext4_extent_header *eh;
+    const struct ext4_extent_idx *index;
+    int level = pvt->ext_depth;
+
+    eh = ext4_iter_node(inode, level);
+    if (eh && ++pvt->ext_idx[level] < eh->eh_entries)
+	return;
+
+    /* Next leaf: go up until there is an index entry to the right */
+    while (level--) {
+	eh = ext4_iter_node(inode, level);
+	if (eh && pvt->ext_idx[level] + 1 < eh->eh_entries) {
+	    index = EXT4_FIRST_INDEX(eh) + ++pvt->ext_idx[level];
+	    pvt->ext_blk[level+1] = ((block_t)index->ei_leaf_hi << 32) +
+		index->ei_leaf_lo;
+	    if (ext4_iter_descend(inode, level+1, 0, true))
+		break;
+	    return;
+	}
+    }
+
+    /* The end */
+    level = pvt->ext_depth;
+    eh = ext4_iter_node(inode, level);
+    pvt->ext_idx[level] = eh ? eh->eh_entries : 0;
+}
+
+/*
+ * The extent the iterator points at, or NULL at the end; *_len_ and
+ * *_uninit_ are set from ee_len.
+ */
+static const struct ext4_extent *ext4_iter_extent(struct inode *inode,
+						  uint32_t *len, bool *uninit)
+{
+    struct ext2_pvt_inode *pvt = PVT(inode);
+    const struct ext4_extent_header *eh;
+    const struct ext4_extent *ext;
+
+    eh = ext4_iter_node(inode, pvt->ext_depth);
+    if (!eh || pvt->ext_idx[pvt->ext_depth] >= eh->eh_entries)
+	return NULL;
+
+    ext = EXT4_FIRST_EXTENT(eh) + pvt->ext_idx[pvt->ext_depth];
+    *uninit = ext->ee_len > EXT4_INIT_MAX_LEN;
+    *len = *uninit ? ext->ee_len - EXT4_INIT_MAX_LEN : ext->ee_len;
+    return ext;
+}
+
+/*
+ * Map _block_ and as many blocks after it as are contiguous on disk,
+ * even across extents and leaves.  Holes and uninitialized extents
+ * map to block 0, i.e. zeroes.
+ */
+static block_t ext4_iter_map(struct inode *inode, uint32_t block,
+			     size_t *nblocks)
+{
+    struct ext2_pvt_inode *pvt = PVT(inode);
+    const struct ext4_extent *ext;
+    uint32_t len, eblock;
+    block_t start, end, pblock;
+    bool uninit, zero;
+
+    if ((!pvt->ext_valid || block != pvt->ext_next) &&
+	ext4_iter_seek(inode, block)) {
+	printf("ERROR, extent leaf not found\n");
+	*nblocks = 0;
+	return 0;
+    }
+
+    ext = ext4_iter_extent(inode, &len, &uninit);
+    while (ext && block >= ext->ee_block + len) {
+	/* Past this one; there's a hole or a later extent */
+	ext4_iter_advance(inode);
+	ext = ext4_iter_extent(inode, &len, &uninit);
+    }
+
+    if (!ext) {
+	/* A hole up to the end of the file */
+	end = (inode->size + BLOCK_SIZE(inode->fs) - 1)
+	    >> BLOCK_SHIFT(inode->fs);
+	*nblocks = end > block ? end - block : 1;
+	pvt->ext_next = block + *nblocks;
+	return 0;
+    }
+
+    if (block < ext->ee_block) {
+	/* A hole up to the next extent */
+	*nblocks = ext->ee_block - block;
+	pvt->ext_next = ext->ee_block;
+	return 0;
+    }
+
+    zero = uninit;
+    start = ((block_t)ext->ee_start_hi << 32) + ext->ee_start_lo;
+    pblock = zero ? 0 : start + (block - ext->ee_block);
+    *nblocks = ext->ee_block + len - block;
+    eblock = ext->ee_block + len;
+    end = start + len;
+
+    /* Coalesce with whatever follows, for as long as it's contiguous */
+    for (;;) {
+	ext4_iter_advance(inode);
+	ext = ext4_iter_extent(inode, &len, &uninit);
+	if (!ext || ext->ee_block != eblock || uninit != zero)
+	    break;
+	start = ((block_t)ext->ee_start_hi << 32) + ext->ee_start_lo;
+	if (!zero && start != end)
+	    break;
+	*nblocks += len;
+	eblock += len;
+	end += len;
+    }
+
+    pvt->ext_next = block + *nblocks;
+    return pblock;
+}
+
 /*
  * Scan forward in a range of blocks to see if they are contiguous,
  * then return the initial value.
@@ -215,7 +418,10 @@ int ext2_next_extent(struct inode *inode, uint32_t lstart)
     block_t block;
     size_t nblocks = 0;
 
-    block = ext2_bmap(inode, lstart >> blktosec, &nblocks);
+    if (inode->flags & EXT4_EXTENTS_FLAG)
+	block = ext4_iter_map(inode, lstart >> blktosec, &nblocks);
+    else
+	block = ext2_bmap(inode, lstart >> blktosec, &nblocks);
 
     if (!block)
 	inode->next_extent.pstart = EXTENT_ZERO;
@@ -311,6 +311,7 @@ static int ext2_fs_init(struct fs_info *fs)
 
     /* Initialize the cache, and force block zero to all zero */
     cache_init(fs->fs_dev, fs->block_shift);
+    cache_set_limit(fs->fs_dev, sb.s_blocks_count);
     cs = _get_cache_block(fs->fs_dev, 0);
     memset(cs->data, 0, fs->block_size);
     cache_lock_block(cs);
@@ -34,6 +34,8 @@
 
 /* for EXT4 extent */
 #define EXT4_EXT_MAGIC     0xf30a
+#define EXT4_MAX_DEPTH     5	   /* Deepest extent tree we handle */
+#define EXT4_INIT_MAX_LEN  32768   /* Longer extents are uninitialized */
 #define EXT4_EXTENTS_FLAG  0x00080000
 
 /*
@@ -297,6 +299,17 @@ struct ext2_pvt_inode {
 	uint32_t i_block[EXT2_N_BLOCKS];
 	struct ext4_extent_header i_extent_hdr;
     };
+
+    /*
+     * Position of the extent iterator: the tree node and entry at each
+     * level, level 0 being the root in the inode, and the logical
+     * block the iterator is at.
+     */
+    block_t  ext_blk[EXT4_MAX_DEPTH + 1];
+    uint16_t ext_idx[EXT4_MAX_DEPTH + 1];
+    uint32_t ext_next;
+    uint8_t  ext_depth;
+    uint8_t  ext_valid;
 };
 
 #define PVT(i) ((struct ext2_pvt_inode *)((i)->pvt))
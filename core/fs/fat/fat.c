@@ -83,6 +83,87 @@ static uint32_t get_next_cluster(struct fs_info *fs, uint32_t clust_num)
     return next_cluster;
 }
 
+/*
+ * Like get_next_cluster(), for walking a whole chain: the FAT sector
+ * last used is kept in _cur_ and _data_, so it is only looked up in the
+ * cache when the chain moves on to another one.
+ */
+static uint32_t walk_next_cluster(struct fs_info *fs, uint32_t clust_num,
+				  sector_t *cur, const uint8_t **data)
+{
+    uint32_t offset;
+    sector_t fat_sector;
+
+    if (FAT_SB(fs)->fat_type == FAT12)
+	return get_next_cluster(fs, clust_num);
+
+    offset = clust_num << (FAT_SB(fs)->fat_type == FAT32 ? 2 : 1);
+    fat_sector = offset >> SECTOR_SHIFT(fs);
+    offset &= SECTOR_SIZE(fs) - 1;
+
+    if (fat_sector != *cur) {
+	*data = get_fat_sector(fs, fat_sector);
+	*cur  = fat_sector;
+    }
+
+    if (FAT_SB(fs)->fat_type == FAT16)
+	return *(const uint16_t *)(*data + offset);
+    else
+	return *(const uint32_t *)(*data + offset) & 0x0fffffff;
+}
+
+/*
+ * Follow the cluster chain of a file once, at open time, and record it
+ * in the inode's extent map as runs of contiguous clusters, so that
+ * generic_getfssec() can stream the file without coming back to
+ * fat_next_extent() for every extent.  If the map fills up, the FAT
+ * position is left at the first extent not recorded, and
+ * fat_next_extent() carries on from there.
+ */
+static void fat_map_chain(struct inode *inode)
+{
+    struct fs_info *fs = inode->fs;
+    struct fat_sb_info *sbi = FAT_SB(fs);
+    const uint32_t cluster_secs = UINT32_C(1) << sbi->clust_shift;
+    const uint8_t *data = NULL;
+    sector_t cur = -1;
+    uint32_t tcluster, lcluster, pcluster, xcluster;
+    struct extent e;
+
+    tcluster = (inode->size + (UINT32_C(1) << sbi->clust_byte_shift) - 1)
+	>> sbi->clust_byte_shift;
+    pcluster = PVT(inode)->start_cluster;
+    if (!tcluster || pcluster-2 >= sbi->clusters)
+	return;
+
+    e.lstart = 0;
+    e.pstart = ((sector_t)(pcluster-2) << sbi->clust_shift) + sbi->data;
+    e.len    = cluster_secs;
+
+    for (lcluster = 1; lcluster < tcluster; lcluster++) {
+	xcluster = walk_next_cluster(fs, pcluster, &cur, &data);
+	if (xcluster-2 >= sbi->clusters)
+	    break;		/* Broken chain; let fat_next_extent() decide */
+
+	if (xcluster != pcluster + 1) {
+	    if (!extent_map_add(inode, &e))
+		goto full;
+	    e.lstart = lcluster << sbi->clust_shift;
+	    e.pstart = ((sector_t)(xcluster-2) << sbi->clust_shift) + sbi->data;
+	    e.len    = 0;
+	}
+	e.len += cluster_secs;
+	pcluster = xcluster;
+    }
+
+    if (extent_map_add(inode, &e))
+	return;
+
+full:
+    PVT(inode)->offset = e.lstart;
+    PVT(inode)->here   = e.pstart;
+}
+
 static int fat_next_extent(struct inode *inode, uint32_t lstart)
 {
     struct fs_info *fs = inode->fs;
@@ -556,6 +637,9 @@ found:
     }
     inode->mode = get_inode_mode(de->attr);
 
+    if (inode->mode == DT_REG)
+	fat_map_chain(inode);
+
     return inode;
 }
 
@@ -775,6 +859,7 @@ static int vfat_fs_init(struct fs_info *fs)
 
     /* Initialize the cache */
     cache_init(fs->fs_dev, fs->block_shift);
+    cache_set_limit(fs->fs_dev, total_sectors);
 
     return fs->block_shift;
 }
@@ -2,6 +2,7 @@
 #include <stdbool.h>
 #include <string.h>
 #include <dprintf.h>
+#include <syslinux/pmapi.h>
 #include "fs.h"
 #include "cache.h"
 
@@ -37,7 +38,7 @@ void put_inode(struct inode *inode)
     while (inode && --inode->refcnt == 0) {
 	struct inode *dead = inode;
 	inode = inode->parent;
-	free(dead);
+	free_inode(dead);
     }
 }
 
@@ -181,6 +182,37 @@ size_t pmapi_read_file(uint16_t *handle, void *buf, size_t sectors)
     return bytes_read;
 }
 
+/*
+ * Fill the buffers of several open files.  Filesystems that can do
+ * better than one file after the other get to go first; anything they
+ * leave is read the ordinary way.  Returns -1 if a read failed.
+ */
+int pmapi_read_files(struct com32_readfile *rf, int count)
+{
+    size_t bytes_read;
+    int i;
+
+    if (this_fs->fs_ops->read_files)
+	this_fs->fs_ops->read_files(rf, count);
+
+    for (i = 0; i < count; i++) {
+	while (rf[i].handle && rf[i].bytes < rf[i].size) {
+	    bytes_read = pmapi_read_file(&rf[i].handle,
+					 (char *)rf[i].buf + rf[i].bytes,
+					 (rf[i].size - rf[i].bytes) >>
+					 SECTOR_SHIFT(this_fs));
+	    if (!bytes_read) {
+		if (rf[i].handle)
+		    return -1;
+		break;
+	    }
+	    rf[i].bytes += bytes_read;
+	}
+    }
+
+    return 0;
+}
+
 void pm_searchdir(com32sys_t *regs)
 {
     char *name = MK_PTR(regs->ds, regs->edi.w[0]);
@@ -51,12 +51,21 @@
  * Note: the filesystem driver is not required to do extent coalescing,
  * if that is difficult to do; this routine will perform extent lookahead
  * and coalescing.
+ *
+ * Every extent next_extent() returns is also remembered in a small
+ * per-inode map, so seeking back to a part of the file we have already
+ * seen is a binary search rather than another walk of the FAT chain,
+ * indirect blocks or runlist.
  */
 
 #include <dprintf.h>
+#include <stdlib.h>
 #include <minmax.h>
 #include "fs.h"
 
+#define EXTENT_MAP_MIN	4
+#define EXTENT_MAP_MAX	64	/* Past this, new extents are not kept */
+
 static inline sector_t next_psector(sector_t psector, uint32_t skip)
 {
     if (EXTENT_SPECIAL(psector))
@@ -71,14 +80,122 @@ static inline sector_t next_pstart(const struct extent *e)
 }
 
 
+/*
+ * Index of the first extent in the map starting after _lsector_
+ */
+static int extent_map_search(const struct inode *inode, uint32_t lsector)
+{
+    int lo = 0, hi = inode->extent_count;
+
+    while (lo < hi) {
+	int mid = (lo + hi) >> 1;
+	if (inode->extent_map[mid].lstart <= lsector)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+
+    return lo;
+}
+
+/*
+ * Look up the extent containing _lsector_, and return it trimmed to
+ * start there.  Returns false if we don't know it.
+ */
+static bool extent_map_find(const struct inode *inode, uint32_t lsector,
+			    struct extent *e)
+{
+    const struct extent *m;
+    uint32_t delta;
+    int i;
+
+    i = extent_map_search(inode, lsector);
+    if (!i)
+	return false;
+
+    m = &inode->extent_map[i-1];
+    delta = lsector - m->lstart;
+    if (delta >= m->len)
+	return false;
+
+    e->lstart = lsector;
+    e->pstart = next_psector(m->pstart, delta);
+    e->len    = m->len - delta;
+    return true;
+}
+
+/*
+ * Remember a new extent, merging it into its predecessor if the two are
+ * contiguous.  Filesystems which can map a file cheaply in one go may
+ * call this directly.  Returns false if the map is full.
+ */
+bool extent_map_add(struct inode *inode, const struct extent *e)
+{
+    struct extent *m, *prev;
+    uint32_t len = e->len;
+    int i;
+
+    if (!len || e->pstart == EXTENT_VOID)
+	return true;
+
+    i = extent_map_search(inode, e->lstart);
+    if (i) {
+	prev = &inode->extent_map[i-1];
+	if (e->lstart < prev->lstart + prev->len)
+	    return true;	/* Already known */
+	if (e->lstart == prev->lstart + prev->len &&
+	    e->pstart == next_pstart(prev)) {
+	    prev->len += len;
+	    if (i < inode->extent_count &&
+		prev->lstart + prev->len > inode->extent_map[i].lstart)
+		prev->len = inode->extent_map[i].lstart - prev->lstart;
+	    return true;
+	}
+    }
+
+    if (i < inode->extent_count)
+	len = min(len, inode->extent_map[i].lstart - e->lstart);
+
+    if (inode->extent_count >= inode->extent_alloc) {
+	int nalloc;
+
+	if (inode->extent_alloc >= EXTENT_MAP_MAX)
+	    return false;
+
+	nalloc = inode->extent_alloc ? inode->extent_alloc << 1
+	    : EXTENT_MAP_MIN;
+	/* The core has no realloc() */
+	m = malloc(nalloc * sizeof *m);
+	if (!m)
+	    return false;	/* It's only a cache */
+	if (inode->extent_count)
+	    memcpy(m, inode->extent_map,
+		   inode->extent_count * sizeof *m);
+	free(inode->extent_map);
+	inode->extent_map   = m;
+	inode->extent_alloc = nalloc;
+    }
+
+    m = &inode->extent_map[i];
+    memmove(m + 1, m, (inode->extent_count - i) * sizeof *m);
+    *m = *e;
+    m->len = len;
+    inode->extent_count++;
+    return true;
+}
+
 static void get_next_extent(struct inode *inode)
 {
     /* The logical start address that we care about... */
     uint32_t lstart = inode->this_extent.lstart + inode->this_extent.len;
 
+    if (extent_map_find(inode, lstart, &inode->next_extent))
+	return;
+
     if (inode->fs->fs_ops->next_extent(inode, lstart))
 	inode->next_extent.len = 0; /* ERROR */
     inode->next_extent.lstart = lstart;
+    extent_map_add(inode, &inode->next_extent);
 
     dprintf("Extent: inode %p @ %u start %llu len %u\n",
 	    inode, inode->next_extent.lstart,
@@ -114,9 +231,11 @@ uint32_t generic_getfssec(struct file *file, char *buf,
 
     if (lsector < inode->this_extent.lstart ||
 	lsector >= inode->this_extent.lstart + inode->this_extent.len) {
-	/* Still nothing useful... */
-	inode->this_extent.lstart = lsector;
-	inode->this_extent.len = 0;
+	/* Still nothing useful, unless we have been here before... */
+	if (!extent_map_find(inode, lsector, &inode->this_extent)) {
+	    inode->this_extent.lstart = lsector;
+	    inode->this_extent.len = 0;
+	}
     } else {
 	/* We have some usable information */
 	uint32_t delta = lsector - inode->this_extent.lstart;
@@ -280,6 +280,7 @@ static int iso_fs_init(struct fs_info *fs)
 
     /* Initialize the cache */
     cache_init(fs->fs_dev, fs->block_shift);
+    cache_set_limit(fs->fs_dev, *(uint32_t *)(pvd + VOLUME_SIZE_OFFSET));
 
     return fs->block_shift;
 }
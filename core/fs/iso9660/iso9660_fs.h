@@ -15,7 +15,8 @@ struct iso_boot_info {
 
 extern struct iso_boot_info iso_boot_info; /* In isolinux.asm */
 
-/* The root dir entry offset in the primary volume descriptor */
+/* The volume size (in blocks) and root dir entry offsets in the PVD */
+#define VOLUME_SIZE_OFFSET 80
 #define ROOT_DIR_OFFSET   156
 
 struct iso_dir_entry {
@@ -401,8 +401,10 @@ static int parse_data_run(const void *stream, uint32_t *offset,
         res = (res << byte_shift) | *byte--;
 
     chunk->lcn += res;
-    /* are VCNS from cur_vcn to next_vcn - 1 unallocated ? */
-    if (!chunk->lcn)
+    /* are VCNS from cur_vcn to next_vcn - 1 unallocated ? (sparse runs
+     * have no LCN bytes at all)
+     */
+    if (!l || !chunk->lcn)
         chunk->flags |= MAP_UNALLOCATED;
     else
         chunk->flags |= MAP_ALLOCATED;
@@ -618,6 +620,135 @@ static inline enum dirent_type get_inode_mode(struct ntfs_mft_record *mrec)
     return mrec->flags & MFT_RECORD_IS_DIRECTORY ? DT_DIR : DT_REG;
 }
 
+/* Attribute list entries refer to MFT records including a sequence number */
+#define MFT_REF_NO(ref)     ((ref) & UINT64_C(0x0000FFFFFFFFFFFF))
+
+/* Marks a sparse run in the overflow runlist */
+#define RUN_SPARSE          ((int64_t)-1)
+
+/*
+ * Decode all the data runs of a $DATA attribute record into the inode's
+ * extent map, so generic_getfssec() can read the file straight from
+ * disk without coming back to us.  Runs which no longer fit in the map
+ * go to the overflow runlist, which ntfs_next_extent() searches.
+ * Returns the VCN following the last run, or -1 on error.
+ */
+static int64_t ntfs_map_runs(struct fs_info *fs, struct inode *inode,
+                             struct ntfs_attr_record *attr)
+{
+    struct ntfs_sb_info *sbi = NTFS_SB(fs);
+    struct runlist **rlist = &NTFS_PVT(inode)->data.non_resident.rlist;
+    struct mapping_chunk chunk;
+    struct extent e;
+    uint8_t *attr_len;
+    uint8_t *stream;
+    uint32_t offset;
+
+    attr_len = (uint8_t *)attr + attr->len;
+    stream = mapping_chunk_init(attr, &chunk, &offset);
+    chunk.vcn = attr->data.non_resident.lowest_vcn;
+
+    for (;;) {
+        if (parse_data_run(stream, &offset, attr_len, &chunk)) {
+            printf("parse_data_run()\n");
+            return -1;
+        }
+
+        if (chunk.flags & MAP_END)
+            break;
+
+        e.lstart = chunk.vcn << sbi->clust_shift;
+        e.len = chunk.len << sbi->clust_shift;
+        if (chunk.flags & MAP_ALLOCATED)
+            e.pstart = (sector_t)chunk.lcn << sbi->clust_shift;
+        else
+            e.pstart = EXTENT_ZERO;
+
+        /* Once the map is full, keep the rest in order in the runlist */
+        if (!runlist_is_empty(*rlist) || !extent_map_add(inode, &e)) {
+            struct runlist_element run = {
+                .vcn = chunk.vcn,
+                .lcn = (chunk.flags & MAP_ALLOCATED) ? chunk.lcn : RUN_SPARSE,
+                .len = chunk.len,
+            };
+            runlist_append(rlist, &run);
+        }
+
+        chunk.vcn += chunk.len;
+    }
+
+    return chunk.vcn;
+}
+
+/*
+ * The $DATA attribute of a large, fragmented file may be split over
+ * several attribute records in other MFT records, listed in the
+ * $ATTRIBUTE_LIST of the base record.  Map the runs of those which
+ * follow _vcn_, in order.
+ */
+static int ntfs_map_attr_list(struct fs_info *fs, struct inode *inode,
+                              struct ntfs_mft_record *base, int64_t vcn)
+{
+    struct ntfs_attr_record *attr, *list = NULL;
+    struct ntfs_attr_list_entry *entry;
+    struct ntfs_mft_record *mrec;
+    uint8_t *end;
+
+    attr = (struct ntfs_attr_record *)((uint8_t *)base + base->attrs_offset);
+    for (; attr->type != NTFS_AT_END;
+         attr = (struct ntfs_attr_record *)((uint8_t *)attr + attr->len)) {
+        if (attr->type == NTFS_AT_ATTR_LIST) {
+            list = attr;
+            break;
+        }
+    }
+
+    if (!list || list->non_resident) {
+        /* Huge attribute lists are not resident; we don't follow those */
+        dprintf("%s: no resident $ATTRIBUTE_LIST\n", __func__);
+        return -1;
+    }
+
+    entry = (struct ntfs_attr_list_entry *)
+        ((uint8_t *)list + list->data.resident.value_offset);
+    end = (uint8_t *)entry + list->data.resident.value_len;
+
+    for (; (uint8_t *)entry < end && entry->length;
+         entry = (struct ntfs_attr_list_entry *)((uint8_t *)entry +
+                                                 entry->length)) {
+        if (entry->type != NTFS_AT_DATA || entry->name_length ||
+            (int64_t)entry->lowest_vcn != vcn)
+            continue;
+
+        mrec = NTFS_SB(fs)->mft_record_lookup(fs, MFT_REF_NO(entry->mft_ref),
+                                              NULL);
+        if (!mrec) {
+            printf("No MFT record found!\n");
+            return -1;
+        }
+
+        attr = (struct ntfs_attr_record *)((uint8_t *)mrec + mrec->attrs_offset);
+        for (; attr->type != NTFS_AT_END;
+             attr = (struct ntfs_attr_record *)((uint8_t *)attr + attr->len)) {
+            if (attr->type == NTFS_AT_DATA && attr->non_resident &&
+                !attr->name_len &&
+                (int64_t)attr->data.non_resident.lowest_vcn == vcn)
+                break;
+        }
+
+        if (attr->type != NTFS_AT_END)
+            vcn = ntfs_map_runs(fs, inode, attr);
+        else
+            vcn = -1;
+
+        free(mrec);
+        if (vcn < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
 static int index_inode_setup(struct fs_info *fs, unsigned long mft_no,
                             struct inode *inode)
 {
@@ -625,11 +756,7 @@ static int index_inode_setup(struct fs_info *fs, unsigned long mft_no,
     struct ntfs_mft_record *mrec, *lmrec;
     struct ntfs_attr_record *attr;
     enum dirent_type d_type;
-    uint8_t *attr_len;
-    struct mapping_chunk chunk;
-    int err;
-    uint8_t *stream;
-    uint32_t offset;
+    int64_t vcn, total;
 
     dprintf("in %s()\n", __func__);
 
@@ -686,31 +813,20 @@ static int index_inode_setup(struct fs_info *fs, unsigned long mft_no,
                 (uint32_t)((uint8_t *)attr + attr->data.resident.value_offset);
             inode->size = attr->data.resident.value_len;
         } else {
-            attr_len = (uint8_t *)attr + attr->len;
-
-            stream = mapping_chunk_init(attr, &chunk, &offset);
             NTFS_PVT(inode)->data.non_resident.rlist = NULL;
-            for (;;) {
-                err = parse_data_run(stream, &offset, attr_len, &chunk);
-                if (err) {
-                    printf("parse_data_run()\n");
-                    goto out;
-                }
+            vcn = ntfs_map_runs(fs, inode, attr);
+            if (vcn < 0)
+                goto out;
 
-                if (chunk.flags & MAP_UNALLOCATED)
-                    continue;
-                if (chunk.flags & MAP_END)
-                    break;
-                if (chunk.flags &  MAP_ALLOCATED) {
-                    /* append new run to the runlist */
-                    runlist_append(&NTFS_PVT(inode)->data.non_resident.rlist,
-                                    (struct runlist_element *)&chunk);
-                    /* update for next VCN */
-                    chunk.vcn += chunk.len;
-                }
-            }
+            /* The rest of the runs are in other MFT records */
+            total = (attr->data.non_resident.allocated_size +
+                     NTFS_SB(fs)->clust_size - 1) >>
+                NTFS_SB(fs)->clust_byte_shift;
+            if (vcn < total && ntfs_map_attr_list(fs, inode, lmrec, vcn))
+                printf("Incomplete runlist\n");
 
-            if (runlist_is_empty(NTFS_PVT(inode)->data.non_resident.rlist)) {
+            if (!inode->extent_count &&
+                runlist_is_empty(NTFS_PVT(inode)->data.non_resident.rlist)) {
                 printf("No mapping found\n");
                 goto out;
             }
@@ -927,7 +1043,8 @@ static int ntfs_next_extent(struct inode *inode, uint32_t lstart)
     struct ntfs_sb_info *sbi = NTFS_SB(fs);
     sector_t pstart = 0;
     struct runlist *rlist;
-    struct runlist *ret;
+    uint64_t run_start, run_len;
+    uint32_t delta;
     const uint32_t sec_size = SECTOR_SIZE(fs);
     const uint32_t sec_shift = SECTOR_SHIFT(fs);
 
@@ -938,27 +1055,27 @@ static int ntfs_next_extent(struct inode *inode, uint32_t lstart)
                 sec_shift;
         inode->next_extent.len = (inode->size + sec_size - 1) >> sec_shift;
     } else {
-        rlist = NTFS_PVT(inode)->data.non_resident.rlist;
-
-        if (!lstart || lstart >= NTFS_PVT(inode)->here) {
-            if (runlist_is_empty(rlist))
-                goto out;   /* nothing to do ;-) */
-
-            ret = runlist_remove(&rlist);
-
-            NTFS_PVT(inode)->here =
-                ((ret->run.len << sbi->clust_byte_shift) >> sec_shift);
-
-            pstart = ret->run.lcn << sbi->clust_shift;
-            inode->next_extent.len =
-                ((ret->run.len << sbi->clust_byte_shift) + sec_size - 1) >>
-                sec_shift;
+        /*
+         * Everything up to the overflow runlist is in the extent map,
+         * which generic_getfssec() has already looked at.
+         */
+        for (rlist = NTFS_PVT(inode)->data.non_resident.rlist; rlist;
+             rlist = rlist->next) {
+            run_start = rlist->run.vcn << sbi->clust_shift;
+            run_len = rlist->run.len << sbi->clust_shift;
+            if (lstart >= run_start && lstart - run_start < run_len)
+                break;
+        }
 
-            NTFS_PVT(inode)->data.non_resident.rlist = rlist;
+        if (!rlist)
+            goto out;
 
-            free(ret);
-            ret = NULL;
-        }
+        delta = lstart - run_start;
+        inode->next_extent.len = run_len - delta;
+        if (rlist->run.lcn == RUN_SPARSE)
+            pstart = EXTENT_ZERO;
+        else
+            pstart = ((sector_t)rlist->run.lcn << sbi->clust_shift) + delta;
     }
 
     inode->next_extent.pstart = pstart;
@@ -1021,6 +1138,19 @@ out:
     return 0;
 }
 
+static void ntfs_close_file(struct file *file)
+{
+    struct inode *inode = file->inode;
+    struct runlist *rlist;
+
+    if (inode && inode->refcnt == 1 && NTFS_PVT(inode)->non_resident) {
+        while ((rlist = runlist_remove(&NTFS_PVT(inode)->data.non_resident.rlist)))
+            free(rlist);
+    }
+
+    generic_close_file(file);
+}
+
 static inline bool is_filename_printable(const char *s)
 {
     return s && (*s != '.' && *s != '$');
@@ -1378,7 +1508,7 @@ const struct fs_ops ntfs_fs_ops = {
     .fs_init        = ntfs_fs_init,
     .searchdir      = NULL,
     .getfssec       = ntfs_getfssec,
-    .close_file     = generic_close_file,
+    .close_file     = ntfs_close_file,
     .mangle_name    = generic_mangle_name,
     .load_config    = generic_load_config,
     .readdir        = ntfs_readdir,
@@ -5,6 +5,7 @@
 #include "pxe.h"
 
 char LocalDomain[256];
+uint16_t InterfaceMTU;
 
 int over_load;
 uint8_t uuid_type;
@@ -26,6 +27,13 @@ static void router(const void *data, int opt_len)
     IPInfo.gateway = *(const uint32_t *)data;
 }
 
+static void interface_mtu(const void *data, int opt_len)
+{
+    if (opt_len != 2)
+	return;
+    InterfaceMTU = ntohs(*(const uint16_t *)data);
+}
+
 static void dns_servers(const void *data, int opt_len)
 {
     const uint32_t *dp = data;
@@ -149,6 +157,7 @@ static const struct dhcp_options dhcp_opts[] = {
     {3,   router},
     {6,   dns_servers},
     {15,  local_domain},
+    {26,  interface_mtu},
     {43,  vendor_encaps},
     {52,  option_overload},
     {54,  server},
@@ -225,6 +234,7 @@ static void parse_dhcp_options(const void *option, int size, uint8_t opt_filter)
  * boot_file	- boot file name
  * DNSServers	- DNS server IPs
  * LocalDomain	- Local domain name
+ * InterfaceMTU	- Interface MTU
  * MAC_len, MAC	- Client identifier, if MAC_len == 0
  *
  * This assumes the DHCP packet is in "trackbuf".
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <core.h>
+#include <minmax.h>
 #include "pxe.h"
 
 /* DNS CLASS values we care about */
@@ -48,6 +49,26 @@ struct dnsrr {
 
 uint32_t dns_server[DNS_MAX_SERVERS] = {0, };
 
+/*
+ * A small cache of recent answers, keyed by the query name in wire
+ * format, so fetching several files from the same host only costs one
+ * lookup.  Entries live as long as the TTL of the answer says; names
+ * which did not resolve are remembered briefly as well.
+ */
+#define DNS_CACHE_SIZE	8
+#define DNS_CACHE_NAME	128		/* Longer names are not cached */
+#define DNS_MAX_TTL	86400		/* Seconds; keeps ms_timer() sane */
+#define DNS_NEG_TTL	10		/* Seconds to remember a failure */
+
+struct dns_cache {
+    uint32_t ip;			/* 0 = name did not resolve */
+    uint32_t expires;			/* ms_timer() value */
+    uint8_t  len;			/* Length of name; 0 = unused */
+    char     name[DNS_CACHE_NAME];
+};
+
+static struct dns_cache dns_cache[DNS_CACHE_SIZE];
+
 
 /*
  * Turn a string in _src_ into a DNS "label set" in _dst_; returns the
@@ -162,27 +183,60 @@ static char *dns_skiplabel(char *label)
     }
 }
 
+static inline bool dns_cache_valid(const struct dns_cache *dc)
+{
+    return dc->len && (int32_t)(dc->expires - ms_timer()) > 0;
+}
+
+/*
+ * Look up the label set _name_ of _len_ bytes in the cache.  On a miss
+ * returns NULL, and *_slot_ is set to the entry the answer should go
+ * in, if the name can be cached at all.
+ */
+static struct dns_cache *dns_cache_lookup(const char *name, int len,
+					  struct dns_cache **slot)
+{
+    struct dns_cache *dc, *victim = NULL;
+
+    *slot = NULL;
+    if (len > DNS_CACHE_NAME)
+	return NULL;
+
+    for (dc = dns_cache; dc < dns_cache + DNS_CACHE_SIZE; dc++) {
+	if (!dns_cache_valid(dc)) {
+	    dc->len = 0;
+	    victim = dc;
+	    continue;
+	}
+	if (dc->len == len && !memcmp(dc->name, name, len))
+	    return dc;
+	/* Otherwise evict whatever expires first */
+	if (!victim || (victim->len &&
+			(int32_t)(dc->expires - victim->expires) < 0))
+	    victim = dc;
+    }
+
+    *slot = victim;
+    return NULL;
+}
+
 /*
  * Actual resolver function
  * Points to a null-terminated or :-terminated string in _name_
  * and returns the ip addr in _ip_ if it exists and can be found.
  * If _ip_ = 0 on exit, the lookup failed. _name_ will be updated
- *
- * XXX: probably need some caching here.
  */
 uint32_t dns_resolv(const char *name)
 {
-    static char __lowmem DNSSendBuf[PKTBUF_SIZE];
-    static char __lowmem DNSRecvBuf[PKTBUF_SIZE];
+    struct pxe_rtt dns_rtt;
+    static char __lowmem DNSSendBuf[DNS_MAX_PACKET];
+    static char __lowmem DNSRecvBuf[DNS_MAX_PACKET];
     char *p;
     int err;
     int dots;
     int same;
     int rd_len;
     int ques, reps;    /* number of questions and replies */
-    uint8_t timeout;
-    const uint8_t *timeout_ptr = TimeoutTable;
-    uint32_t oldtime;
     uint32_t srv;
     uint32_t *srv_ptr;
     struct dnshdr *hd1 = (struct dnshdr *)DNSSendBuf;
@@ -193,14 +247,15 @@ uint32_t dns_resolv(const char *name)
     static __lowmem struct s_PXENV_UDP_READ  udp_read;
     uint16_t local_port;
     uint32_t result = 0;
+    uint32_t ttl = 0;		/* How long to cache the result; 0 = don't */
+    uint32_t min_ttl;
+    struct dns_cache *dc, *slot;
+    int qlen;
 
     /* Make sure we have at least one valid DNS server */
     if (!dns_server[0])
 	return 0;
 
-    /* Get a local port number */
-    local_port = get_port();
-
     /* First, fill the DNS header struct */
     hd1->id++;                      /* New query ID */
     hd1->flags   = htons(0x0100);   /* Recursion requested */
@@ -224,11 +279,26 @@ uint32_t dns_resolv(const char *name)
     query->qclass = htons(CLASS_IN);
     p += sizeof(struct dnsquery);
 
+    /* Do we know the answer already? */
+    qlen = (char *)query - (DNSSendBuf + sizeof(struct dnshdr));
+    dc = dns_cache_lookup(DNSSendBuf + sizeof(struct dnshdr), qlen, &slot);
+    if (dc)
+	return dc->ip;
+
+    /* Save the name now; a CNAME will overwrite it in the query */
+    if (slot) {
+	slot->len = 0;
+	memcpy(slot->name, DNSSendBuf + sizeof(struct dnshdr), qlen);
+    }
+
+    /* Get a local port number */
+    local_port = get_port();
+
     /* Now send it to name server */
-    timeout_ptr = TimeoutTable;
-    timeout = *timeout_ptr++;
     srv_ptr = dns_server;
-    while (timeout) {
+    rtt_init(&dns_rtt);
+    rtt_send(&dns_rtt);
+    for (;;) {
 	srv = *srv_ptr++;
 	if (!srv) {
 	    srv_ptr = dns_server;
@@ -246,24 +316,29 @@ uint32_t dns_resolv(const char *name)
         if (err || udp_write.status)
             continue;
 
-        oldtime = jiffies();
 	do {
-	    if (jiffies() - oldtime >= timeout)
+	    if (rtt_expired(&dns_rtt)) {
+		if (rtt_backoff(&dns_rtt))
+		    goto done;		/* Give up */
 		goto again;
+	    }
 
             udp_read.status      = 0;
             udp_read.src_ip      = srv;
             udp_read.dest_ip     = IPInfo.myip;
             udp_read.s_port      = DNS_PORT;
             udp_read.d_port      = local_port;
-            udp_read.buffer_size = PKTBUF_SIZE;
+            udp_read.buffer_size = DNS_MAX_PACKET;
             udp_read.buffer      = FAR_PTR(DNSRecvBuf);
             err = pxe_call(PXENV_UDP_READ, &udp_read);
 	} while (err || udp_read.status || hd2->id != hd1->id);
 
+	rtt_reply(&dns_rtt);
+
         if ((hd2->flags ^ 0x80) & htons(0xf80f))
             goto badness;
 
+        min_ttl = DNS_MAX_TTL;
         ques = htons(hd2->qdcount);   /* Questions */
         reps = htons(hd2->ancount);   /* Replies   */
         p = DNSRecvBuf + sizeof(struct dnshdr);
@@ -284,10 +359,13 @@ uint32_t dns_resolv(const char *name)
 		case TYPE_A:
 		    if (rd_len == 4) {
 			result = *(uint32_t *)rr->rdata;
+			ttl = min(min_ttl, ntohl(rr->ttl));
 			goto done;
 		    }
 		    break;
 		case TYPE_CNAME:
+		    /* The answer is only good as long as the alias */
+		    min_ttl = min(min_ttl, ntohl(rr->ttl));
 		    dns_copylabel(DNSSendBuf + sizeof(struct dnshdr),
 				  rr->rdata, DNSRecvBuf);
 		    /*
@@ -322,9 +400,12 @@ uint32_t dns_resolv(const char *name)
          ; (i.e. neither AA or RA set), then at least try a
          ; different setver...
         */
-        if (hd2->flags == htons(0x480))
+        if (hd2->flags == htons(0x480)) {
+	    rtt_send(&dns_rtt);
             continue;
+	}
 
+        ttl = DNS_NEG_TTL;
         break; /* failed */
 
     again:
@@ -333,6 +414,14 @@ uint32_t dns_resolv(const char *name)
 
 done:
     free_port(local_port);	/* Return port number to the free pool */
+    rtt_done(&dns_rtt, &pxe_net_stats.dns, NULL);
+
+    /* A server that never answered tells us nothing worth keeping */
+    if (slot && ttl) {
+	slot->ip      = result;
+	slot->expires = ms_timer() + ttl * 1000;
+	slot->len     = qlen;
+    }
 
     return result;
 }
@@ -21,7 +21,7 @@
 
 static int pxe_idle_poll(void)
 {
-    static __lowmem char junk_pkt[PKTBUF_SIZE];
+    static __lowmem char junk_pkt[2048];	/* Only polled, never read */
     static __lowmem t_PXENV_UDP_READ read_buf;
 
     memset(&read_buf, 0, sizeof read_buf);
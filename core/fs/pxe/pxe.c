@@ -5,6 +5,7 @@
 #include <fs.h>
 #include <minmax.h>
 #include <sys/cpu.h>
+#include <syslinux/pmapi.h>
 #include "pxe.h"
 
 #define GPXE 1
@@ -27,15 +28,11 @@ char dot_quad_buf[16];
 static bool has_gpxe;
 static uint32_t gpxe_funcs;
 bool have_uuid = false;
+static bool udp_unfiltered;	   /* UDP_READ ignores its port filter */
 
 /* Common receive buffer */
 static __lowmem char packet_buf[PKTBUF_SIZE] __aligned(16);
 
-const uint8_t TimeoutTable[] = {
-    2, 2, 3, 3, 4, 5, 6, 7, 9, 10, 12, 15, 18, 21, 26, 31, 37, 44,
-    53, 64, 77, 92, 110, 132, 159, 191, 229, 255, 255, 255, 255, 0
-};
-
 struct tftp_options {
     const char *str_ptr;        /* string pointer */
     size_t      offset;		/* offset into socket structre */
@@ -49,6 +46,7 @@ static const struct tftp_options tftp_options[] =
 {
     { "tsize",   IFIELD(size) },
     { "blksize", PFIELD(tftp_blksize) },
+    { "windowsize", PFIELD(tftp_windowsize) },
 };
 static const int tftp_nopts = sizeof tftp_options / sizeof tftp_options[0];
 
@@ -68,17 +66,62 @@ static struct inode *allocate_socket(struct fs_info *fs)
     } else {
 	struct pxe_pvt_inode *socket = PVT(inode);
 	socket->tftp_localport = get_port();
+	rtt_init(&socket->tftp_rtt);
 	inode->mode = DT_REG;	/* No other types relevant for PXE */
     }
 
     return inode;
 }
 
+/*
+ * The largest window whose buffer fits in TFTP_WINDOW_BYTES; several
+ * sockets may be open at once, and they all share the core heap.
+ */
+static uint16_t tftp_max_window(uint16_t blksize)
+{
+    uint16_t window = TFTP_WINDOW_BYTES / blksize;
+
+    return min(max(window, 1), TFTP_MAX_WINDOW);
+}
+
+/*
+ * Allocate the packet buffer once the window and block sizes are
+ * known: one slot of tftp_blksize for each packet in the window.
+ * If the heap is too tight for that, fall back to a window of one
+ * packet; the server will resend what we don't keep.
+ */
+static bool alloc_window(struct inode *inode)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+    uint16_t window = tftp_max_window(socket->tftp_blksize);
+
+    if (socket->tftp_windowsize < 1)
+	socket->tftp_windowsize = 1;
+    else if (socket->tftp_windowsize > window)
+	socket->tftp_windowsize = window;
+
+    socket->tftp_pktbuf = malloc(socket->tftp_windowsize *
+				 socket->tftp_blksize);
+    if (!socket->tftp_pktbuf && socket->tftp_windowsize > 1) {
+	socket->tftp_windowsize = 1;
+	socket->tftp_pktbuf = malloc(socket->tftp_blksize);
+    }
+    if (!socket->tftp_pktbuf) {
+	malloc_error("TFTP window buffer");
+	return false;
+    }
+
+    return true;
+}
+
 static void free_socket(struct inode *inode)
 {
     struct pxe_pvt_inode *socket = PVT(inode);
 
+    if (socket->tftp_localport != 0xffff)
+	rtt_done(&socket->tftp_rtt, &pxe_net_stats.tftp, &pxe_net_stats.last);
     free_port(socket->tftp_localport);
+    free(socket->tftp_pktbuf);
     free_inode(inode);
 }
 
@@ -421,16 +464,19 @@ static enum pxe_path_type pxe_path_type(const char *str)
  * @param: inode -> Inode pointer
  *
  */
-static void get_packet_gpxe(struct inode *inode)
+static uint32_t get_packet_gpxe(struct inode *inode, char *buf, uint32_t room)
 {
     struct pxe_pvt_inode *socket = PVT(inode);
     static __lowmem struct s_PXENV_FILE_READ file_read;
     int err;
 
+    if (!buf || room > PKTBUF_SIZE)
+	room = PKTBUF_SIZE;
+
     while (1) {
         file_read.FileHandle  = socket->tftp_remoteport;
         file_read.Buffer      = FAR_PTR(packet_buf);
-        file_read.BufferSize  = PKTBUF_SIZE;
+        file_read.BufferSize  = room;
         err = pxe_call(PXENV_FILE_READ, &file_read);
         if (!err)  /* successed */
             break;
@@ -439,22 +485,26 @@ static void get_packet_gpxe(struct inode *inode)
 	    kaboom();
     }
 
-    memcpy(socket->tftp_pktbuf, packet_buf, file_read.BufferSize);
-
-    socket->tftp_dataptr   = socket->tftp_pktbuf;
-    socket->tftp_bytesleft = file_read.BufferSize;
+    if (buf) {
+	memcpy(buf, packet_buf, file_read.BufferSize);
+    } else {
+	memcpy(socket->tftp_pktbuf, packet_buf, file_read.BufferSize);
+	socket->tftp_dataptr   = socket->tftp_pktbuf;
+	socket->tftp_bytesleft = file_read.BufferSize;
+    }
     socket->tftp_filepos  += file_read.BufferSize;
 
-    if (socket->tftp_bytesleft == 0)
+    if (file_read.BufferSize == 0)
         inode->size = socket->tftp_filepos;
 
     /* if we're done here, close the file */
     if (inode->size > socket->tftp_filepos)
-        return;
+        return file_read.BufferSize;
 
     /* Got EOF, close it */
     socket->tftp_goteof = 1;
     gpxe_close_file(inode);
+    return file_read.BufferSize;
 }
 #endif /* GPXE */
 
@@ -475,109 +525,224 @@ static void pxe_mangle_name(char *dst, const char *src)
 }
 
 /*
- * Get a fresh packet if the buffer is drained, and we haven't hit
- * EOF yet.  The buffer should be filled immediately after draining!
+ * Start receiving the next window: ACK the previous packet, which
+ * should cause the server to send it.
  */
-static void fill_buffer(struct inode *inode)
+static void start_window(struct inode *inode)
 {
-    int err;
-    int last_pkt;
-    const uint8_t *timeout_ptr;
-    uint8_t timeout;
-    uint16_t buffersize;
-    uint32_t oldtime;
-    void *data = NULL;
-    static __lowmem struct s_PXENV_UDP_READ udp_read;
     struct pxe_pvt_inode *socket = PVT(inode);
 
-    if (socket->tftp_bytesleft || socket->tftp_goteof)
-        return;
+    socket->tftp_winnext  = 0;
+    socket->tftp_wincount = 0;
+    socket->tftp_winrecv  = 0;
+    socket->tftp_nacked   = 0;
 
-#if GPXE
-    if (socket->tftp_localport == 0xffff) {
-        get_packet_gpxe(inode);
-        return;
-    }
-#endif
+    ack_packet(inode, socket->tftp_lastpkt);
+    rtt_send(&socket->tftp_rtt);
+}
 
-    /*
-     * Start by ACKing the previous packet; this should cause
-     * the next packet to be sent.
-     */
-    timeout_ptr = TimeoutTable;
-    timeout = *timeout_ptr++;
-    oldtime = jiffies();
+/*
+ * Has the current window ended?
+ */
+static inline bool window_done(struct inode *inode)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
 
- ack_again:
-    ack_packet(inode, socket->tftp_lastpkt);
+    return socket->tftp_goteof ||
+	socket->tftp_winrecv >= socket->tftp_windowsize;
+}
 
-    while (timeout) {
-        udp_read.buffer      = FAR_PTR(packet_buf);
-        udp_read.buffer_size = PKTBUF_SIZE;
-        udp_read.src_ip      = socket->tftp_remoteip;
-        udp_read.dest_ip     = IPInfo.myip;
-        udp_read.s_port      = socket->tftp_remoteport;
-        udp_read.d_port      = socket->tftp_localport;
-        err = pxe_call(PXENV_UDP_READ, &udp_read);
-        if (err) {
-	    uint32_t now = jiffies();
-
-	    if (now-oldtime >= timeout) {
-		oldtime = now;
-		timeout = *timeout_ptr++;
-		if (!timeout)
-		    break;
-	    }
-            continue;
-        }
+/*
+ * Nothing arrived: check the retransmission timer.  Returns true if
+ * the window should be ended with what we have.
+ */
+static bool window_idle(struct inode *inode)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
 
-        if (udp_read.buffer_size < 4)  /* Bad size for a DATA packet */
-            continue;
+    if (!rtt_expired(&socket->tftp_rtt))
+	return false;
 
-        data = packet_buf;
-        if (*(uint16_t *)data != TFTP_DATA)    /* Not a data packet */
-            continue;
+    /* Anything we already have is good enough */
+    if (socket->tftp_winrecv)
+	return true;
 
-        /* If goes here, recevie OK, break */
-        break;
+    if (rtt_backoff(&socket->tftp_rtt))
+	kaboom();		/* time runs out */
+    ack_packet(inode, socket->tftp_lastpkt);
+    return false;
+}
+
+/*
+ * Poll once for the next DATA packet of the current window.  Packets
+ * are only accepted in sequence; on a gap the last in-order packet is
+ * ACKed again so the server restarts the window from there (RFC 7440.)
+ *
+ * If *_buf_ is set and *_room_ can hold a whole block, the packet is
+ * copied straight there and both are advanced; otherwise it goes to
+ * the next slot of the window buffer.
+ *
+ * Returns -1 if nothing arrived, 0 if a packet was dropped, and 1 if
+ * the packet was accepted.
+ */
+static int tftp_recv(struct inode *inode, char **buf, uint32_t *room)
+{
+    int err;
+    uint16_t last_pkt, blk_num;
+    uint16_t buffersize;
+    char *slot;
+    static __lowmem struct s_PXENV_UDP_READ udp_read;
+    struct pxe_pvt_inode *socket = PVT(inode);
+
+    udp_read.buffer      = FAR_PTR(packet_buf);
+    udp_read.buffer_size = PKTBUF_SIZE;
+    udp_read.src_ip      = socket->tftp_remoteip;
+    udp_read.dest_ip     = IPInfo.myip;
+    udp_read.s_port      = socket->tftp_remoteport;
+    udp_read.d_port      = socket->tftp_localport;
+    err = pxe_call(PXENV_UDP_READ, &udp_read);
+    if (err)
+	return -1;
+
+    /*
+     * The addresses and ports we pass in are only a filter, and not
+     * every PXE stack applies it.  With several transfers open this
+     * may well be another socket's packet; it is lost to that socket,
+     * whose server will have to resend, so stop interleaving.
+     */
+    if (udp_read.d_port != socket->tftp_localport ||
+	udp_read.s_port != socket->tftp_remoteport ||
+	udp_read.src_ip != socket->tftp_remoteip) {
+	udp_unfiltered = true;
+	return 0;
     }
 
-    /* time runs out */
-    if (timeout == 0)
-	kaboom();
+    if (udp_read.buffer_size < 4)  /* Bad size for a DATA packet */
+	return 0;
 
-    last_pkt = socket->tftp_lastpkt;
-    last_pkt = ntohs(last_pkt);       /* Host byte order */
-    last_pkt++;
-    last_pkt = htons(last_pkt);       /* Network byte order */
-    if (*(uint16_t *)(data + 2) != last_pkt) {
-        /*
-         * Wrong packet, ACK the packet and try again.
-         * This is presumably because the ACK got lost,
-         * so the server just resent the previous packet.
-         */
+    if (*(uint16_t *)packet_buf != TFTP_DATA)    /* Not a data packet */
+	return 0;
+
+    if (udp_read.buffer_size - 4 > socket->tftp_blksize)
+	return 0;		/* Bigger than we negotiated */
+
+    blk_num  = *(uint16_t *)(packet_buf + 2);
+    last_pkt = htons(ntohs(socket->tftp_lastpkt) + 1);
+    if (blk_num != last_pkt) {
+	/*
+	 * Either a duplicate, presumably because an ACK got lost
+	 * and the server resent, or we lost a packet in the middle
+	 * of the window.  ACK the last good packet, once, so the
+	 * server starts over from there.
+	 */
 #if 0
 	printf("Wrong packet, wanted %04x, got %04x\n", \
-               htons(last_pkt), htons(*(uint16_t *)(data+2)));
+	       htons(last_pkt), htons(blk_num));
 #endif
-        goto ack_again;
+	socket->tftp_rtt.stats.duplicates++;
+	if (!socket->tftp_nacked) {
+	    ack_packet(inode, socket->tftp_lastpkt);
+	    socket->tftp_nacked = 1;
+	}
+	return 0;
     }
 
     /* It's the packet we want.  We're also EOF if the size < blocksize */
+    rtt_reply(&socket->tftp_rtt);
+    socket->tftp_nacked = 0;
     socket->tftp_lastpkt = last_pkt;    /* Update last packet number */
     buffersize = udp_read.buffer_size - 4;  /* Skip TFTP header */
-    memcpy(socket->tftp_pktbuf, packet_buf + 4, buffersize);
-    socket->tftp_dataptr = socket->tftp_pktbuf;
+    if (*buf && *room >= socket->tftp_blksize) {
+	memcpy(*buf, packet_buf + 4, buffersize);
+	*buf  += buffersize;
+	*room -= buffersize;
+    } else {
+	slot = socket->tftp_pktbuf +
+	    socket->tftp_wincount * socket->tftp_blksize;
+	memcpy(slot, packet_buf + 4, buffersize);
+	socket->tftp_winlen[socket->tftp_wincount++] = buffersize;
+    }
     socket->tftp_filepos += buffersize;
-    socket->tftp_bytesleft = buffersize;
+    socket->tftp_winrecv++;
+
     if (buffersize < socket->tftp_blksize) {
-        /* it's the last block, ACK packet immediately */
-        ack_packet(inode, *(uint16_t *)(data + 2));
+	/* it's the last block, ACK packet immediately */
+	ack_packet(inode, blk_num);
 
-        /* Make sure we know we are at end of file */
-        inode->size 		= socket->tftp_filepos;
-        socket->tftp_goteof	= 1;
+	/* Make sure we know we are at end of file */
+	inode->size 	    = socket->tftp_filepos;
+	socket->tftp_goteof = 1;
     }
+
+    return 1;
+}
+
+/*
+ * Receive the next window of DATA packets.  The window ends when it
+ * is full, on the final (short) packet, or when the timer runs out
+ * with at least one packet in hand.
+ *
+ * If _buf_ is set, packets are copied straight from the receive buffer
+ * to it for as long as _room_ can hold a whole block, and only the
+ * rest of the window goes to the window buffer.  Returns the number of
+ * bytes stored at _buf_.
+ */
+static uint32_t get_window(struct inode *inode, char *buf, uint32_t room)
+{
+    char *start = buf;
+
+    start_window(inode);
+
+    while (!window_done(inode)) {
+	if (tftp_recv(inode, &buf, &room) < 0 && window_idle(inode))
+	    break;
+    }
+
+    return buf - start;
+}
+
+/*
+ * Hand out the next slot of the window buffer.
+ */
+static void next_slot(struct inode *inode)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+    int slot;
+
+    slot = socket->tftp_winnext++;
+    socket->tftp_wincount--;
+    socket->tftp_dataptr   = socket->tftp_pktbuf + slot * socket->tftp_blksize;
+    socket->tftp_bytesleft = socket->tftp_winlen[slot];
+}
+
+/*
+ * Get a fresh packet if the buffer is drained, and we haven't hit
+ * EOF yet.  The buffer should be filled immediately after draining!
+ * Packets still queued in the window buffer are handed out first; the
+ * next window is only requested once all of them have been consumed.
+ */
+static void fill_buffer(struct inode *inode)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+
+    if (socket->tftp_bytesleft)
+        return;
+
+    if (!socket->tftp_wincount) {
+	if (socket->tftp_goteof)
+	    return;
+
+#if GPXE
+	if (socket->tftp_localport == 0xffff) {
+	    get_packet_gpxe(inode, NULL, 0);
+	    return;
+	}
+#endif
+
+	get_window(inode, NULL, 0);
+    }
+
+    next_slot(inode);
 }
 
 
@@ -604,6 +769,25 @@ static uint32_t pxe_getfssec(struct file *file, char *buf,
 
     count <<= TFTP_BLOCKSIZE_LG2;
     while (count) {
+	if (!socket->tftp_bytesleft && !socket->tftp_wincount &&
+	    !socket->tftp_goteof && count >= socket->tftp_blksize) {
+	    /*
+	     * Nothing buffered and the caller wants at least a whole
+	     * block: receive straight into the caller's buffer.
+	     */
+#if GPXE
+	    if (socket->tftp_localport == 0xffff)
+		chunk = get_packet_gpxe(inode, buf, count);
+	    else
+#endif
+		chunk = get_window(inode, buf, count);
+	    buf += chunk;
+	    bytes_read += chunk;
+	    count -= chunk;
+	    if (chunk)
+		continue;
+	}
+
         fill_buffer(inode); /* If we have no 'fresh' buffer, get it */
         if (!socket->tftp_bytesleft)
             break;
@@ -620,8 +804,14 @@ static uint32_t pxe_getfssec(struct file *file, char *buf,
     }
 
 
-    if (socket->tftp_bytesleft || (socket->tftp_filepos < inode->size)) {
-	fill_buffer(inode);
+    if (socket->tftp_bytesleft || socket->tftp_wincount ||
+	(socket->tftp_filepos < inode->size)) {
+	/*
+	 * Don't pull in the next window if nothing is buffered; leave
+	 * it for the next call so it can go straight to the caller.
+	 */
+	if (socket->tftp_wincount)
+	    fill_buffer(inode);
         *have_more = 1;
     } else if (socket->tftp_goteof) {
         /*
@@ -634,6 +824,114 @@ static uint32_t pxe_getfssec(struct file *file, char *buf,
     return bytes_read;
 }
 
+/*
+ * Copy out whatever is already buffered, without touching the network.
+ */
+static uint32_t tftp_drain(struct inode *inode, char *buf, uint32_t room)
+{
+    struct pxe_pvt_inode *socket = PVT(inode);
+    uint32_t chunk, bytes = 0;
+
+    while (room) {
+	if (!socket->tftp_bytesleft) {
+	    if (!socket->tftp_wincount)
+		break;
+	    next_slot(inode);
+	}
+
+	chunk = min(room, socket->tftp_bytesleft);
+	memcpy(buf, socket->tftp_dataptr, chunk);
+	socket->tftp_dataptr   += chunk;
+	socket->tftp_bytesleft -= chunk;
+	buf   += chunk;
+	room  -= chunk;
+	bytes += chunk;
+    }
+
+    return bytes;
+}
+
+/*
+ * Read several files at once, e.g. a kernel and its initrds.  Rather
+ * than waiting for each transfer in turn, all the sockets are polled
+ * round robin and each is ACKed as soon as its window is complete, so
+ * the servers keep sending while we are busy with the other files and
+ * the round trips overlap.
+ *
+ * That relies on PXENV_UDP_READ handing each socket only its own
+ * packets.  Once the stack is seen not to, the files are read one at
+ * a time instead.
+ *
+ * Each file is read until its buffer is full or it hits EOF; whatever
+ * is left is up to the caller.
+ */
+static void pxe_read_files(struct com32_readfile *rf, int count)
+{
+    enum { PF_IDLE, PF_WINDOW, PF_DONE } state[MAX_OPEN];
+    struct inode *inode;
+    struct pxe_pvt_inode *socket;
+    char *buf;
+    uint32_t room;
+    int i, active = 0;
+
+    if (count > MAX_OPEN)
+	count = MAX_OPEN;
+
+    for (i = 0; i < count; i++) {
+	state[i] = PF_DONE;
+	if (!rf[i].handle)
+	    continue;
+
+	socket = PVT(handle_to_file(rf[i].handle)->inode);
+	if (socket->tftp_localport == 0 || socket->tftp_localport == 0xffff)
+	    continue;		/* Not a TFTP transfer */
+
+	state[i] = PF_IDLE;
+	active++;
+    }
+
+    while (active) {
+	for (i = 0; i < count; i++) {
+	    if (state[i] == PF_DONE)
+		continue;
+
+	    inode  = handle_to_file(rf[i].handle)->inode;
+	    socket = PVT(inode);
+	    buf    = (char *)rf[i].buf + rf[i].bytes;
+	    room   = rf[i].size - rf[i].bytes;
+
+	    if (state[i] == PF_IDLE) {
+		/* Between windows: empty the window buffer and go on */
+		rf[i].bytes += tftp_drain(inode, buf, room);
+		buf  = (char *)rf[i].buf + rf[i].bytes;
+		room = rf[i].size - rf[i].bytes;
+
+		if (!room || socket->tftp_goteof ||
+		    socket->tftp_bytesleft || socket->tftp_wincount) {
+		    state[i] = PF_DONE;
+		    active--;
+		    continue;
+		}
+
+		start_window(inode);
+		state[i] = PF_WINDOW;
+	    }
+
+	    if (tftp_recv(inode, &buf, &room) < 0) {
+		if (window_idle(inode))
+		    state[i] = PF_IDLE;
+	    } else {
+		rf[i].bytes = buf - (char *)rf[i].buf;
+		if (window_done(inode))
+		    state[i] = PF_IDLE;
+	    }
+
+	    if (udp_unfiltered)
+		break;		/* Only the first file left in flight */
+	}
+    }
+}
+
 /**
  * Open a TFTP connection to the server
  *
@@ -645,6 +943,52 @@ static uint32_t pxe_getfssec(struct file *file, char *buf,
  */
 static void __pxe_searchdir(const char *filename, struct file *file);
 extern uint16_t PXERetry;
+extern uint16_t PXEBlksize;
+
+/*
+ * The block size to ask the server for: the PXEBLKSIZE directive if
+ * set, otherwise whatever fits in the interface MTU from DHCP, and
+ * otherwise the traditional 1408.  The MTU, if known, is always an
+ * upper bound, since PXE stacks are not good at reassembling fragments.
+ */
+static uint16_t tftp_want_blksize(void)
+{
+    /* IP header + UDP header + TFTP header */
+    const uint16_t overhead = 20 + 8 + 4;
+    uint32_t blksize, mtu_max = TFTP_MAX_BLKSIZE;
+
+    if (InterfaceMTU)
+	mtu_max = max(InterfaceMTU - overhead, TFTP_BLOCKSIZE);
+
+    if (PXEBlksize)
+	blksize = PXEBlksize;
+    else if (InterfaceMTU)
+	blksize = mtu_max;
+    else
+	blksize = TFTP_LARGE_BLKSIZE;
+
+    blksize = min(blksize, mtu_max);
+    blksize = min(blksize, TFTP_MAX_BLKSIZE);
+    return max(blksize, TFTP_BLOCKSIZE);
+}
+
+/*
+ * Append the TFTP mode and options to a RRQ packet
+ */
+static char *rrq_options(char *buf, uint16_t blksize)
+{
+    static const char rrq_head[] = "octet\0""tsize\0""0\0""blksize";
+    static const char rrq_tail[] = "windowsize";
+
+    memcpy(buf, rrq_head, sizeof rrq_head);
+    buf += sizeof rrq_head;
+    buf += sprintf(buf, "%u", blksize) + 1;
+    memcpy(buf, rrq_tail, sizeof rrq_tail);
+    buf += sizeof rrq_tail;
+    buf += sprintf(buf, "%u",
+		   min(tftp_max_window(blksize), TFTP_WANT_WINDOW)) + 1;
+    return buf;
+}
 
 static void pxe_searchdir(const char *filename, struct file *file)
 {
@@ -667,19 +1011,17 @@ static void __pxe_searchdir(const char *filename, struct file *file)
     char *p;
     char *options;
     char *data;
+    char *rrq_opts;
+    uint16_t blksize;
     static __lowmem struct s_PXENV_UDP_WRITE udp_write;
     static __lowmem struct s_PXENV_UDP_READ  udp_read;
     static __lowmem struct s_PXENV_FILE_OPEN file_open;
-    static const char rrq_tail[] = "octet\0""tsize\0""0\0""blksize\0""1408";
-    static __lowmem char rrq_packet_buf[2+2*FILENAME_MAX+sizeof rrq_tail];
+    static __lowmem char rrq_packet_buf[2+2*FILENAME_MAX+64];
     const struct tftp_options *tftp_opt;
     int i = 0;
     int err;
     int buffersize;
     int rrq_len;
-    const uint8_t  *timeout_ptr;
-    uint32_t timeout;
-    uint32_t oldtime;
     uint16_t tid;
     uint16_t opcode;
     uint16_t blk_num;
@@ -755,8 +1097,9 @@ static void __pxe_searchdir(const char *filename, struct file *file)
     }
 
     buf++;			/* Point *past* the final NULL */
-    memcpy(buf, rrq_tail, sizeof rrq_tail);
-    buf += sizeof rrq_tail;
+    rrq_opts = buf;
+    blksize = tftp_want_blksize();
+    buf = rrq_options(buf, blksize);
 
     rrq_len = buf - rrq_packet_buf;
 
@@ -777,6 +1120,8 @@ static void __pxe_searchdir(const char *filename, struct file *file)
 	    socket->tftp_localport = -1;
 	    socket->tftp_remoteport = file_open.FileHandle;
 	    inode->size = -1;
+	    socket->tftp_blksize = PKTBUF_SIZE;
+	    socket->tftp_windowsize = 1;
 	    goto done;
 	} else {
 	    static bool already = false;
@@ -792,14 +1137,9 @@ static void __pxe_searchdir(const char *filename, struct file *file)
     if (!ip)
 	    goto done;		/* No server */
 
-    timeout_ptr = TimeoutTable;   /* Reset timeout */
-    
-sendreq:
-    timeout = *timeout_ptr++;
-    if (!timeout)
-	return;			/* No file available... */
-    oldtime = jiffies();
+    rtt_send(&socket->tftp_rtt);
 
+sendreq:
     socket->tftp_remoteip = ip;
     tid = socket->tftp_localport;   /* TID(local port No) */
     udp_write.buffer    = FAR_PTR(rrq_packet_buf);
@@ -822,9 +1162,13 @@ wait_pkt:
         udp_read.d_port      = tid;
         err = pxe_call(PXENV_UDP_READ, &udp_read);
         if (err || udp_read.status) {
-	    uint32_t now = jiffies();
-	    if (now - oldtime >= timeout)
+	    if (rtt_expired(&socket->tftp_rtt)) {
+		if (rtt_backoff(&socket->tftp_rtt)) {
+		    inode->size = 0;
+		    goto done;		/* No file available... */
+		}
 		goto sendreq;
+	    }
         } else {
 	    /* Make sure the packet actually came from the server */
 	    if (udp_read.src_ip == socket->tftp_remoteip)
@@ -832,12 +1176,15 @@ wait_pkt:
 	}
     }
 
+    rtt_reply(&socket->tftp_rtt);
+
     socket->tftp_remoteport = udp_read.s_port;
 
     /* filesize <- -1 == unknown */
     inode->size = -1;
-    /* Default blksize unless blksize option negotiated */
+    /* Default blksize and window unless the options are negotiated */
     socket->tftp_blksize = TFTP_BLOCKSIZE;
+    socket->tftp_windowsize = 1;
     buffersize = udp_read.buffer_size - 2;  /* bytes after opcode */
     if (buffersize < 0)
         goto wait_pkt;                     /* Garbled reply */
@@ -848,6 +1195,18 @@ wait_pkt:
     opcode = *(uint16_t *)packet_buf;
     switch (opcode) {
     case TFTP_ERROR:
+	if (buffersize >= 2 &&
+	    *(uint16_t *)(packet_buf + 2) == TFTP_EOPTNEG &&
+	    blksize != TFTP_LARGE_BLKSIZE) {
+	    /*
+	     * The server didn't like our options; most likely the
+	     * block size.  Try once more with the conservative one.
+	     */
+	    blksize = TFTP_LARGE_BLKSIZE;
+	    rrq_len = rrq_options(rrq_opts, blksize) - rrq_packet_buf;
+	    rtt_send(&socket->tftp_rtt);
+	    goto sendreq;
+	}
         inode->size = 0;
         break;			/* ERROR reply; don't try again */
 
@@ -884,6 +1243,8 @@ wait_pkt:
             ack_packet(inode, blk_num);
         }
 
+        if (!alloc_window(inode))
+            goto done;
         socket->tftp_bytesleft = buffersize;
         socket->tftp_dataptr = socket->tftp_pktbuf;
         memcpy(socket->tftp_pktbuf, data, buffersize);
@@ -958,6 +1319,13 @@ wait_pkt:
             }
 	    *opdata_ptr = opdata;
 	}
+
+	/*
+	 * The server may pick a smaller block size than we asked
+	 * for, but never a larger one (RFC 2348.)
+	 */
+	if (socket->tftp_blksize < 8 || socket->tftp_blksize > blksize)
+	    goto err_reply;
 	break;
 
     default:
@@ -966,7 +1334,7 @@ wait_pkt:
     }
 
 done:
-    if (!inode->size) {
+    if (!inode->size || (!socket->tftp_pktbuf && !alloc_window(inode))) {
         free_socket(inode);
 	return;
     }
@@ -1750,4 +2118,5 @@ const struct fs_ops pxe_fs_ops = {
     .close_file    = pxe_close_file,
     .mangle_name   = pxe_mangle_name,
     .load_config   = pxe_load_config,
+    .read_files    = pxe_read_files,
 };
@@ -21,6 +21,7 @@
 #define PXE_H
 
 #include <syslinux/pxe_api.h>
+#include <syslinux/pxe_stats.h>
 #include "fs.h"			/* For MAX_OPEN, should go away */
 
 /*
@@ -29,7 +30,12 @@
 #define TFTP_PORT        htons(69)              /* Default TFTP port */
 #define TFTP_BLOCKSIZE_LG2 9
 #define TFTP_BLOCKSIZE  (1 << TFTP_BLOCKSIZE_LG2)
-#define PKTBUF_SIZE     2048			/*  */
+#define TFTP_LARGE_BLKSIZE 1408			/* Fits a 1500-byte MTU */
+#define TFTP_MAX_BLKSIZE 8192			/* Largest blksize we ask for */
+#define PKTBUF_SIZE     (TFTP_MAX_BLKSIZE + 16)	/* Largest TFTP packet */
+#define TFTP_MAX_WINDOW 16			/* Largest window we accept */
+#define TFTP_WANT_WINDOW 8			/* Window we ask for */
+#define TFTP_WINDOW_BYTES 32768		/* Window buffer per socket */
 
 #define is_digit(c)     (((c) >= '0') && ((c) <= '9'))
 
@@ -149,6 +155,19 @@ struct bootp_t {
     uint8_t  options[1260]; /* Vendor options */
 } __attribute__ ((packed));
 
+/*
+ * Retransmission timer state, see rtt.c
+ */
+struct pxe_rtt {
+    uint32_t srtt;		/* Smoothed RTT, ms * 8 (0 = no samples) */
+    uint32_t rttvar;		/* RTT variation, ms * 4 */
+    uint32_t rto;		/* Retransmit timeout, ms */
+    uint32_t sent;		/* ms_timer() when last sent */
+    uint16_t retries;		/* Timeouts of the current request */
+    bool     timing;		/* Request not retransmitted, can sample */
+    struct pxe_xfer_stats stats;
+};
+
 /*
  * Our inode private information -- this includes the packet buffer!
  */
@@ -158,13 +177,20 @@ struct pxe_pvt_inode {
     uint32_t tftp_remoteip;    /* Remote IP address */
     uint32_t tftp_filepos;     /* bytes downloaded (includeing buffer) */
     uint32_t tftp_blksize;     /* Block size for this connection(*) */
+    uint32_t tftp_windowsize;  /* Window size for this connection(*) */
     uint16_t tftp_bytesleft;   /* Unclaimed data bytes */
     uint16_t tftp_lastpkt;     /* Sequence number of last packet (NBO) */
     char    *tftp_dataptr;     /* Pointer to available data */
     uint8_t  tftp_goteof;      /* 1 if the EOF packet received */
+    uint8_t  tftp_wincount;    /* Received packets not yet handed out */
+    uint8_t  tftp_winnext;     /* Next window slot to hand out */
+    uint8_t  tftp_winrecv;     /* Packets received in this window */
+    uint8_t  tftp_nacked;      /* Last good packet ACKed again */
     uint8_t  tftp_unused[3];   /* Currently unused */
-    char     tftp_pktbuf[PKTBUF_SIZE];
-} __attribute__ ((packed));
+    uint16_t tftp_winlen[TFTP_MAX_WINDOW]; /* Data bytes in each slot */
+    char    *tftp_pktbuf;      /* tftp_windowsize slots of tftp_blksize */
+    struct pxe_rtt tftp_rtt;   /* Retransmission timer */
+};
 
 #define PVT(i) ((struct pxe_pvt_inode *)((i)->pvt))
 
@@ -191,6 +217,7 @@ extern uint8_t MAC_type;
 
 extern uint8_t  DHCPMagic;
 extern uint32_t RebootTime;
+extern uint16_t InterfaceMTU;
 
 extern char boot_file[];
 extern char path_prefix[];
@@ -212,7 +239,7 @@ extern uint8_t uuid_type;
 extern uint8_t uuid[];
 
 extern uint16_t BIOS_fbm;
-extern const uint8_t TimeoutTable[];
+extern struct pxe_net_stats pxe_net_stats;
 
 /*
  * Compute the suitable gateway for a specific route -- too many
@@ -241,6 +268,15 @@ void parse_dhcp(int);
 int dns_mangle(char **, const char *);
 uint32_t dns_resolv(const char *);
 
+/* rtt.c */
+void rtt_init(struct pxe_rtt *);
+void rtt_send(struct pxe_rtt *);
+bool rtt_expired(const struct pxe_rtt *);
+int rtt_backoff(struct pxe_rtt *);
+void rtt_reply(struct pxe_rtt *);
+void rtt_done(struct pxe_rtt *, struct pxe_xfer_stats *,
+	      struct pxe_xfer_stats *);
+
 /* idle.c */
 void pxe_idle_init(void);
 void pxe_idle_cleanup(void);
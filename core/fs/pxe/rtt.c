@@ -0,0 +1,159 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2026 The Syslinux Authors - All Rights Reserved
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version; incorporated herein by reference.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * rtt.c
+ *
+ * Adaptive retransmission timer for TFTP and DNS, in the style of
+ * RFC 6298: keep a smoothed round trip time and its variation, and
+ * time out after SRTT + 4*RTTVAR, doubling on every timeout.  Only
+ * replies to requests that were not retransmitted are used as RTT
+ * samples (Karn's algorithm.)
+ *
+ * The only clock we have is the BIOS timer, which ticks every ~55 ms,
+ * so that is the granularity of both the samples and the timeout.
+ */
+
+#include <string.h>
+#include <core.h>
+#include <minmax.h>
+#include "pxe.h"
+
+#define RTT_TICK	55		/* Clock granularity, ms */
+#define RTO_INIT	(2*RTT_TICK)	/* Before we have any samples */
+#define RTO_MIN		(2*RTT_TICK)
+#define RTO_MAX		14000
+#define RTT_MAX_RETRIES	16		/* Roughly as long as we used to wait */
+
+struct pxe_net_stats pxe_net_stats;
+
+/* The latest estimate, used to seed new transfers */
+static struct pxe_rtt rtt_last = {
+    .rto = RTO_INIT,
+};
+
+void rtt_init(struct pxe_rtt *rtt)
+{
+    memset(rtt, 0, sizeof *rtt);
+    rtt->srtt   = rtt_last.srtt;
+    rtt->rttvar = rtt_last.rttvar;
+    rtt->rto    = rtt_last.rto;
+}
+
+/*
+ * A new request has been sent
+ */
+void rtt_send(struct pxe_rtt *rtt)
+{
+    rtt->sent    = ms_timer();
+    rtt->timing  = true;
+    rtt->retries = 0;
+}
+
+/*
+ * Has the current request timed out?
+ */
+bool rtt_expired(const struct pxe_rtt *rtt)
+{
+    return ms_timer() - rtt->sent >= rtt->rto;
+}
+
+/*
+ * The current request timed out and is about to be sent again.
+ * Returns -1 if the caller should give up instead.
+ */
+int rtt_backoff(struct pxe_rtt *rtt)
+{
+    if (++rtt->retries > RTT_MAX_RETRIES)
+	return -1;
+
+    rtt->rto    = min(rtt->rto << 1, RTO_MAX);
+    rtt->sent   = ms_timer();
+    rtt->timing = false;
+    rtt->stats.retransmits++;
+    return 0;
+}
+
+/*
+ * A good reply arrived.  If it answers a request we only sent once,
+ * it is an RTT sample.
+ */
+void rtt_reply(struct pxe_rtt *rtt)
+{
+    uint32_t r, delta;
+
+    rtt->stats.packets++;
+    rtt->retries = 0;
+
+    if (!rtt->timing)
+	return;
+    rtt->timing = false;
+
+    r = ms_timer() - rtt->sent;
+    rtt->stats.rtt_samples++;
+    rtt->stats.rtt_total += r;
+
+    /* srtt is kept scaled by 8, rttvar by 4 */
+    if (!rtt->srtt) {
+	rtt->srtt   = (r << 3) + 1;	/* Never 0 once we have a sample */
+	rtt->rttvar = r << 1;
+    } else {
+	delta = (rtt->srtt >> 3) > r ? (rtt->srtt >> 3) - r
+				     : r - (rtt->srtt >> 3);
+	rtt->rttvar += delta - (rtt->rttvar >> 2);
+	rtt->srtt   += r - (rtt->srtt >> 3);
+    }
+
+    rtt->rto = (rtt->srtt >> 3) + max(RTT_TICK, rtt->rttvar);
+    rtt->rto = min(max(rtt->rto, RTO_MIN), RTO_MAX);
+
+    rtt_last.srtt   = rtt->srtt;
+    rtt_last.rttvar = rtt->rttvar;
+    rtt_last.rto    = rtt->rto;
+}
+
+/*
+ * Fold the statistics of a finished transfer into _total_, and
+ * optionally keep a copy of them in _last_.
+ */
+void rtt_done(struct pxe_rtt *rtt, struct pxe_xfer_stats *total,
+	      struct pxe_xfer_stats *last)
+{
+    rtt->stats.srtt = rtt->srtt >> 3;
+    rtt->stats.rto  = rtt->rto;
+
+    if (last)
+	*last = rtt->stats;
+
+    total->packets     += rtt->stats.packets;
+    total->retransmits += rtt->stats.retransmits;
+    total->duplicates  += rtt->stats.duplicates;
+    total->rtt_samples += rtt->stats.rtt_samples;
+    total->rtt_total   += rtt->stats.rtt_total;
+    total->srtt         = rtt->stats.srtt;
+    total->rto          = rtt->stats.rto;
+
+    memset(&rtt->stats, 0, sizeof rtt->stats);
+}
+
+/*
+ * INT 22h AX=0025h: copy the statistics to ES:BX, at most CX bytes;
+ * returns the full size of the structure in CX.
+ */
+void pxe_get_netstats(com32sys_t *regs)
+{
+    void *buf = MK_PTR(regs->es, regs->ebx.w[0]);
+    size_t len = min(regs->ecx.w[0], sizeof pxe_net_stats);
+
+    memcpy(buf, &pxe_net_stats, len);
+    regs->ecx.w[0] = sizeof pxe_net_stats;
+}
@@ -6,11 +6,15 @@
 #include "disk.h"
 #include "fs.h"
 
+/* Maximum number of blocks get_cache() reads ahead on a miss */
+#define CACHE_RA_MAX	16
+
 /* The cache structure */
 struct cache {
     block_t block;
     struct cache *prev;
     struct cache *next;
+    struct cache *hnext;	/* Next descriptor in the same hash bucket */
     void *data;
 };
 
@@ -19,5 +23,6 @@ void cache_init(struct device *, int);
 const void *get_cache(struct device *, block_t);
 struct cache *_get_cache_block(struct device *, block_t);
 void cache_lock_block(struct cache *);
+void cache_set_limit(struct device *, block_t);
 
 #endif /* cache.h */
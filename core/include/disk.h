@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <syslinux/disk_stats.h>
 
 typedef uint64_t sector_t;
 typedef uint64_t block_t;
@@ -20,11 +21,14 @@ struct disk {
     
     unsigned int h, s;		/* CHS geometry */
     unsigned int secpercyl;	/* h*s */
-    unsigned int _pad;
+    int edd_flat;		/* EDD 3.0 64-bit buffers: 1 yes, 0 untried, -1 no */
 
     sector_t part_start;   /* the start address of this partition(in sectors) */
+    sector_t sectors;	   /* size of the whole media in sectors, 0 if unknown */
 
     int (*rdwr_sectors)(struct disk *, void *, sector_t, size_t, bool);
+
+    struct disk_io_stats stats;
 };
 
 extern void read_sectors(char *, sector_t, int);
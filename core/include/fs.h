@@ -43,6 +43,7 @@ extern struct fs_info *this_fs;
 
 struct dirent;                  /* Directory entry structure */
 struct file;
+struct com32_readfile;
 enum fs_flags {
     FS_NODEV   = 1 << 0,
     FS_USEMEM  = 1 << 1,        /* If we need a malloc routine, set it */
@@ -71,6 +72,9 @@ struct fs_ops {
     int	     (*readdir)(struct file *, struct dirent *);
 
     int      (*next_extent)(struct inode *, uint32_t);
+
+    /* optional: read several open files in one go */
+    void     (*read_files)(struct com32_readfile *, int);
 };
 
 /*
@@ -107,6 +111,9 @@ struct inode {
     uint32_t     flags;
     uint32_t     file_acl;
     struct extent this_extent, next_extent;
+    struct extent *extent_map;	/* Extents seen so far, sorted by lstart */
+    uint16_t     extent_count;
+    uint16_t     extent_alloc;
     char         pvt[0]; /* Private filesystem data */
 };
 
@@ -129,9 +136,19 @@ struct device {
     /* the cache stuff */
     char *cache_data;
     struct cache *cache_head;
+    struct cache **cache_hash;
     uint16_t cache_block_size;
     uint16_t cache_entries;
     uint32_t cache_size;
+    uint32_t cache_hash_mask;
+
+    /* read-ahead state, see get_cache() */
+    block_t cache_ra_next;	/* Block following the last miss run */
+    uint16_t cache_ra_window;	/* Current read-ahead window, in blocks */
+    uint16_t cache_ra_max;	/* Upper bound, 1 disables read-ahead */
+    block_t cache_ra_limit;	/* Never read ahead at or past this block */
+
+    struct disk_cache_stats cache_stats;
 };
 
 /*
@@ -148,6 +165,7 @@ static inline bool not_whitespace(char c)
 struct inode *alloc_inode(struct fs_info *fs, uint32_t ino, size_t data);
 static inline void free_inode(struct inode * inode)
 {
+    free(inode->extent_map);
     free(inode);
 }
 
@@ -185,6 +203,7 @@ void mangle_name(char *, const char *);
 int searchdir(const char *name);
 void _close_file(struct file *);
 size_t pmapi_read_file(uint16_t *handle, void *buf, size_t sectors);
+int pmapi_read_files(struct com32_readfile *rf, int count);
 int open_file(const char *name, struct com32_filedata *filedata);
 void pm_open_file(com32sys_t *);
 void close_file(uint16_t handle);
@@ -220,6 +239,7 @@ void generic_close_file(struct file *file);
 /* getfssec.c */
 uint32_t generic_getfssec(struct file *file, char *buf,
 			  int sectors, bool *have_more);
+bool extent_map_add(struct inode *inode, const struct extent *e);
 
 /* nonextextent.c */
 int no_next_extent(struct inode *, uint32_t);
@@ -12,14 +12,13 @@ static struct free_arena_header *
 __free_block(struct free_arena_header *ah)
 {
     struct free_arena_header *pah, *nah;
-    struct free_arena_header *head =
-	&__malloc_head[ARENA_HEAP_GET(ah->a.attrs)];
 
     pah = ah->a.prev;
     nah = ah->a.next;
     if ( ARENA_TYPE_GET(pah->a.attrs) == ARENA_TYPE_FREE &&
            (char *)pah+ARENA_SIZE_GET(pah->a.attrs) == (char *)ah ) {
         /* Coalesce into the previous block */
+        __malloc_bin_remove(pah);
         ARENA_SIZE_SET(pah->a.attrs, ARENA_SIZE_GET(pah->a.attrs) +
 		ARENA_SIZE_GET(ah->a.attrs));
         pah->a.next = nah;
@@ -32,14 +31,8 @@ __free_block(struct free_arena_header *ah)
         ah = pah;
         pah = ah->a.prev;
     } else {
-        /* Need to add this block to the free chain */
         ARENA_TYPE_SET(ah->a.attrs, ARENA_TYPE_FREE);
         ah->a.tag = MALLOC_FREE;
-
-        ah->next_free = head->next_free;
-        ah->prev_free = head;
-        head->next_free = ah;
-        ah->next_free->prev_free = ah;
     }
 
     /* In either of the previous cases, we might be able to merge
@@ -50,8 +43,7 @@ __free_block(struct free_arena_header *ah)
 		ARENA_SIZE_GET(nah->a.attrs));
 
         /* Remove the old block from the chains */
-        nah->next_free->prev_free = nah->prev_free;
-        nah->prev_free->next_free = nah->next_free;
+        __malloc_bin_remove(nah);
         ah->a.next = nah->a.next;
         nah->a.next->a.prev = ah;
 
@@ -60,10 +52,25 @@ __free_block(struct free_arena_header *ah)
 #endif
     }
 
+    /* Now that we know its final size, put it on the right free list */
+    __malloc_bin_insert(ah);
+
     /* Return the block that contains the called block */
     return ah;
 }
 
+static void __count_free(struct free_arena_header *ah)
+{
+    struct malloc_tag_stats *ts;
+
+    if (ah->a.tag < MALLOC_STATS_TAGS) {
+	ts = &__malloc_tag_stats[ah->a.tag];
+	ts->frees++;
+	ts->blocks--;
+	ts->bytes -= ARENA_SIZE_GET(ah->a.attrs);
+    }
+}
+
 void free(void *ptr)
 {
     struct free_arena_header *ah;
@@ -80,6 +87,7 @@ void free(void *ptr)
     assert( ARENA_TYPE_GET(ah->a.attrs) == ARENA_TYPE_USED );
 #endif
 
+    __count_free(ah);
     __free_block(ah);
 
   /* Here we could insert code to return memory to the system. */
@@ -138,8 +146,10 @@ static void __free_tagged(malloc_tag_t tag) {
 	head = &__malloc_head[i];
 	for (fp = head->a.next ; fp != head ; fp = fp->a.next) {
 	    if (ARENA_TYPE_GET(fp->a.attrs) == ARENA_TYPE_USED &&
-		fp->a.tag == tag)
+		fp->a.tag == tag) {
+		__count_free(fp);
 		fp = __free_block(fp);
+	    }
 	}
     }
 
@@ -11,7 +11,7 @@ extern char __lowmem_heap[];
 void mem_init(void)
 {
     struct free_arena_header *fp;
-    int i;
+    int i, j;
     uint16_t *bios_free_mem = (uint16_t *)0x413;
 
     /* Initialize the head nodes */
@@ -24,6 +24,16 @@ void mem_init(void)
 	fp++;
     }
 
+    /* ... and the free list heads */
+    for (i = 0 ; i < NHEAP ; i++) {
+	for (j = 0 ; j < MALLOC_BINS ; j++) {
+	    fp = &__malloc_bins[i].bin[j];
+	    fp->a.next = fp->a.prev = fp->next_free = fp->prev_free = fp;
+	    fp->a.attrs = ARENA_TYPE_HEAD | (i << ARENA_HEAP_POS);
+	    fp->a.tag = MALLOC_HEAD;
+	}
+    }
+
     /* Initialize the main heap */
     fp = (struct free_arena_header *)main_heap;
     fp->a.attrs = ARENA_TYPE_USED | (HEAP_MAIN << ARENA_HEAP_POS);
@@ -1,7 +1,8 @@
 /*
  * malloc.c
  *
- * Very simple linked-list based malloc()/free().
+ * Very simple linked-list based malloc()/free(), with the free blocks
+ * binned by size.
  */
 
 #include <stdlib.h>
@@ -10,6 +11,50 @@
 #include <dprintf.h>
 #include "malloc.h"
 
+struct malloc_bins __malloc_bins[NHEAP];
+struct malloc_tag_stats __malloc_tag_stats[MALLOC_STATS_TAGS];
+
+/*
+ * Which bin does a free block of this size go in?
+ */
+unsigned int __malloc_bin(size_t size)
+{
+    unsigned int bin;
+
+    if (size <= MALLOC_SMALL_MAX)
+	return size / sizeof(struct arena_header) - 2;
+
+    bin = MALLOC_SMALL_BINS + __builtin_clz(MALLOC_SMALL_MAX)
+	- __builtin_clz(size - 1);
+    return bin < MALLOC_BINS ? bin : MALLOC_BINS - 1;
+}
+
+void __malloc_bin_insert(struct free_arena_header *fp)
+{
+    struct malloc_bins *mb = &__malloc_bins[ARENA_HEAP_GET(fp->a.attrs)];
+    unsigned int bin = __malloc_bin(ARENA_SIZE_GET(fp->a.attrs));
+    struct free_arena_header *head = &mb->bin[bin];
+
+    fp->next_free = head->next_free;
+    fp->prev_free = head;
+    head->next_free->prev_free = fp;
+    head->next_free = fp;
+    mb->map |= 1 << bin;
+}
+
+/* This must be called before the size of the block changes */
+void __malloc_bin_remove(struct free_arena_header *fp)
+{
+    struct malloc_bins *mb = &__malloc_bins[ARENA_HEAP_GET(fp->a.attrs)];
+
+    fp->next_free->prev_free = fp->prev_free;
+    fp->prev_free->next_free = fp->next_free;
+
+    /* Both neighbours are the list head if the list is now empty */
+    if (fp->next_free == fp->prev_free)
+	mb->map &= ~(1 << __malloc_bin(ARENA_SIZE_GET(fp->a.attrs)));
+}
+
 static void *__malloc_from_block(struct free_arena_header *fp,
 				 size_t size, malloc_tag_t tag)
 {
@@ -18,6 +63,7 @@ static void *__malloc_from_block(struct free_arena_header *fp,
     unsigned int heap = ARENA_HEAP_GET(fp->a.attrs);
 
     fsize = ARENA_SIZE_GET(fp->a.attrs);
+    __malloc_bin_remove(fp);
 
     /* We need the 2* to account for the larger requirements of a free block */
     if ( fsize >= size+2*sizeof(struct arena_header) ) {
@@ -39,19 +85,22 @@ static void *__malloc_from_block(struct free_arena_header *fp,
         na->a.prev = nfp;
         fp->a.next = nfp;
 
-        /* Replace current block on free chain */
-        nfp->next_free = fp->next_free;
-        nfp->prev_free = fp->prev_free;
-        fp->next_free->prev_free = nfp;
-        fp->prev_free->next_free = nfp;
+        /* The rest goes back on the free lists */
+        __malloc_bin_insert(nfp);
     } else {
         /* Allocate the whole block */
         ARENA_TYPE_SET(fp->a.attrs, ARENA_TYPE_USED);
         fp->a.tag = tag;
+    }
 
-        /* Remove from free chain */
-        fp->next_free->prev_free = fp->prev_free;
-        fp->prev_free->next_free = fp->next_free;
+    if (tag < MALLOC_STATS_TAGS) {
+	struct malloc_tag_stats *ts = &__malloc_tag_stats[tag];
+
+	ts->allocs++;
+	ts->blocks++;
+	ts->bytes += ARENA_SIZE_GET(fp->a.attrs);
+	if (ts->bytes > ts->peak_bytes)
+	    ts->peak_bytes = ts->bytes;
     }
 
     return (void *)(&fp->a + 1);
@@ -59,8 +108,10 @@ static void *__malloc_from_block(struct free_arena_header *fp,
 
 static void *_malloc(size_t size, enum heap heap, malloc_tag_t tag)
 {
-    struct free_arena_header *fp;
-    struct free_arena_header *head = &__malloc_head[heap];
+    struct malloc_bins *mb = &__malloc_bins[heap];
+    struct free_arena_header *fp, *head;
+    unsigned int bin;
+    uint32_t map;
     void *p = NULL;
 
     dprintf("_malloc(%zu, %u, %u) @ %p = ",
@@ -70,17 +121,40 @@ static void *_malloc(size_t size, enum heap heap, malloc_tag_t tag)
 	/* Add the obligatory arena header, and round up */
 	size = (size + 2 * sizeof(struct arena_header) - 1) & ARENA_SIZE_MASK;
 
-	for ( fp = head->next_free ; fp != head ; fp = fp->next_free ) {
-	    if ( ARENA_SIZE_GET(fp->a.attrs) >= size ) {
-		/* Found fit -- allocate out of this block */
-		p = __malloc_from_block(fp, size, tag);
-		break;
+	bin = __malloc_bin(size);
+	map = mb->map & ~((1 << bin) - 1);
+
+	if (bin >= MALLOC_SMALL_BINS && (map & (1 << bin))) {
+	    /* Our own bin may hold blocks that are too small */
+	    head = &mb->bin[bin];
+	    for (fp = head->next_free; fp != head; fp = fp->next_free) {
+		if (ARENA_SIZE_GET(fp->a.attrs) >= size)
+		    goto found;
+		mb->stats.bin_searches++;
 	    }
-        }
+	    map &= ~(1 << bin);
+	}
+
+	if (map) {
+	    /* Anything in the first non-empty bin from here on fits */
+	    fp = mb->bin[__builtin_ctz(map)].next_free;
+	    if (ARENA_SIZE_GET(fp->a.attrs) == size)
+		mb->stats.exact_hits++;
+	    goto found;
+	}
+
+	if (tag < MALLOC_STATS_TAGS)
+	    __malloc_tag_stats[tag].failures++;
     }
 
     dprintf("%p\n", p);
     return p;
+
+found:
+    /* Found fit -- allocate out of this block */
+    p = __malloc_from_block(fp, size, tag);
+    dprintf("%p\n", p);
+    return p;
 }
 
 void *malloc(size_t size)
@@ -97,3 +171,40 @@ void *pmapi_lmalloc(size_t size)
 {
     return _malloc(size, HEAP_LOWMEM, MALLOC_MODULE);
 }
+
+/*
+ * INT 22h AX=0027h: copy the statistics to ES:BX, at most CX bytes;
+ * returns the full size of the structure in CX.
+ */
+void get_mallocstats(com32sys_t *regs)
+{
+    static struct malloc_stats stats;
+    struct free_arena_header *fp, *head;
+    struct malloc_heap_stats *hs;
+    void *buf = MK_PTR(regs->es, regs->ebx.w[0]);
+    size_t len = sizeof stats;
+    size_t size;
+    int i, j;
+
+    memcpy(stats.tag, __malloc_tag_stats, sizeof stats.tag);
+
+    for (i = 0; i < NHEAP && i < MALLOC_STATS_HEAPS; i++) {
+	hs = &stats.heap[i];
+	*hs = __malloc_bins[i].stats;
+	for (j = 0; j < MALLOC_BINS; j++) {
+	    head = &__malloc_bins[i].bin[j];
+	    for (fp = head->next_free; fp != head; fp = fp->next_free) {
+		size = ARENA_SIZE_GET(fp->a.attrs);
+		hs->free_blocks++;
+		hs->free_bytes += size;
+		if (size > hs->largest_free)
+		    hs->largest_free = size;
+	    }
+	}
+    }
+
+    if (len > regs->ecx.w[0])
+	len = regs->ecx.w[0];
+    memcpy(buf, &stats, len);
+    regs->ecx.w[0] = sizeof stats;
+}
@@ -6,6 +6,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <syslinux/malloc_stats.h>
 #include "core.h"
 
 /*
@@ -78,5 +79,30 @@ struct free_arena_header {
     size_t _pad[2];		/* Pad to 2*sizeof(struct arena_header) */
 };
 
+/*
+ * Free blocks are kept on segregated lists ("bins") by size.  Each of
+ * the first MALLOC_SMALL_BINS holds blocks of one size only, in steps
+ * of the arena unit, so small allocations come straight off the front
+ * of a list; each of the others holds a power-of-two range of sizes,
+ * and the last one everything bigger.  A bitmap of the non-empty bins
+ * lets us skip the empty ones.
+ */
+#define MALLOC_BINS		32
+#define MALLOC_SMALL_BINS	15
+#define MALLOC_SMALL_MAX	((MALLOC_SMALL_BINS + 1) * \
+				 sizeof(struct arena_header))
+
+struct malloc_bins {
+    uint32_t map;			/* Bit n set if bin[n] is non-empty */
+    struct free_arena_header bin[MALLOC_BINS];
+    struct malloc_heap_stats stats;
+};
+
 extern struct free_arena_header __malloc_head[NHEAP];
+extern struct malloc_bins __malloc_bins[NHEAP];
+extern struct malloc_tag_stats __malloc_tag_stats[MALLOC_STATS_TAGS];
+
 void __inject_free_block(struct free_arena_header *ah);
+unsigned int __malloc_bin(size_t size);
+void __malloc_bin_insert(struct free_arena_header *fp);
+void __malloc_bin_remove(struct free_arena_header *fp);
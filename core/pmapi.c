@@ -40,4 +40,6 @@ const struct com32_pmapi pm_api_vector =
 
     .jiffies	= &__jiffies,
     .ms_timer	= &__ms_timer,
+
+    .read_files	= pmapi_read_files,
 };
@@ -49,6 +49,16 @@ struct downloader {
 	struct image *image;
 	/** Current position within image buffer */
 	size_t pos;
+	/** Allocated length of image buffer
+	 *
+	 * This may be more than the image length, to leave room for
+	 * data which has yet to arrive.
+	 */
+	size_t alloc_len;
+	/** Number of times the image buffer has been reallocated */
+	unsigned int reallocs;
+	/** Total length of data moved by reallocations */
+	size_t realloc_bytes;
 	/** Image registration routine */
 	int ( * register_image ) ( struct image *image );
 };
@@ -83,37 +93,98 @@ static void downloader_finished ( struct downloader *downloader, int rc ) {
 	job_done ( &downloader->job, rc );
 }
 
+/**
+ * Reallocate download buffer
+ *
+ * @v downloader	Downloader
+ * @v alloc_len		New allocated length
+ * @ret rc		Return status code
+ */
+static int downloader_realloc ( struct downloader *downloader,
+				size_t alloc_len ) {
+	userptr_t new_buffer;
+
+	new_buffer = urealloc ( downloader->image->data, alloc_len );
+	if ( ! new_buffer )
+		return -ENOBUFS;
+
+	/* Reallocation may move the existing contents */
+	downloader->reallocs++;
+	downloader->realloc_bytes += downloader->image->len;
+
+	downloader->image->data = new_buffer;
+	downloader->alloc_len = alloc_len;
+	return 0;
+}
+
 /**
  * Ensure that download buffer is large enough for the specified size
  *
  * @v downloader	Downloader
  * @v len		Required minimum size
+ * @v exact		Size is the final size of the image
  * @ret rc		Return status code
+ *
+ * Reallocating may copy the whole buffer, so if the final size isn't
+ * known then the buffer is grown geometrically, to keep the total
+ * amount copied proportional to the image size.
  */
 static int downloader_ensure_size ( struct downloader *downloader,
-				    size_t len ) {
-	userptr_t new_buffer;
+				    size_t len, int exact ) {
+	size_t alloc_len;
 
 	/* If buffer is already large enough, do nothing */
 	if ( len <= downloader->image->len )
 		return 0;
 
-	DBGC ( downloader, "Downloader %p extending to %zd bytes\n",
-	       downloader, len );
-
-	/* Extend buffer */
-	new_buffer = urealloc ( downloader->image->data, len );
-	if ( ! new_buffer ) {
-		DBGC ( downloader, "Downloader %p could not extend buffer to "
-		       "%zd bytes\n", downloader, len );
-		return -ENOBUFS;
+	/* Extend buffer, if it doesn't have room already */
+	if ( len > downloader->alloc_len ) {
+		alloc_len = len;
+		if ( ! exact ) {
+			alloc_len += ( downloader->alloc_len / 2 );
+			if ( alloc_len < len )
+				alloc_len = len;
+		}
+
+		DBGC ( downloader, "Downloader %p extending to %zd bytes\n",
+		       downloader, alloc_len );
+
+		/* Fall back to the exact size if memory is tight */
+		if ( ( downloader_realloc ( downloader, alloc_len ) != 0 ) &&
+		     ( ( alloc_len == len ) ||
+		       ( downloader_realloc ( downloader, len ) != 0 ) ) ) {
+			DBGC ( downloader, "Downloader %p could not extend "
+			       "buffer to %zd bytes\n", downloader, len );
+			return -ENOBUFS;
+		}
 	}
-	downloader->image->data = new_buffer;
 	downloader->image->len = len;
 
 	return 0;
 }
 
+/**
+ * Release unused space at the end of the download buffer
+ *
+ * @v downloader	Downloader
+ */
+static void downloader_trim ( struct downloader *downloader ) {
+	size_t len = downloader->image->len;
+
+	/* Shrinking should never fail, but the oversized buffer is
+	 * still usable if it does.
+	 */
+	if ( ( len < downloader->alloc_len ) &&
+	     ( downloader_realloc ( downloader, len ) != 0 ) ) {
+		DBGC ( downloader, "Downloader %p could not trim buffer to "
+		       "%zd bytes\n", downloader, len );
+	}
+
+	DBGC ( downloader, "Downloader %p received %zd bytes with %d "
+	       "reallocations moving %zd bytes\n", downloader, len,
+	       downloader->reallocs, downloader->realloc_bytes );
+}
+
 /****************************************************************************
  *
  * Job control interface
@@ -187,10 +258,14 @@ static int downloader_xfer_deliver_iob ( struct xfer_interface *xfer,
 		downloader->pos = 0;
 	downloader->pos += meta->offset;
 
-	/* Ensure that we have enough buffer space for this data */
+	/* Ensure that we have enough buffer space for this data.  An
+	 * empty buffer is a seek(), which protocols use to tell us the
+	 * filesize, so allocate exactly that much.
+	 */
 	len = iob_len ( iobuf );
 	max = ( downloader->pos + len );
-	if ( ( rc = downloader_ensure_size ( downloader, max ) ) != 0 )
+	if ( ( rc = downloader_ensure_size ( downloader, max,
+					     ( len == 0 ) ) ) != 0 )
 		goto done;
 
 	/* Copy data to buffer */
@@ -216,8 +291,10 @@ static void downloader_xfer_close ( struct xfer_interface *xfer, int rc ) {
 		container_of ( xfer, struct downloader, xfer );
 
 	/* Register image if download was successful */
-	if ( rc == 0 )
+	if ( rc == 0 ) {
+		downloader_trim ( downloader );
 		rc = downloader->register_image ( downloader->image );
+	}
 
 	/* Terminate download */
 	downloader_finished ( downloader, rc );
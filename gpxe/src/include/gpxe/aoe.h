@@ -101,6 +101,29 @@ struct aoehdr {
 #define AOE_ERR_CONFIG_EXISTS	4 /**< Config string present */
 #define AOE_ERR_BAD_VERSION	5 /**< Unsupported version */
 
+/** Maximum number of AoE commands outstanding per session */
+#define AOE_MAX_TAGS 16
+
+struct aoe_session;
+
+/** An outstanding AoE command */
+struct aoe_tag {
+	/** AoE session */
+	struct aoe_session *aoe;
+	/** Tag is in use */
+	int busy;
+	/** Tag value */
+	uint32_t tag;
+	/** Starting LBA */
+	uint64_t lba;
+	/** Number of sectors */
+	unsigned int count;
+	/** Byte offset within ATA command's data buffer */
+	unsigned int offset;
+	/** Retransmission timer */
+	struct retry_timer timer;
+};
+
 /** An AoE session */
 struct aoe_session {
 	/** Reference counter */
@@ -119,8 +142,18 @@ struct aoe_session {
 	/** Target MAC address */
 	uint8_t target[ETH_ALEN];
 
-	/** Tag for current AoE command */
+	/** Tag for most recent AoE command */
 	uint32_t tag;
+	/** Outstanding AoE commands */
+	struct aoe_tag tags[AOE_MAX_TAGS];
+	/** Number of outstanding AoE commands */
+	unsigned int pending;
+	/** Maximum number of outstanding AoE commands
+	 *
+	 * This is the target's queue depth, as reported in its
+	 * config response.
+	 */
+	unsigned int window;
 
 	/** Current AOE command */
 	uint8_t aoe_cmd_type;
@@ -128,13 +161,18 @@ struct aoe_session {
 	struct ata_command *command;
 	/** Overall status of current ATA command */
 	unsigned int status;
-	/** Byte offset within command's data buffer */
+	/** LBA of next AoE command to send */
+	uint64_t lba;
+	/** Sectors for which no AoE command has been sent */
+	unsigned int count;
+	/** Byte offset of next AoE command within data buffer */
 	unsigned int command_offset;
+	/** Number of AoE commands still to be sent */
+	unsigned int tx_remaining;
+	/** Number of AoE commands still awaiting a response */
+	unsigned int rx_remaining;
 	/** Return status code for command */
 	int rc;
-
-	/** Retransmission timer */
-	struct retry_timer timer;
 };
 
 #define AOE_STATUS_ERR_MASK	0x0f /**< Error portion of status code */ 
@@ -54,6 +54,71 @@ struct tcp_mss_option {
 /** Code for the TCP MSS option */
 #define TCP_OPTION_MSS 2
 
+/** TCP window scale option */
+struct tcp_window_scale_option {
+	uint8_t kind;
+	uint8_t length;
+	uint8_t scale;
+} __attribute__ (( packed ));
+
+/** Padded TCP window scale option (used for sending) */
+struct tcp_window_scale_padded_option {
+	uint8_t nop[1];
+	struct tcp_window_scale_option wsopt;
+} __attribute__ (( packed ));
+
+/** Code for the TCP window scale option */
+#define TCP_OPTION_WS 3
+
+/** Largest window scale shift allowed by RFC 7323 */
+#define TCP_MAX_WINDOW_SCALE 14
+
+/** TCP SACK-permitted option */
+struct tcp_sack_permitted_option {
+	uint8_t kind;
+	uint8_t length;
+} __attribute__ (( packed ));
+
+/** Padded TCP SACK-permitted option (used for sending) */
+struct tcp_sack_permitted_padded_option {
+	uint8_t nop[2];
+	struct tcp_sack_permitted_option spopt;
+} __attribute__ (( packed ));
+
+/** Code for the TCP SACK-permitted option */
+#define TCP_OPTION_SACK_PERMITTED 4
+
+/** TCP SACK block */
+struct tcp_sack_block {
+	uint32_t left;
+	uint32_t right;
+} __attribute__ (( packed ));
+
+/** Padded TCP SACK option (used for sending)
+ *
+ * The option is followed by between one and @c TCP_SACK_MAX blocks.
+ */
+struct tcp_sack_padded_option {
+	uint8_t nop[2];
+	uint8_t kind;
+	uint8_t length;
+} __attribute__ (( packed ));
+
+/** Code for the TCP SACK option */
+#define TCP_OPTION_SACK 5
+
+/** Maximum length of TCP options
+ *
+ * This is limited by the size of the header length field.
+ */
+#define TCP_MAX_OPTIONS_LEN 40
+
+/** Maximum number of SACK blocks we send
+ *
+ * This is as many as fit in the option space alongside timestamps.
+ */
+#define TCP_SACK_MAX 3
+
 /** TCP timestamp option */
 struct tcp_timestamp_option {
 	uint8_t kind;
@@ -77,8 +142,37 @@ struct tcp_options {
 	const struct tcp_mss_option *mssopt;
 	/** Timestampe option, if present */
 	const struct tcp_timestamp_option *tsopt;
+	/** Window scale option, if present */
+	const struct tcp_window_scale_option *wsopt;
+	/** SACK-permitted option, if present */
+	const struct tcp_sack_permitted_option *spopt;
 };
 
+/**
+ * Internal header of a received segment awaiting processing
+ *
+ * This is pushed onto the front of the segment's payload while it
+ * sits on the receive queue.
+ */
+struct tcp_rx_queued_header {
+	/** SEQ value, in host-endian order
+	 *
+	 * This is the sequence number of the first payload byte (or
+	 * of the FIN, if there is no payload).
+	 */
+	uint32_t seq;
+	/** Next SEQ value, in host-endian order */
+	uint32_t nxt;
+	/** Flags
+	 *
+	 * Only FIN is valid within this flags byte; SYN has already
+	 * been processed by the time the segment is queued.
+	 */
+	uint8_t flags;
+	/** Reserved */
+	uint8_t reserved[3];
+} __attribute__ (( packed ));
+
 /** @} */
 
 /*
@@ -265,29 +359,27 @@ struct tcp_options {
 /**
  * Maxmimum advertised TCP window size
  *
- * We estimate the TCP window size as the amount of free memory we
- * have.  This is not strictly accurate (since it ignores any space
- * already allocated as RX buffers), but it will do for now.
- *
- * Since we don't store out-of-order received packets, the
- * retransmission penalty is that the whole window contents must be
- * resent.  This suggests keeping the window size small, but bear in
- * mind that the maximum bandwidth on any link is limited to
+ * We estimate the TCP window size from the amount of free memory we
+ * have, up to this limit.  Out-of-order segments are held until the
+ * gap before them is filled, so the window has to be small enough
+ * that we can buffer all of it; in-order data is handed straight to
+ * the application.  The maximum bandwidth on any link is limited to
  *
  *    max_bandwidth = ( tcp_window / round_trip_time )
  *
- * With a 48kB window, which probably accurately reflects our amount
- * of free memory, and a WAN RTT of say 200ms, this gives a maximum
- * bandwidth of 240kB/s.  This is sufficiently close to realistic that
- * we will need to be careful that our advertised window doesn't end
- * up limiting WAN download speeds.
+ * so a 64kB window and a WAN RTT of 50ms give at most 10Mbit/s.  To
+ * do better, we use window scaling when the peer supports it.
+ */
+#define TCP_MAX_WINDOW_SIZE	( 256 * 1024 )
+
+/**
+ * Receive window scale
  *
- * Finally, since the window goes into a 16-bit field and we cannot
- * actually use 65536, we use a window size of (65536-4) to ensure
- * that payloads remain dword-aligned.
+ * This is the smallest shift which lets us advertise the whole of
+ * @c TCP_MAX_WINDOW_SIZE.  Without window scaling, the advertised
+ * window is limited to (65536-4), to keep payloads dword-aligned.
  */
-#define TCP_MAX_WINDOW_SIZE	( 65536 - 4 )
-//#define TCP_MAX_WINDOW_SIZE	4096
+#define TCP_RX_WINDOW_SCALE	3
 
 /**
  * Path MTU
@@ -313,6 +405,20 @@ struct tcp_options {
  */
 #define TCP_MSL ( 2 * 60 * TICKS_PER_SEC )
 
+/**
+ * Compare TCP sequence numbers
+ *
+ * @v seq1		Sequence number 1
+ * @v seq2		Sequence number 2
+ * @ret diff		Sequence difference
+ *
+ * The result is negative, zero or positive as @c seq1 is before, at
+ * or after @c seq2, allowing for wraparound.
+ */
+static inline int32_t tcp_cmp ( uint32_t seq1, uint32_t seq2 ) {
+	return ( ( int32_t ) ( seq1 - seq2 ) );
+}
+
 extern struct tcpip_protocol tcp_protocol;
 
 #endif /* _GPXE_TCP_H */
@@ -64,6 +64,8 @@ static void aoe_free ( struct refcnt *refcnt ) {
  * @v rc		Return status code
  */
 static void aoe_done ( struct aoe_session *aoe, int rc ) {
+	struct aoe_tag *tag;
+	unsigned int i;
 
 	/* Record overall command status */
 	if ( aoe->command ) {
@@ -72,8 +74,17 @@ static void aoe_done ( struct aoe_session *aoe, int rc ) {
 		aoe->command = NULL;
 	}
 
-	/* Stop retransmission timer */
-	stop_timer ( &aoe->timer );
+	/* Stop retransmission timers and forget any outstanding
+	 * commands; late responses will no longer match a tag.
+	 */
+	for ( i = 0 ; i < AOE_MAX_TAGS ; i++ ) {
+		tag = &aoe->tags[i];
+		stop_timer ( &tag->timer );
+		tag->busy = 0;
+	}
+	aoe->pending = 0;
+	aoe->tx_remaining = 0;
+	aoe->rx_remaining = 0;
 
 	/* Mark operation as complete */
 	aoe->rc = rc;
@@ -83,18 +94,18 @@ static void aoe_done ( struct aoe_session *aoe, int rc ) {
  * Send AoE command
  *
  * @v aoe		AoE session
+ * @v tag		AoE command tag
  * @ret rc		Return status code
  *
  * This transmits an AoE command packet.  It does not wait for a
  * response.
  */
-static int aoe_send_command ( struct aoe_session *aoe ) {
+static int aoe_send_command ( struct aoe_session *aoe, struct aoe_tag *tag ) {
 	struct ata_command *command = aoe->command;
 	struct io_buffer *iobuf;
 	struct aoehdr *aoehdr;
 	union aoecmd *aoecmd;
 	struct aoeata *aoeata;
-	unsigned int count;
 	unsigned int data_out_len;
 	unsigned int aoecmdlen;
 
@@ -109,20 +120,16 @@ static int aoe_send_command ( struct aoe_session *aoe ) {
          * to allocate the I/O buffer, in case allocation itself
          * fails.
          */
-	start_timer ( &aoe->timer );
+	start_timer ( &tag->timer );
 
-	/* Calculate count and data_out_len for this subcommand */
+	/* Calculate data_out_len for this subcommand */
 	switch ( aoe->aoe_cmd_type ) {
 	case AOE_CMD_ATA:
-		count = command->cb.count.native;
-		if ( count > AOE_MAX_COUNT )
-			count = AOE_MAX_COUNT;
 		data_out_len = ( command->data_out ?
-				 ( count * ATA_SECTOR_SIZE ) : 0 );
+				 ( tag->count * ATA_SECTOR_SIZE ) : 0 );
 		aoecmdlen = sizeof ( aoecmd->ata );
 		break;
 	case AOE_CMD_CONFIG:
-		count = 0;
 		data_out_len = 0;
 		aoecmdlen = sizeof ( aoecmd->cfg );
 		break;
@@ -146,7 +153,7 @@ static int aoe_send_command ( struct aoe_session *aoe ) {
 	aoehdr->major = htons ( aoe->major );
 	aoehdr->minor = aoe->minor;
 	aoehdr->command = aoe->aoe_cmd_type;
-	aoehdr->tag = htonl ( ++aoe->tag );
+	aoehdr->tag = htonl ( tag->tag );
 
 	/* Fill AoE payload */
 	switch ( aoe->aoe_cmd_type ) {
@@ -159,16 +166,16 @@ static int aoe_send_command ( struct aoe_session *aoe ) {
 				   ( command->cb.device & ATA_DEV_SLAVE ) |
 				   ( data_out_len ? AOE_FL_WRITE : 0 ) );
 		aoeata->err_feat = command->cb.err_feat.bytes.cur;
-		aoeata->count = count;
+		aoeata->count = tag->count;
 		aoeata->cmd_stat = command->cb.cmd_stat;
-		aoeata->lba.u64 = cpu_to_le64 ( command->cb.lba.native );
+		aoeata->lba.u64 = cpu_to_le64 ( tag->lba );
 		if ( ! command->cb.lba48 )
 			aoeata->lba.bytes[3] |=
 				( command->cb.device & ATA_DEV_MASK );
 
 		/* Fill data payload */
 		copy_from_user ( iob_put ( iobuf, data_out_len ),
-				 command->data_out, aoe->command_offset,
+				 command->data_out, tag->offset,
 				 data_out_len );
 		break;
 	case AOE_CMD_CONFIG:
@@ -182,6 +189,93 @@ static int aoe_send_command ( struct aoe_session *aoe ) {
 	return net_tx ( iobuf, aoe->netdev, &aoe_protocol, aoe->target );
 }
 
+/**
+ * Send as many AoE commands as the target will accept
+ *
+ * @v aoe		AoE session
+ *
+ * An ATA command is split into AoE commands of at most @c
+ * AOE_MAX_COUNT sectors each, which are sent without waiting for
+ * earlier ones to complete, up to the target's queue depth.
+ */
+static void aoe_send_commands ( struct aoe_session *aoe ) {
+	struct aoe_tag *tag;
+	unsigned int count;
+	unsigned int i;
+
+	while ( aoe->tx_remaining && ( aoe->pending < aoe->window ) ) {
+
+		/* Find a free tag */
+		for ( i = 0 ; i < AOE_MAX_TAGS ; i++ ) {
+			if ( ! aoe->tags[i].busy )
+				break;
+		}
+		assert ( i < AOE_MAX_TAGS );
+		tag = &aoe->tags[i];
+
+		/* Take the next portion of the ATA command */
+		count = aoe->count;
+		if ( count > AOE_MAX_COUNT )
+			count = AOE_MAX_COUNT;
+		tag->busy = 1;
+		tag->tag = ++aoe->tag;
+		tag->lba = aoe->lba;
+		tag->count = count;
+		tag->offset = aoe->command_offset;
+		aoe->lba += count;
+		aoe->count -= count;
+		aoe->command_offset += ( count * ATA_SECTOR_SIZE );
+		aoe->tx_remaining--;
+		aoe->pending++;
+
+		/* A failure to send will be retried by the timer */
+		aoe_send_command ( aoe, tag );
+	}
+}
+
+/**
+ * Start AoE command
+ *
+ * @v aoe		AoE session
+ * @v count		Number of sectors
+ */
+static void aoe_start ( struct aoe_session *aoe, unsigned int count ) {
+
+	aoe->status = 0;
+	aoe->count = count;
+	aoe->command_offset = 0;
+
+	/* A command with no data still needs one AoE command */
+	aoe->tx_remaining = ( ( count + AOE_MAX_COUNT - 1 ) / AOE_MAX_COUNT );
+	if ( ! aoe->tx_remaining )
+		aoe->tx_remaining = 1;
+	aoe->rx_remaining = aoe->tx_remaining;
+
+	aoe_send_commands ( aoe );
+}
+
+/**
+ * Mark AoE command as complete
+ *
+ * @v aoe		AoE session
+ * @v tag		AoE command tag
+ */
+static void aoe_tag_done ( struct aoe_session *aoe, struct aoe_tag *tag ) {
+
+	stop_timer ( &tag->timer );
+	tag->busy = 0;
+	aoe->pending--;
+
+	/* Check for operation complete */
+	if ( ! --aoe->rx_remaining ) {
+		aoe_done ( aoe, 0 );
+		return;
+	}
+
+	/* Transmit next portion of request */
+	aoe_send_commands ( aoe );
+}
+
 /**
  * Handle AoE retry timer expiry
  *
@@ -189,13 +283,16 @@ static int aoe_send_command ( struct aoe_session *aoe ) {
  * @v fail		Failure indicator
  */
 static void aoe_timer_expired ( struct retry_timer *timer, int fail ) {
-	struct aoe_session *aoe =
-		container_of ( timer, struct aoe_session, timer );
+	struct aoe_tag *tag =
+		container_of ( timer, struct aoe_tag, timer );
+	struct aoe_session *aoe = tag->aoe;
 
 	if ( fail ) {
 		aoe_done ( aoe, -ETIMEDOUT );
 	} else {
-		aoe_send_command ( aoe );
+		DBGC ( aoe, "AoE %p retransmitting tag %08x\n",
+		       aoe, tag->tag );
+		aoe_send_command ( aoe, tag );
 	}
 }
 
@@ -203,18 +300,38 @@ static void aoe_timer_expired ( struct retry_timer *timer, int fail ) {
  * Handle AoE configuration command response
  *
  * @v aoe		AoE session
+ * @v tag		AoE command tag
+ * @v aoecfg		AoE config command
+ * @v len		Length of AoE config command
  * @v ll_source		Link-layer source address
  * @ret rc		Return status code
  */
-static int aoe_rx_cfg ( struct aoe_session *aoe, const void *ll_source ) {
+static int aoe_rx_cfg ( struct aoe_session *aoe, struct aoe_tag *tag,
+			struct aoecfg *aoecfg, size_t len,
+			const void *ll_source ) {
+	unsigned int bufcnt;
+
+	/* Sanity check */
+	if ( len < sizeof ( *aoecfg ) ) {
+		/* Ignore packet; allow timer to trigger retransmit */
+		return -EINVAL;
+	}
 
 	/* Record target MAC address */
 	memcpy ( aoe->target, ll_source, sizeof ( aoe->target ) );
 	DBGC ( aoe, "AoE %p target MAC address %s\n",
 	       aoe, eth_ntoa ( aoe->target ) );
 
+	/* Record target queue depth */
+	bufcnt = ntohs ( aoecfg->bufcnt );
+	aoe->window = ( ( bufcnt < AOE_MAX_TAGS ) ? bufcnt : AOE_MAX_TAGS );
+	if ( ! aoe->window )
+		aoe->window = 1;
+	DBGC ( aoe, "AoE %p target queue depth %d, using %d\n",
+	       aoe, bufcnt, aoe->window );
+
 	/* Mark config request as complete */
-	aoe_done ( aoe, 0 );
+	aoe_tag_done ( aoe, tag );
 
 	return 0;
 }
@@ -223,15 +340,18 @@ static int aoe_rx_cfg ( struct aoe_session *aoe, const void *ll_source ) {
  * Handle AoE ATA command response
  *
  * @v aoe		AoE session
+ * @v tag		AoE command tag
  * @v aoeata		AoE ATA command
  * @v len		Length of AoE ATA command
  * @ret rc		Return status code
+ *
+ * Responses may arrive in any order; each carries the data for its
+ * own portion of the ATA command's data buffer.
  */
-static int aoe_rx_ata ( struct aoe_session *aoe, struct aoeata *aoeata,
-			size_t len ) {
+static int aoe_rx_ata ( struct aoe_session *aoe, struct aoe_tag *tag,
+			struct aoeata *aoeata, size_t len ) {
 	struct ata_command *command = aoe->command;
 	unsigned int rx_data_len;
-	unsigned int count;
 	unsigned int data_len;
 
 	/* Sanity check */
@@ -240,12 +360,7 @@ static int aoe_rx_ata ( struct aoe_session *aoe, struct aoeata *aoeata,
 		return -EINVAL;
 	}
 	rx_data_len = ( len - sizeof ( *aoeata ) );
-
-	/* Calculate count and data_len for this subcommand */
-	count = command->cb.count.native;
-	if ( count > AOE_MAX_COUNT )
-		count = AOE_MAX_COUNT;
-	data_len = count * ATA_SECTOR_SIZE;
+	data_len = ( tag->count * ATA_SECTOR_SIZE );
 
 	/* Merge into overall ATA status */
 	aoe->status |= aoeata->cmd_stat;
@@ -254,28 +369,36 @@ static int aoe_rx_ata ( struct aoe_session *aoe, struct aoeata *aoeata,
 	if ( command->data_in ) {
 		if ( rx_data_len > data_len )
 			rx_data_len = data_len;
-		copy_to_user ( command->data_in, aoe->command_offset,
+		copy_to_user ( command->data_in, tag->offset,
 			       aoeata->data, rx_data_len );
 	}
 
-	/* Update ATA command and offset */
-	aoe->command_offset += data_len;
-	command->cb.lba.native += count;
-	command->cb.count.native -= count;
-
-	/* Check for operation complete */
-	if ( ! command->cb.count.native ) {
-		aoe_done ( aoe, 0 );
-		return 0;
-	}
-
-	/* Transmit next portion of request */
-	stop_timer ( &aoe->timer );
-	aoe_send_command ( aoe );
+	/* Mark this portion of the command as complete */
+	aoe_tag_done ( aoe, tag );
 
 	return 0;
 }
 
+/**
+ * Find outstanding AoE command
+ *
+ * @v aoe		AoE session
+ * @v tag_value		Tag value
+ * @ret tag		AoE command tag, or NULL
+ */
+static struct aoe_tag * aoe_find_tag ( struct aoe_session *aoe,
+				       uint32_t tag_value ) {
+	struct aoe_tag *tag;
+	unsigned int i;
+
+	for ( i = 0 ; i < AOE_MAX_TAGS ; i++ ) {
+		tag = &aoe->tags[i];
+		if ( tag->busy && ( tag->tag == tag_value ) )
+			return tag;
+	}
+	return NULL;
+}
+
 /**
  * Process incoming AoE packets
  *
@@ -290,6 +413,7 @@ static int aoe_rx ( struct io_buffer *iobuf,
 		    const void *ll_source ) {
 	struct aoehdr *aoehdr = iobuf->data;
 	struct aoe_session *aoe;
+	struct aoe_tag *tag;
 	int rc = 0;
 
 	/* Sanity checks */
@@ -313,7 +437,8 @@ static int aoe_rx ( struct io_buffer *iobuf,
 			continue;
 		if ( aoehdr->minor != aoe->minor )
 			continue;
-		if ( ntohl ( aoehdr->tag ) != aoe->tag )
+		tag = aoe_find_tag ( aoe, ntohl ( aoehdr->tag ) );
+		if ( ! tag )
 			continue;
 		if ( aoehdr->ver_flags & AOE_FL_ERROR ) {
 			aoe_done ( aoe, -EIO );
@@ -321,10 +446,12 @@ static int aoe_rx ( struct io_buffer *iobuf,
 		}
 		switch ( aoehdr->command ) {
 		case AOE_CMD_ATA:
-			rc = aoe_rx_ata ( aoe, iobuf->data, iob_len ( iobuf ));
+			rc = aoe_rx_ata ( aoe, tag, iobuf->data,
+					  iob_len ( iobuf ) );
 			break;
 		case AOE_CMD_CONFIG:
-			rc = aoe_rx_cfg ( aoe, ll_source );
+			rc = aoe_rx_cfg ( aoe, tag, iobuf->data,
+					  iob_len ( iobuf ), ll_source );
 			break;
 		default:
 			DBGC ( aoe, "AoE %p ignoring command %02x\n",
@@ -359,11 +486,10 @@ static int aoe_command ( struct ata_device *ata,
 		container_of ( ata->backend, struct aoe_session, refcnt );
 
 	aoe->command = command;
-	aoe->status = 0;
-	aoe->command_offset = 0;
 	aoe->aoe_cmd_type = AOE_CMD_ATA;
+	aoe->lba = command->cb.lba.native;
 
-	aoe_send_command ( aoe );
+	aoe_start ( aoe, command->cb.count.native );
 
 	return 0;
 }
@@ -377,13 +503,12 @@ static int aoe_command ( struct ata_device *ata,
 static int aoe_discover ( struct aoe_session *aoe ) {
 	int rc;
 
-	aoe->status = 0;
 	aoe->aoe_cmd_type = AOE_CMD_CONFIG;
 	aoe->command = NULL;
 
-	aoe_send_command ( aoe );
-
 	aoe->rc = -EINPROGRESS;
+	aoe_start ( aoe, 0 );
+
 	while ( aoe->rc == -EINPROGRESS )
 		step();
 	rc = aoe->rc;
@@ -399,8 +524,10 @@ static int aoe_detached_command ( struct ata_device *ata __unused,
 void aoe_detach ( struct ata_device *ata ) {
 	struct aoe_session *aoe =
 		container_of ( ata->backend, struct aoe_session, refcnt );
+	unsigned int i;
 
-	stop_timer ( &aoe->timer );
+	for ( i = 0 ; i < AOE_MAX_TAGS ; i++ )
+		stop_timer ( &aoe->tags[i].timer );
 	ata->command = aoe_detached_command;
 	list_del ( &aoe->list );
 	ref_put ( ata->backend );
@@ -432,6 +559,7 @@ static int aoe_parse_root_path ( struct aoe_session *aoe,
 int aoe_attach ( struct ata_device *ata, struct net_device *netdev,
 		 const char *root_path ) {
 	struct aoe_session *aoe;
+	unsigned int i;
 	int rc;
 
 	/* Allocate and initialise structure */
@@ -442,7 +570,11 @@ int aoe_attach ( struct ata_device *ata, struct net_device *netdev,
 	aoe->netdev = netdev_get ( netdev );
 	memcpy ( aoe->target, netdev->ll_broadcast, sizeof ( aoe->target ) );
 	aoe->tag = AOE_TAG_MAGIC;
-	aoe->timer.expired = aoe_timer_expired;
+	aoe->window = 1;
+	for ( i = 0 ; i < AOE_MAX_TAGS ; i++ ) {
+		aoe->tags[i].aoe = aoe;
+		aoe->tags[i].timer.expired = aoe_timer_expired;
+	}
 
 	/* Parse root path */
 	if ( ( rc = aoe_parse_root_path ( aoe, root_path ) ) != 0 )
@@ -79,9 +79,30 @@ struct tcp_connection {
 	uint32_t ts_recent;
 	/** Timestamps enabled */
 	int timestamps;
+	/** Send window scale
+	 *
+	 * Equivalent to Snd.Wind.Shift in RFC 7323 terminology
+	 */
+	unsigned int snd_win_scale;
+	/** Receive window scale
+	 *
+	 * Equivalent to Rcv.Wind.Shift in RFC 7323 terminology
+	 */
+	unsigned int rcv_win_scale;
+	/** Peer accepts SACK options */
+	int sack_permitted;
+	/** SEQ value of the most recently queued out-of-order segment */
+	uint32_t rcv_sack;
 
 	/** Transmit queue */
 	struct list_head queue;
+	/** Receive queue
+	 *
+	 * Received segments which are not yet in sequence, sorted by
+	 * SEQ value.  Each has a struct tcp_rx_queued_header pushed
+	 * onto its payload.
+	 */
+	struct list_head rx_queue;
 	/** Retransmission timer */
 	struct retry_timer timer;
 };
@@ -230,6 +251,7 @@ static int tcp_open ( struct xfer_interface *xfer, struct sockaddr *peer,
 	tcp_dump_state ( tcp );
 	tcp->snd_seq = random();
 	INIT_LIST_HEAD ( &tcp->queue );
+	INIT_LIST_HEAD ( &tcp->rx_queue );
 	tcp->timer.expired = tcp_expired;
 	memcpy ( &tcp->peer, st_peer, sizeof ( tcp->peer ) );
 
@@ -287,6 +309,12 @@ static void tcp_close ( struct tcp_connection *tcp, int rc ) {
 			free_iob ( iobuf );
 		}
 
+		/* Free any unprocessed received I/O buffers */
+		list_for_each_entry_safe ( iobuf, tmp, &tcp->rx_queue, list ) {
+			list_del ( &iobuf->list );
+			free_iob ( iobuf );
+		}
+
 		/* Remove from list and drop reference */
 		stop_timer ( &tcp->timer );
 		list_del ( &tcp->list );
@@ -379,6 +407,79 @@ static size_t tcp_process_queue ( struct tcp_connection *tcp, size_t max_len,
 	return len;
 }
 
+/**
+ * Add SACK block to list
+ *
+ * @v tcp		TCP connection
+ * @v sack		SACK block list
+ * @v count		Number of blocks in list
+ * @v left		Start of block
+ * @v right		End of block
+ * @ret count		New number of blocks in list
+ *
+ * The block holding the most recently received segment goes first,
+ * as RFC 2018 asks; others follow in sequence order while there is
+ * room.
+ */
+static unsigned int tcp_sack_add ( struct tcp_connection *tcp,
+				   struct tcp_sack_block *sack,
+				   unsigned int count, uint32_t left,
+				   uint32_t right ) {
+
+	if ( ( tcp_cmp ( tcp->rcv_sack, left ) >= 0 ) &&
+	     ( tcp_cmp ( tcp->rcv_sack, right ) < 0 ) ) {
+		if ( count == TCP_SACK_MAX )
+			count--;
+		memmove ( &sack[1], &sack[0], ( count * sizeof ( sack[0] ) ) );
+		sack[0].left = left;
+		sack[0].right = right;
+		return ( count + 1 );
+	}
+
+	if ( count < TCP_SACK_MAX ) {
+		sack[count].left = left;
+		sack[count].right = right;
+		count++;
+	}
+	return count;
+}
+
+/**
+ * Construct SACK blocks describing the receive queue
+ *
+ * @v tcp		TCP connection
+ * @v sack		SACK block list to fill in
+ * @ret count		Number of blocks
+ */
+static unsigned int tcp_sack ( struct tcp_connection *tcp,
+			       struct tcp_sack_block *sack ) {
+	struct io_buffer *iobuf;
+	struct tcp_rx_queued_header *tcpqhdr;
+	unsigned int count = 0;
+	uint32_t left = 0;
+	uint32_t right = 0;
+	int have_block = 0;
+
+	/* Merge queued segments into contiguous blocks */
+	list_for_each_entry ( iobuf, &tcp->rx_queue, list ) {
+		tcpqhdr = iobuf->data;
+		if ( have_block && ( tcp_cmp ( tcpqhdr->seq, right ) <= 0 ) ) {
+			if ( tcp_cmp ( tcpqhdr->nxt, right ) > 0 )
+				right = tcpqhdr->nxt;
+			continue;
+		}
+		if ( have_block )
+			count = tcp_sack_add ( tcp, sack, count, left, right );
+		left = tcpqhdr->seq;
+		right = tcpqhdr->nxt;
+		have_block = 1;
+	}
+	if ( have_block )
+		count = tcp_sack_add ( tcp, sack, count, left, right );
+
+	return count;
+}
+
 /**
  * Transmit any outstanding data
  *
@@ -395,13 +496,21 @@ static int tcp_xmit ( struct tcp_connection *tcp, int force_send ) {
 	struct io_buffer *iobuf;
 	struct tcp_header *tcphdr;
 	struct tcp_mss_option *mssopt;
+	struct tcp_window_scale_padded_option *wsopt;
+	struct tcp_sack_permitted_padded_option *spopt;
 	struct tcp_timestamp_padded_option *tsopt;
+	struct tcp_sack_padded_option *sackopt;
+	struct tcp_sack_block sack[TCP_SACK_MAX];
+	struct tcp_sack_block *block;
+	unsigned int sack_count = 0;
+	unsigned int i;
 	void *payload;
 	unsigned int flags;
 	size_t len = 0;
 	uint32_t seq_len;
 	uint32_t app_win;
 	uint32_t max_rcv_win;
+	uint32_t win;
 	int rc;
 
 	/* If retransmission timer is already running, do nothing */
@@ -437,29 +546,39 @@ static int tcp_xmit ( struct tcp_connection *tcp, int force_send ) {
 		start_timer ( &tcp->timer );
 
 	/* Allocate I/O buffer */
-	iobuf = alloc_iob ( len + MAX_HDR_LEN );
+	iobuf = alloc_iob ( len + MAX_HDR_LEN + TCP_MAX_OPTIONS_LEN );
 	if ( ! iobuf ) {
 		DBGC ( tcp, "TCP %p could not allocate iobuf for %08x..%08x "
 		       "%08x\n", tcp, tcp->snd_seq, ( tcp->snd_seq + seq_len ),
 		       tcp->rcv_ack );
 		return -ENOMEM;
 	}
-	iob_reserve ( iobuf, MAX_HDR_LEN );
+	iob_reserve ( iobuf, MAX_HDR_LEN + TCP_MAX_OPTIONS_LEN );
 
 	/* Fill data payload from transmit queue */
 	tcp_process_queue ( tcp, len, iobuf, 0 );
 
-	/* Expand receive window if possible */
-	max_rcv_win = ( ( freemem * 3 ) / 4 );
+	/* Expand receive window if possible.  Allow for the overhead
+	 * of holding a whole window of out-of-order segments, each in
+	 * its own I/O buffer.
+	 */
+	max_rcv_win = ( freemem / 2 );
 	if ( max_rcv_win > TCP_MAX_WINDOW_SIZE )
 		max_rcv_win = TCP_MAX_WINDOW_SIZE;
+	if ( max_rcv_win > ( 0xffffUL << tcp->rcv_win_scale ) )
+		max_rcv_win = ( 0xffffUL << tcp->rcv_win_scale );
 	app_win = xfer_window ( &tcp->xfer );
 	if ( max_rcv_win > app_win )
 		max_rcv_win = app_win;
 	max_rcv_win &= ~0x03; /* Keep everything dword-aligned */
+	max_rcv_win &= ~( ( 1UL << tcp->rcv_win_scale ) - 1 );
 	if ( tcp->rcv_win < max_rcv_win )
 		tcp->rcv_win = max_rcv_win;
 
+	/* Describe any holes in what we have received */
+	if ( tcp->sack_permitted && ! ( flags & TCP_SYN ) )
+		sack_count = tcp_sack ( tcp, sack );
+
 	/* Fill up the TCP header */
 	payload = iobuf->data;
 	if ( flags & TCP_SYN ) {
@@ -467,6 +586,15 @@ static int tcp_xmit ( struct tcp_connection *tcp, int force_send ) {
 		mssopt->kind = TCP_OPTION_MSS;
 		mssopt->length = sizeof ( *mssopt );
 		mssopt->mss = htons ( TCP_MSS );
+		wsopt = iob_push ( iobuf, sizeof ( *wsopt ) );
+		wsopt->nop[0] = TCP_OPTION_NOP;
+		wsopt->wsopt.kind = TCP_OPTION_WS;
+		wsopt->wsopt.length = sizeof ( wsopt->wsopt );
+		wsopt->wsopt.scale = TCP_RX_WINDOW_SCALE;
+		spopt = iob_push ( iobuf, sizeof ( *spopt ) );
+		memset ( spopt->nop, TCP_OPTION_NOP, sizeof ( spopt->nop ) );
+		spopt->spopt.kind = TCP_OPTION_SACK_PERMITTED;
+		spopt->spopt.length = sizeof ( spopt->spopt );
 	}
 	if ( ( flags & TCP_SYN ) || tcp->timestamps ) {
 		tsopt = iob_push ( iobuf, sizeof ( *tsopt ) );
@@ -476,8 +604,30 @@ static int tcp_xmit ( struct tcp_connection *tcp, int force_send ) {
 		tsopt->tsopt.tsval = ntohl ( currticks() );
 		tsopt->tsopt.tsecr = ntohl ( tcp->ts_recent );
 	}
+	if ( sack_count ) {
+		block = iob_push ( iobuf, ( sack_count * sizeof ( *block ) ) );
+		for ( i = 0 ; i < sack_count ; i++ ) {
+			block[i].left = htonl ( sack[i].left );
+			block[i].right = htonl ( sack[i].right );
+		}
+		sackopt = iob_push ( iobuf, sizeof ( *sackopt ) );
+		memset ( sackopt->nop, TCP_OPTION_NOP, sizeof ( sackopt->nop ) );
+		sackopt->kind = TCP_OPTION_SACK;
+		sackopt->length = ( sizeof ( *sackopt ) - sizeof ( sackopt->nop ) +
+				    ( sack_count * sizeof ( *block ) ) );
+	}
 	if ( ! ( flags & TCP_SYN ) )
 		flags |= TCP_PSH;
+
+	/* The window in a SYN is never scaled */
+	if ( flags & TCP_SYN ) {
+		win = tcp->rcv_win;
+	} else {
+		win = ( tcp->rcv_win >> tcp->rcv_win_scale );
+	}
+	if ( win > 0xffff )
+		win = 0xffff;
+
 	tcphdr = iob_push ( iobuf, sizeof ( *tcphdr ) );
 	memset ( tcphdr, 0, sizeof ( *tcphdr ) );
 	tcphdr->src = tcp->local_port;
@@ -486,7 +636,7 @@ static int tcp_xmit ( struct tcp_connection *tcp, int force_send ) {
 	tcphdr->ack = htonl ( tcp->rcv_ack );
 	tcphdr->hlen = ( ( payload - iobuf->data ) << 2 );
 	tcphdr->flags = flags;
-	tcphdr->win = htons ( tcp->rcv_win );
+	tcphdr->win = htons ( win );
 	tcphdr->csum = tcpip_chksum ( iobuf->data, iob_len ( iobuf ) );
 
 	/* Dump header */
@@ -578,7 +728,7 @@ static int tcp_xmit_reset ( struct tcp_connection *tcp,
 	tcphdr->ack = in_tcphdr->seq;
 	tcphdr->hlen = ( ( sizeof ( *tcphdr ) / 4 ) << 4 );
 	tcphdr->flags = ( TCP_RST | TCP_ACK );
-	tcphdr->win = htons ( TCP_MAX_WINDOW_SIZE );
+	tcphdr->win = htons ( 0 );
 	tcphdr->csum = tcpip_chksum ( iobuf->data, iob_len ( iobuf ) );
 
 	/* Dump header */
@@ -649,6 +799,13 @@ static void tcp_rx_opts ( struct tcp_connection *tcp, const void *data,
 			data++;
 			continue;
 		}
+		if ( ( ( data + sizeof ( *option ) ) > end ) ||
+		     ( option->length < sizeof ( *option ) ) ||
+		     ( ( data + option->length ) > end ) ) {
+			DBGC ( tcp, "TCP %p received malformed option %d\n",
+			       tcp, kind );
+			return;
+		}
 		switch ( kind ) {
 		case TCP_OPTION_MSS:
 			options->mssopt = data;
@@ -656,6 +813,18 @@ static void tcp_rx_opts ( struct tcp_connection *tcp, const void *data,
 		case TCP_OPTION_TS:
 			options->tsopt = data;
 			break;
+		case TCP_OPTION_WS:
+			options->wsopt = data;
+			break;
+		case TCP_OPTION_SACK_PERMITTED:
+			options->spopt = data;
+			break;
+		case TCP_OPTION_SACK:
+			/* We never have more than one segment in
+			 * flight, so there is nothing to gain from
+			 * the peer's SACK blocks.
+			 */
+			break;
 		default:
 			DBGC ( tcp, "TCP %p received unknown option %d\n",
 			       tcp, kind );
@@ -696,6 +865,18 @@ static int tcp_rx_syn ( struct tcp_connection *tcp, uint32_t seq,
 		tcp->rcv_ack = seq;
 		if ( options->tsopt )
 			tcp->timestamps = 1;
+		if ( options->spopt )
+			tcp->sack_permitted = 1;
+
+		/* Window scaling is used in both directions only if
+		 * both ends ask for it.
+		 */
+		if ( options->wsopt ) {
+			tcp->snd_win_scale = options->wsopt->scale;
+			if ( tcp->snd_win_scale > TCP_MAX_WINDOW_SCALE )
+				tcp->snd_win_scale = TCP_MAX_WINDOW_SCALE;
+			tcp->rcv_win_scale = TCP_RX_WINDOW_SCALE;
+		}
 	}
 
 	/* Ignore duplicate SYN */
@@ -799,7 +980,7 @@ static int tcp_rx_data ( struct tcp_connection *tcp, uint32_t seq,
 	uint32_t len;
 	int rc;
 
-	/* Ignore duplicate or out-of-order data */
+	/* Ignore any part of the data we already have */
 	already_rcvd = ( tcp->rcv_ack - seq );
 	len = iob_len ( iobuf );
 	if ( already_rcvd >= len ) {
@@ -876,6 +1057,115 @@ static int tcp_rx_rst ( struct tcp_connection *tcp, uint32_t seq ) {
 	return -ECONNRESET;
 }
 
+/**
+ * Add received segment to receive queue
+ *
+ * @v tcp		TCP connection
+ * @v seq		SEQ value (in host-endian order)
+ * @v flags		TCP flags
+ * @v iobuf		I/O buffer
+ *
+ * This function takes ownership of the I/O buffer.
+ */
+static void tcp_rx_enqueue ( struct tcp_connection *tcp, uint32_t seq,
+			     unsigned int flags, struct io_buffer *iobuf ) {
+	struct tcp_rx_queued_header *tcpqhdr;
+	struct tcp_rx_queued_header *queued_hdr;
+	struct io_buffer *queued;
+	uint32_t nxt;
+
+	/* SYN has already been handled; only FIN remains */
+	flags &= TCP_FIN;
+	nxt = ( seq + iob_len ( iobuf ) + ( flags ? 1 : 0 ) );
+
+	/* Discard immediately (to save memory) if
+	 *
+	 *  a) we have not yet received a SYN, and so have nothing to
+	 *     compare sequence numbers against, or
+	 *  b) the segment consumes no sequence space, or
+	 *  c) we already have all of it, or
+	 *  d) it is out of order and starts beyond the receive window
+	 */
+	if ( ( ! ( tcp->tcp_state & TCP_STATE_RCVD ( TCP_SYN ) ) ) ||
+	     ( seq == nxt ) ||
+	     ( tcp_cmp ( nxt, tcp->rcv_ack ) <= 0 ) ||
+	     ( ( tcp_cmp ( seq, tcp->rcv_ack ) > 0 ) &&
+	       ( ( seq - tcp->rcv_ack ) >= tcp->rcv_win ) ) ) {
+		free_iob ( iobuf );
+		return;
+	}
+
+	/* Find position in queue, discarding exact duplicates of
+	 * segments we are already holding.
+	 */
+	list_for_each_entry ( queued, &tcp->rx_queue, list ) {
+		queued_hdr = queued->data;
+		if ( tcp_cmp ( seq, queued_hdr->seq ) < 0 )
+			break;
+		if ( ( seq == queued_hdr->seq ) &&
+		     ( tcp_cmp ( nxt, queued_hdr->nxt ) <= 0 ) ) {
+			free_iob ( iobuf );
+			return;
+		}
+	}
+
+	/* Add internal header and insert before the first segment
+	 * which starts later than this one.
+	 */
+	tcpqhdr = iob_push ( iobuf, sizeof ( *tcpqhdr ) );
+	tcpqhdr->seq = seq;
+	tcpqhdr->nxt = nxt;
+	tcpqhdr->flags = flags;
+	list_add_tail ( &iobuf->list, &queued->list );
+
+	/* Remember where the latest out-of-order segment went */
+	if ( tcp_cmp ( seq, tcp->rcv_ack ) > 0 ) {
+		DBGC2 ( tcp, "TCP %p queued out-of-order %08x..%08x\n",
+			tcp, seq, nxt );
+		tcp->rcv_sack = seq;
+	}
+}
+
+/**
+ * Process receive queue
+ *
+ * @v tcp		TCP connection
+ *
+ * Handles any segments which are now in sequence.
+ */
+static void tcp_process_rx_queue ( struct tcp_connection *tcp ) {
+	struct io_buffer *iobuf;
+	struct tcp_rx_queued_header *tcpqhdr;
+	uint32_t seq;
+	unsigned int flags;
+	size_t len;
+
+	while ( ! list_empty ( &tcp->rx_queue ) ) {
+
+		/* Stop at the first gap */
+		iobuf = list_entry ( tcp->rx_queue.next, struct io_buffer,
+				     list );
+		tcpqhdr = iobuf->data;
+		if ( tcp_cmp ( tcpqhdr->seq, tcp->rcv_ack ) > 0 )
+			break;
+
+		/* Remove from queue and strip internal header */
+		list_del ( &iobuf->list );
+		seq = tcpqhdr->seq;
+		flags = tcpqhdr->flags;
+		iob_pull ( iobuf, sizeof ( *tcpqhdr ) );
+		len = iob_len ( iobuf );
+
+		/* Handle new data, if any */
+		tcp_rx_data ( tcp, seq, iobuf );
+		seq += len;
+
+		/* Handle FIN, if present */
+		if ( flags & TCP_FIN )
+			tcp_rx_fin ( tcp, seq );
+	}
+}
+
 /**
  * Process received packet
  *
@@ -958,6 +1248,10 @@ static int tcp_rx ( struct io_buffer *iobuf,
 		goto discard;
 	}
 
+	/* The window in a SYN is never scaled */
+	if ( ! ( flags & TCP_SYN ) )
+		win <<= tcp->snd_win_scale;
+
 	/* Handle ACK, if present */
 	if ( flags & TCP_ACK ) {
 		if ( ( rc = tcp_rx_ack ( tcp, ack, win ) ) != 0 ) {
@@ -978,20 +1272,17 @@ static int tcp_rx ( struct io_buffer *iobuf,
 			goto discard;
 	}
 
-	/* Handle new data, if any */
-	tcp_rx_data ( tcp, seq, iobuf );
-	seq += len;
-
-	/* Handle FIN, if present */
-	if ( flags & TCP_FIN ) {
-		tcp_rx_fin ( tcp, seq );
-		seq++;
-	}
-
 	/* Update timestamp, if present and applicable */
-	if ( ( seq == tcp->rcv_ack ) && options.tsopt )
+	if ( ( tcp_cmp ( seq, tcp->rcv_ack ) <= 0 ) && options.tsopt )
 		tcp->ts_recent = ntohl ( options.tsopt->tsval );
 
+	/* Queue data and FIN, and handle whatever is now in sequence */
+	tcp_rx_enqueue ( tcp, seq, flags, iob_disown ( iobuf ) );
+	tcp_process_rx_queue ( tcp );
+	seq += len;
+	if ( flags & TCP_FIN )
+		seq++;
+
 	/* Dump out any state change as a result of the received packet */
 	tcp_dump_state ( tcp );
 
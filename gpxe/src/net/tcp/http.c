@@ -33,6 +33,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #include <byteswap.h>
 #include <errno.h>
 #include <assert.h>
+#include <gpxe/list.h>
 #include <gpxe/uri.h>
 #include <gpxe/refcnt.h>
 #include <gpxe/iobuf.h>
@@ -44,6 +45,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #include <gpxe/linebuf.h>
 #include <gpxe/features.h>
 #include <gpxe/base64.h>
+#include <gpxe/init.h>
 #include <gpxe/http.h>
 
 FEATURE ( FEATURE_PROTOCOL, "HTTP", DHCP_EB_FEATURE_HTTP, 1 );
@@ -53,9 +55,86 @@ enum http_rx_state {
 	HTTP_RX_RESPONSE = 0,
 	HTTP_RX_HEADER,
 	HTTP_RX_DATA,
+	HTTP_RX_CHUNK_LEN,
+	HTTP_RX_TRAILER,
 	HTTP_RX_DEAD,
 };
 
+/** HTTP request flags */
+enum http_request_flags {
+	/** Request has been sent */
+	HTTP_TX_SENT = 0x0001,
+	/** Response has a Content-Length */
+	HTTP_CONTENT_LENGTH = 0x0002,
+	/** Server will keep the connection open after this response */
+	HTTP_KEEPALIVE = 0x0004,
+	/** Response is HTTP/1.1 or later */
+	HTTP_VERSION_1_1 = 0x0008,
+	/** Data transfer interface has been closed */
+	HTTP_XFER_CLOSED = 0x0010,
+	/** Response uses chunked transfer encoding */
+	HTTP_CHUNKED = 0x0020,
+	/** Request asks for the rest of an interrupted response */
+	HTTP_RESUME = 0x0040,
+	/** Response has a Content-Range starting where we asked */
+	HTTP_CONTENT_RANGE = 0x0080,
+};
+
+/** HTTP connection flags */
+enum http_connection_flags {
+	/** Connection may be used for further requests */
+	HTTP_CONN_KEEPALIVE = 0x0001,
+	/** Further requests may be sent before earlier responses arrive */
+	HTTP_CONN_PIPELINE = 0x0002,
+	/** Connection has been closed */
+	HTTP_CONN_CLOSED = 0x0004,
+};
+
+/** Maximum number of requests outstanding on one connection */
+#define HTTP_MAX_PIPELINE 4
+
+/** Longest unwanted response body worth reading to keep a connection */
+#define HTTP_DRAIN_MAX 4096
+
+/**
+ * An HTTP connection
+ *
+ * A connection carries one or more requests to the same server, in
+ * order.  Once a response has told us that the server will keep the
+ * connection open, the connection is left in a pool when it goes
+ * idle, and later requests to the same server reuse it rather than
+ * paying for a new TCP handshake (and DNS lookup, and TLS
+ * negotiation).  If the server also speaks HTTP/1.1, requests are
+ * pipelined: they are sent without waiting for earlier responses.
+ */
+struct http_connection {
+	/** Reference count */
+	struct refcnt refcnt;
+	/** List of open connections */
+	struct list_head list;
+	/** Transport layer interface */
+	struct xfer_interface socket;
+	/** TX process */
+	struct process process;
+
+	/** Server host name */
+	char *host;
+	/** Server port */
+	unsigned int port;
+	/** Socket filter, or NULL */
+	int ( * filter ) ( struct xfer_interface *xfer,
+			   struct xfer_interface **next );
+
+	/** Requests, in the order they are sent */
+	struct list_head requests;
+	/** Number of requests on the request list */
+	unsigned int pending;
+	/** Number of responses received in full */
+	unsigned int responses;
+	/** Flags */
+	unsigned int flags;
+};
+
 /**
  * An HTTP request
  *
@@ -68,24 +147,49 @@ struct http_request {
 
 	/** URI being fetched */
 	struct uri *uri;
-	/** Transport layer interface */
-	struct xfer_interface socket;
-
-	/** TX process */
-	struct process process;
-
+	/** Server port */
+	unsigned int port;
+	/** Socket filter, or NULL */
+	int ( * filter ) ( struct xfer_interface *xfer,
+			   struct xfer_interface **next );
+	/** Connection carrying this request, or NULL */
+	struct http_connection *conn;
+	/** List of requests on the connection */
+	struct list_head list;
+
+	/** Flags */
+	unsigned int flags;
 	/** HTTP response code */
 	unsigned int response;
-	/** HTTP Content-Length */
+	/** HTTP Content-Length
+	 *
+	 * For a resumed request, this includes the part of the
+	 * response received before the resume.
+	 */
 	size_t content_length;
 	/** Received length */
 	size_t rx_len;
+	/** Remaining length of current chunk */
+	size_t chunk_len;
+	/** Offset requested by Range header */
+	size_t range_start;
+	/** Error which caused the request to be resumed */
+	int resume_rc;
+	/** Strong entity tag of the response, or NULL */
+	char *etag;
+	/** Last-Modified date of the response, or NULL */
+	char *last_modified;
 	/** RX state */
 	enum http_rx_state rx_state;
 	/** Line buffer for received header lines */
 	struct line_buffer linebuf;
 };
 
+/** Open HTTP connections */
+static LIST_HEAD ( http_connections );
+
+static int http_connect ( struct http_request *http, int reuse );
+
 /**
  * Free HTTP request
  *
@@ -97,9 +201,91 @@ static void http_free ( struct refcnt *refcnt ) {
 
 	uri_put ( http->uri );
 	empty_line_buffer ( &http->linebuf );
+	free ( http->etag );
+	free ( http->last_modified );
 	free ( http );
 };
 
+/**
+ * Free HTTP connection
+ *
+ * @v refcnt		Reference counter
+ */
+static void http_conn_free ( struct refcnt *refcnt ) {
+	struct http_connection *conn =
+		container_of ( refcnt, struct http_connection, refcnt );
+
+	free ( conn->host );
+	free ( conn );
+}
+
+/**
+ * Queue HTTP request on a connection
+ *
+ * @v http		HTTP request
+ * @v conn		HTTP connection
+ */
+static void http_attach ( struct http_request *http,
+			  struct http_connection *conn ) {
+
+	DBGC ( http, "HTTP %p using connection %p (%d pending)\n",
+	       http, conn, conn->pending );
+	list_add_tail ( &http->list, &conn->requests );
+	ref_get ( &http->refcnt );
+	ref_get ( &conn->refcnt );
+	http->conn = conn;
+	conn->pending++;
+
+	/* Kick TX process to send the request */
+	process_add ( &conn->process );
+}
+
+/**
+ * Remove HTTP request from its connection
+ *
+ * @v http		HTTP request
+ *
+ * This drops the connection's reference to the request, which may
+ * free it.
+ */
+static void http_detach ( struct http_request *http ) {
+	struct http_connection *conn = http->conn;
+
+	list_del ( &http->list );
+	conn->pending--;
+	http->conn = NULL;
+	ref_put ( &conn->refcnt );
+	ref_put ( &http->refcnt );
+}
+
+/**
+ * Close HTTP data transfer interface
+ *
+ * @v http		HTTP request
+ * @v rc		Return status code
+ *
+ * The request stays on its connection, to keep our place in the
+ * stream.  If much of its response is still to come, the
+ * connection's TX process drops the connection when it gets there
+ * (see http_conn_step()).
+ */
+static void http_finish ( struct http_request *http, int rc ) {
+	struct http_connection *conn = http->conn;
+
+	if ( http->flags & HTTP_XFER_CLOSED )
+		return;
+	http->flags |= HTTP_XFER_CLOSED;
+
+	xfer_nullify ( &http->xfer );
+	xfer_close ( &http->xfer, rc );
+
+	/* Let the connection check whether its next response is
+	 * still wanted
+	 */
+	if ( conn && ! ( conn->flags & HTTP_CONN_CLOSED ) )
+		process_add ( &conn->process );
+}
+
 /**
  * Mark HTTP request as complete
  *
@@ -114,21 +300,158 @@ static void http_done ( struct http_request *http, int rc ) {
 	/* If we had a Content-Length, and the received content length
 	 * isn't correct, flag an error
 	 */
-	if ( http->content_length &&
+	if ( ( http->flags & HTTP_CONTENT_LENGTH ) &&
 	     ( http->content_length != http->rx_len ) ) {
 		DBGC ( http, "HTTP %p incorrect length %zd, should be %zd\n",
 		       http, http->rx_len, http->content_length );
 		rc = -EIO;
 	}
 
+	/* Close data transfer interface */
+	http_finish ( http, rc );
+
+	/* Remove from connection.  This may free the request. */
+	if ( http->conn )
+		http_detach ( http );
+}
+
+/**
+ * Resend HTTP request on a new connection
+ *
+ * @v http		HTTP request
+ */
+static void http_retry ( struct http_request *http ) {
+	int rc;
+
+	DBGC ( http, "HTTP %p retrying on new connection\n", http );
+
+	/* Keep request alive while it has no connection */
+	ref_get ( &http->refcnt );
+	http_detach ( http );
+	http->flags &= ~HTTP_TX_SENT;
+	if ( ( rc = http_connect ( http, 0 ) ) != 0 )
+		http_done ( http, rc );
+	ref_put ( &http->refcnt );
+}
+
+/**
+ * Check whether an interrupted HTTP response can be resumed
+ *
+ * @v http		HTTP request
+ * @ret resumable	Response can be resumed
+ *
+ * We need to be able to tell where the response ends, and a
+ * validator to make sure that the rest of it comes from the same
+ * entity.  Each attempt must make some progress, so that a server
+ * which always drops the connection can't keep us here forever.
+ */
+static int http_can_resume ( struct http_request *http ) {
+
+	if ( http->flags & HTTP_XFER_CLOSED )
+		return 0;
+	if ( ( http->rx_state != HTTP_RX_DATA ) &&
+	     ( http->rx_state != HTTP_RX_CHUNK_LEN ) )
+		return 0;
+	if ( ! ( http->flags & ( HTTP_CONTENT_LENGTH | HTTP_CHUNKED ) ) )
+		return 0;
+	if ( ! ( http->etag || http->last_modified ) )
+		return 0;
+	return ( http->rx_len > http->range_start );
+}
+
+/**
+ * Request the rest of an interrupted HTTP response
+ *
+ * @v http		HTTP request
+ * @v rc		Reason for interruption
+ *
+ * The request is sent again with a Range header starting at the
+ * first byte we don't have.  If the server can't honour it, the
+ * request fails with the original error.
+ */
+static void http_resume ( struct http_request *http, int rc ) {
+
+	DBGC ( http, "HTTP %p resuming at %zd: %s\n",
+	       http, http->rx_len, strerror ( rc ) );
+
+	/* Keep request alive while it has no connection */
+	ref_get ( &http->refcnt );
+	http_detach ( http );
+	http->flags = HTTP_RESUME;
+	http->rx_state = HTTP_RX_RESPONSE;
+	empty_line_buffer ( &http->linebuf );
+	http->content_length = 0;
+	http->chunk_len = 0;
+	http->range_start = http->rx_len;
+	http->resume_rc = ( rc ? rc : -ECONNRESET );
+	if ( ( rc = http_connect ( http, 1 ) ) != 0 )
+		http_done ( http, rc );
+	ref_put ( &http->refcnt );
+}
+
+/**
+ * Close HTTP connection
+ *
+ * @v conn		HTTP connection
+ * @v rc		Reason for close
+ *
+ * A response with neither a Content-Length nor chunked encoding ends
+ * when the connection does.  Requests which have not had any of their
+ * response yet are sent again on a new connection, unless this was
+ * the first request on a new connection: the server may have timed
+ * out an idle connection, or may not keep pipelined requests.  A
+ * response which was cut off part way through is resumed if
+ * possible.
+ */
+static void http_conn_close ( struct http_connection *conn, int rc ) {
+	struct http_request *http;
+	struct http_request *tmp;
+	int first = 1;
+	int retry;
+
+	if ( conn->flags & HTTP_CONN_CLOSED )
+		return;
+	conn->flags |= HTTP_CONN_CLOSED;
+
+	/* Detaching the last request may otherwise free us */
+	ref_get ( &conn->refcnt );
+
+	DBGC ( conn, "HTTP %p closing after %d responses: %s\n",
+	       conn, conn->responses, strerror ( rc ) );
+
+	/* Remove from pool */
+	list_del ( &conn->list );
+
 	/* Remove process */
-	process_del ( &http->process );
+	process_del ( &conn->process );
+
+	/* Close socket */
+	xfer_nullify ( &conn->socket );
+	xfer_close ( &conn->socket, rc );
+
+	/* Complete, fail or resend outstanding requests */
+	list_for_each_entry_safe ( http, tmp, &conn->requests, list ) {
+		retry = ( ( http->rx_state == HTTP_RX_RESPONSE ) &&
+			  ( http->linebuf.len == 0 ) &&
+			  ! ( http->flags & HTTP_XFER_CLOSED ) &&
+			  ( conn->responses || ! first ) );
+		first = 0;
+
+		if ( retry ) {
+			http_retry ( http );
+		} else if ( ( ( http->rx_state == HTTP_RX_DATA ) &&
+			      ! ( http->flags & ( HTTP_CONTENT_LENGTH |
+						  HTTP_CHUNKED ) ) ) ||
+			    ( http->rx_state == HTTP_RX_TRAILER ) ) {
+			http_done ( http, rc );
+		} else if ( http_can_resume ( http ) ) {
+			http_resume ( http, rc );
+		} else {
+			http_done ( http, ( rc ? rc : -ECONNRESET ) );
+		}
+	}
 
-	/* Close all data transfer interfaces */
-	xfer_nullify ( &http->socket );
-	xfer_close ( &http->socket, rc );
-	xfer_nullify ( &http->xfer );
-	xfer_close ( &http->xfer, rc );
+	ref_put ( &conn->refcnt );
 }
 
 /**
@@ -171,13 +494,29 @@ static int http_rx_response ( struct http_request *http, char *response ) {
 	if ( strncmp ( response, "HTTP/", 5 ) != 0 )
 		return -EIO;
 
+	/* HTTP/1.1 connections stay open unless the server says not */
+	if ( strncmp ( response, "HTTP/1.0", 8 ) != 0 )
+		http->flags |= ( HTTP_VERSION_1_1 | HTTP_KEEPALIVE );
+
 	/* Locate and check response code */
 	spc = strchr ( response, ' ' );
 	if ( ! spc )
 		return -EIO;
 	http->response = strtoul ( spc, NULL, 10 );
-	if ( ( rc = http_response_to_rc ( http->response ) ) != 0 )
-		return rc;
+	if ( http->flags & HTTP_RESUME ) {
+		/* Anything but the partial content we asked for is
+		 * no use to us.
+		 */
+		rc = ( ( http->response == 206 ) ? 0 : http->resume_rc );
+	} else {
+		rc = http_response_to_rc ( http->response );
+	}
+	if ( rc != 0 ) {
+		/* Fail the download, but keep reading a short response
+		 * so that the connection can still be reused.
+		 */
+		http_finish ( http, rc );
+	}
 
 	/* Move to received headers */
 	http->rx_state = HTTP_RX_HEADER;
@@ -194,13 +533,17 @@ static int http_rx_response ( struct http_request *http, char *response ) {
 static int http_rx_location ( struct http_request *http, const char *value ) {
 	int rc;
 
+	/* Nothing to redirect if the download has been abandoned */
+	if ( http->flags & HTTP_XFER_CLOSED )
+		return 0;
+
 	/* Redirect to new location */
 	DBGC ( http, "HTTP %p redirecting to %s\n", http, value );
 	if ( ( rc = xfer_redirect ( &http->xfer, LOCATION_URI_STRING,
 				    value ) ) != 0 ) {
 		DBGC ( http, "HTTP %p could not redirect: %s\n",
 		       http, strerror ( rc ) );
-		return rc;
+		http_finish ( http, rc );
 	}
 
 	return 0;
@@ -223,6 +566,15 @@ static int http_rx_content_length ( struct http_request *http,
 		       http, value );
 		return -EIO;
 	}
+	http->flags |= HTTP_CONTENT_LENGTH;
+
+	/* A partial response covers only the part we don't have, and
+	 * the recipient already knows the filesize.
+	 */
+	if ( http->flags & HTTP_RESUME ) {
+		http->content_length += http->range_start;
+		return 0;
+	}
 
 	/* Use seek() to notify recipient of filesize */
 	xfer_seek ( &http->xfer, http->content_length, SEEK_SET );
@@ -231,6 +583,126 @@ static int http_rx_content_length ( struct http_request *http,
 	return 0;
 }
 
+/**
+ * Handle HTTP Connection header
+ *
+ * @v http		HTTP request
+ * @v value		HTTP header value
+ * @ret rc		Return status code
+ */
+static int http_rx_connection ( struct http_request *http,
+				const char *value ) {
+
+	if ( strcasecmp ( value, "close" ) == 0 ) {
+		http->flags &= ~HTTP_KEEPALIVE;
+	} else if ( strcasecmp ( value, "keep-alive" ) == 0 ) {
+		http->flags |= HTTP_KEEPALIVE;
+	}
+
+	return 0;
+}
+
+/**
+ * Handle HTTP Transfer-Encoding header
+ *
+ * @v http		HTTP request
+ * @v value		HTTP header value
+ * @ret rc		Return status code
+ */
+static int http_rx_transfer_encoding ( struct http_request *http,
+				       const char *value ) {
+
+	if ( strcasecmp ( value, "chunked" ) == 0 ) {
+		http->flags |= HTTP_CHUNKED;
+	} else if ( strcasecmp ( value, "identity" ) != 0 ) {
+		DBGC ( http, "HTTP %p unsupported Transfer-Encoding \"%s\"\n",
+		       http, value );
+		return -ENOTSUP;
+	}
+
+	return 0;
+}
+
+/**
+ * Handle HTTP Content-Range header
+ *
+ * @v http		HTTP request
+ * @v value		HTTP header value
+ * @ret rc		Return status code
+ */
+static int http_rx_content_range ( struct http_request *http,
+				   const char *value ) {
+	unsigned long start;
+	char *endp;
+
+	if ( ! ( http->flags & HTTP_RESUME ) )
+		return 0;
+
+	/* Expect "bytes <start>-<end>/<total>" */
+	if ( strncmp ( value, "bytes ", 6 ) != 0 )
+		goto err;
+	start = strtoul ( ( value + 6 ), &endp, 10 );
+	if ( ( *endp != '-' ) || ( start != http->range_start ) )
+		goto err;
+	http->flags |= HTTP_CONTENT_RANGE;
+	return 0;
+
+ err:
+	DBGC ( http, "HTTP %p unexpected Content-Range \"%s\"\n",
+	       http, value );
+	http_finish ( http, http->resume_rc );
+	return 0;
+}
+
+/**
+ * Record HTTP response validator
+ *
+ * @v http		HTTP request
+ * @v validator		Validator to fill in
+ * @v value		HTTP header value
+ * @ret rc		Return status code
+ */
+static int http_rx_validator ( struct http_request *http, char **validator,
+			       const char *value ) {
+
+	/* Only the original response describes the entity we want */
+	if ( http->flags & HTTP_RESUME )
+		return 0;
+
+	free ( *validator );
+	*validator = strdup ( value );
+	if ( ! *validator )
+		return -ENOMEM;
+	return 0;
+}
+
+/**
+ * Handle HTTP ETag header
+ *
+ * @v http		HTTP request
+ * @v value		HTTP header value
+ * @ret rc		Return status code
+ */
+static int http_rx_etag ( struct http_request *http, const char *value ) {
+
+	/* If-Range can't use weak entity tags */
+	if ( strncmp ( value, "W/", 2 ) == 0 )
+		return 0;
+	return http_rx_validator ( http, &http->etag, value );
+}
+
+/**
+ * Handle HTTP Last-Modified header
+ *
+ * @v http		HTTP request
+ * @v value		HTTP header value
+ * @ret rc		Return status code
+ */
+static int http_rx_last_modified ( struct http_request *http,
+				   const char *value ) {
+	return http_rx_validator ( http, &http->last_modified, value );
+}
+
 /** An HTTP header handler */
 struct http_header_handler {
 	/** Name (e.g. "Content-Length") */
@@ -241,7 +713,7 @@ struct http_header_handler {
 	 * @v value	HTTP header value
 	 * @ret rc	Return status code
 	 *
-	 * If an error is returned, the download will be aborted.
+	 * If an error is returned, the connection will be closed.
 	 */
 	int ( * rx ) ( struct http_request *http, const char *value );
 };
@@ -256,9 +728,101 @@ static struct http_header_handler http_header_handlers[] = {
 		.header = "Content-Length",
 		.rx = http_rx_content_length,
 	},
+	{
+		.header = "Connection",
+		.rx = http_rx_connection,
+	},
+	{
+		.header = "Transfer-Encoding",
+		.rx = http_rx_transfer_encoding,
+	},
+	{
+		.header = "Content-Range",
+		.rx = http_rx_content_range,
+	},
+	{
+		.header = "ETag",
+		.rx = http_rx_etag,
+	},
+	{
+		.header = "Last-Modified",
+		.rx = http_rx_last_modified,
+	},
 	{ NULL, NULL }
 };
 
+/**
+ * Mark HTTP response as received in full
+ *
+ * @v http		HTTP request
+ */
+static void http_rx_done ( struct http_request *http ) {
+	struct http_connection *conn = http->conn;
+
+	conn->responses++;
+	http_done ( http, 0 );
+
+	/* If the server is going to close the connection, there's no
+	 * point waiting for it; anything queued behind this response
+	 * is sent again on a new connection.
+	 */
+	if ( ! ( conn->flags & HTTP_CONN_KEEPALIVE ) )
+		http_conn_close ( conn, 0 );
+}
+
+/**
+ * Handle end of HTTP headers
+ *
+ * @v http		HTTP request
+ */
+static void http_rx_headers_done ( struct http_request *http ) {
+	struct http_connection *conn = http->conn;
+
+	DBGC ( http, "HTTP %p start of data\n", http );
+	empty_line_buffer ( &http->linebuf );
+	http->rx_state = HTTP_RX_DATA;
+
+	/* Chunked encoding overrides any Content-Length */
+	if ( http->flags & HTTP_CHUNKED ) {
+		http->flags &= ~HTTP_CONTENT_LENGTH;
+		http->rx_state = HTTP_RX_CHUNK_LEN;
+	}
+
+	/* A resumed response must carry on exactly where the last one
+	 * left off.  Tell the recipient where that is.
+	 */
+	if ( http->flags & HTTP_RESUME ) {
+		if ( http->flags & HTTP_CONTENT_RANGE ) {
+			xfer_seek ( &http->xfer, http->rx_len, SEEK_SET );
+		} else {
+			http_finish ( http, http->resume_rc );
+		}
+	}
+
+	/* We can only find the end of the response, and so reuse the
+	 * connection, if we know the length of the response.
+	 */
+	if ( ( http->flags & HTTP_KEEPALIVE ) &&
+	     ( http->flags & ( HTTP_CONTENT_LENGTH | HTTP_CHUNKED ) ) ) {
+		conn->flags |= HTTP_CONN_KEEPALIVE;
+		if ( http->flags & HTTP_VERSION_1_1 )
+			conn->flags |= HTTP_CONN_PIPELINE;
+	} else {
+		conn->flags &= ~( HTTP_CONN_KEEPALIVE | HTTP_CONN_PIPELINE );
+	}
+
+	/* Now that we know how much is left, see whether an unwanted
+	 * response is worth reading
+	 */
+	if ( http->flags & HTTP_XFER_CLOSED )
+		process_add ( &conn->process );
+
+	/* There may be no data at all */
+	if ( ( http->flags & HTTP_CONTENT_LENGTH ) &&
+	     ( http->content_length == http->rx_len ) )
+		http_rx_done ( http );
+}
+
 /**
  * Handle HTTP header
  *
@@ -274,9 +838,7 @@ static int http_rx_header ( struct http_request *http, char *header ) {
 
 	/* An empty header line marks the transition to the data phase */
 	if ( ! header[0] ) {
-		DBGC ( http, "HTTP %p start of data\n", http );
-		empty_line_buffer ( &http->linebuf );
-		http->rx_state = HTTP_RX_DATA;
+		http_rx_headers_done ( http );
 		return 0;
 	}
 
@@ -302,6 +864,55 @@ static int http_rx_header ( struct http_request *http, char *header ) {
 	return 0;
 }
 
+/**
+ * Handle HTTP chunk length
+ *
+ * @v http		HTTP request
+ * @v length		Chunk length line
+ * @ret rc		Return status code
+ */
+static int http_rx_chunk_len ( struct http_request *http, char *length ) {
+	char *endp;
+
+	/* Skip the line break which ends the previous chunk */
+	if ( ! length[0] )
+		return 0;
+
+	/* Parse length, ignoring any chunk extensions */
+	http->chunk_len = strtoul ( length, &endp, 16 );
+	if ( ( endp == length ) ||
+	     ( ( *endp != '\0' ) && ( *endp != ';' ) &&
+	       ( *endp != ' ' ) && ( *endp != '\t' ) ) ) {
+		DBGC ( http, "HTTP %p invalid chunk length \"%s\"\n",
+		       http, length );
+		return -EIO;
+	}
+
+	/* A zero-length chunk marks the end of the data */
+	http->rx_state = ( http->chunk_len ? HTTP_RX_DATA : HTTP_RX_TRAILER );
+	return 0;
+}
+
+/**
+ * Handle HTTP trailer
+ *
+ * @v http		HTTP request
+ * @v trailer		HTTP trailer
+ * @ret rc		Return status code
+ */
+static int http_rx_trailer ( struct http_request *http, char *trailer ) {
+
+	/* Trailers end with an empty line, just like headers */
+	if ( trailer[0] ) {
+		DBGC ( http, "HTTP %p ignoring trailer \"%s\"\n",
+		       http, trailer );
+		return 0;
+	}
+
+	http_rx_done ( http );
+	return 0;
+}
+
 /** An HTTP line-based data handler */
 struct http_line_handler {
 	/** Handle line
@@ -317,6 +928,8 @@ struct http_line_handler {
 static struct http_line_handler http_line_handlers[] = {
 	[HTTP_RX_RESPONSE]	= { .rx = http_rx_response },
 	[HTTP_RX_HEADER]	= { .rx = http_rx_header },
+	[HTTP_RX_CHUNK_LEN]	= { .rx = http_rx_chunk_len },
+	[HTTP_RX_TRAILER]	= { .rx = http_rx_trailer },
 };
 
 /**
@@ -325,22 +938,32 @@ static struct http_line_handler http_line_handlers[] = {
  * @v http		HTTP request
  * @v iobuf		I/O buffer
  * @ret rc		Return status code
+ *
+ * The I/O buffer must not extend beyond the end of the response, or
+ * of the current chunk.
  */
 static int http_rx_data ( struct http_request *http,
 			  struct io_buffer *iobuf ) {
 	int rc;
 
-	/* Update received length */
+	/* Update received lengths */
 	http->rx_len += iob_len ( iobuf );
+	if ( http->flags & HTTP_CHUNKED )
+		http->chunk_len -= iob_len ( iobuf );
 
 	/* Hand off data buffer */
 	if ( ( rc = xfer_deliver_iob ( &http->xfer, iobuf ) ) != 0 )
 		return rc;
 
-	/* If we have reached the content-length, stop now */
-	if ( http->content_length &&
-	     ( http->rx_len >= http->content_length ) ) {
-		http_done ( http, 0 );
+	/* If we have reached the end of the chunk, look for the next
+	 * one; if we have reached the content-length, stop now.
+	 */
+	if ( http->flags & HTTP_CHUNKED ) {
+		if ( ! http->chunk_len )
+			http->rx_state = HTTP_RX_CHUNK_LEN;
+	} else if ( ( http->flags & HTTP_CONTENT_LENGTH ) &&
+		    ( http->rx_len >= http->content_length ) ) {
+		http_rx_done ( http );
 	}
 
 	return 0;
@@ -357,26 +980,65 @@ static int http_rx_data ( struct http_request *http,
 static int http_socket_deliver_iob ( struct xfer_interface *socket,
 				     struct io_buffer *iobuf,
 				     struct xfer_metadata *meta __unused ) {
-	struct http_request *http =
-		container_of ( socket, struct http_request, socket );
+	struct http_connection *conn =
+		container_of ( socket, struct http_connection, socket );
+	struct http_request *http;
 	struct http_line_handler *lh;
+	struct io_buffer *data;
 	char *line;
+	size_t remaining;
 	ssize_t len;
 	int rc = 0;
 
-	while ( iob_len ( iobuf ) ) {
-		switch ( http->rx_state ) {
-		case HTTP_RX_DEAD:
-			/* Do no further processing */
+	/* Closing the connection may drop the last reference to it */
+	ref_get ( &conn->refcnt );
+
+	while ( iobuf && iob_len ( iobuf ) ) {
+		if ( conn->flags & HTTP_CONN_CLOSED )
+			goto done;
+		if ( list_empty ( &conn->requests ) ) {
+			DBGC ( conn, "HTTP %p unexpected data\n", conn );
+			rc = -EIO;
 			goto done;
+		}
+		http = list_entry ( conn->requests.next, struct http_request,
+				    list );
+
+		switch ( http->rx_state ) {
 		case HTTP_RX_DATA:
 			/* Once we're into the data phase, just fill
-			 * the data buffer
+			 * the data buffer, up to the end of the
+			 * chunk or response.  Anything after that is
+			 * the next chunk length, or belongs to the
+			 * next response.
 			 */
-			rc = http_rx_data ( http, iob_disown ( iobuf ) );
-			goto done;
+			if ( http->flags & HTTP_CHUNKED ) {
+				remaining = http->chunk_len;
+			} else if ( http->flags & HTTP_CONTENT_LENGTH ) {
+				remaining = ( http->content_length -
+					      http->rx_len );
+			} else {
+				remaining = iob_len ( iobuf );
+			}
+			if ( iob_len ( iobuf ) > remaining ) {
+				data = alloc_iob ( remaining );
+				if ( ! data ) {
+					rc = -ENOMEM;
+					goto done;
+				}
+				memcpy ( iob_put ( data, remaining ),
+					 iobuf->data, remaining );
+				iob_pull ( iobuf, remaining );
+			} else {
+				data = iob_disown ( iobuf );
+			}
+			if ( ( rc = http_rx_data ( http, data ) ) != 0 )
+				goto done;
+			break;
 		case HTTP_RX_RESPONSE:
 		case HTTP_RX_HEADER:
+		case HTTP_RX_CHUNK_LEN:
+		case HTTP_RX_TRAILER:
 			/* In the other phases, buffer and process a
 			 * line at a time
 			 */
@@ -404,19 +1066,20 @@ static int http_socket_deliver_iob ( struct xfer_interface *socket,
 
  done:
 	if ( rc )
-		http_done ( http, rc );
+		http_conn_close ( conn, rc );
 	free_iob ( iobuf );
+	ref_put ( &conn->refcnt );
 	return rc;
 }
 
 /**
- * HTTP process
+ * Send HTTP request
  *
- * @v process		Process
+ * @v http		HTTP request
+ * @ret rc		Return status code
  */
-static void http_step ( struct process *process ) {
-	struct http_request *http =
-		container_of ( process, struct http_request, process );
+static int http_send ( struct http_request *http ) {
+	struct http_connection *conn = http->conn;
 	const char *host = http->uri->host;
 	const char *user = http->uri->user;
 	const char *password =
@@ -426,47 +1089,143 @@ static void http_step ( struct process *process ) {
 	size_t user_pw_base64_len = base64_encoded_len ( user_pw_len );
 	char user_pw[ user_pw_len + 1 /* NUL */ ];
 	char user_pw_base64[ user_pw_base64_len + 1 /* NUL */ ];
-	int rc;
 	int request_len = unparse_uri ( NULL, 0, http->uri,
 					URI_PATH_BIT | URI_QUERY_BIT );
+	char request[request_len + 1];
+	const char *validator =
+		( http->etag ? http->etag : http->last_modified );
+	char range[ ( validator ? strlen ( validator ) : 0 ) +
+		    64 /* "Range: bytes=<n>-" "If-Range: " */ ];
+
+	/* Construct path?query request */
+	unparse_uri ( request, sizeof ( request ), http->uri,
+		      URI_PATH_BIT | URI_QUERY_BIT );
+
+	/* Construct authorisation, if applicable */
+	if ( user ) {
+		/* Make "user:password" string from decoded fields */
+		snprintf ( user_pw, sizeof ( user_pw ), "%s:%s",
+			   user, password );
+
+		/* Base64-encode the "user:password" string */
+		base64_encode ( user_pw, user_pw_base64 );
+	}
+
+	/* Construct range, if resuming */
+	range[0] = '\0';
+	if ( http->flags & HTTP_RESUME ) {
+		snprintf ( range, sizeof ( range ),
+			   "Range: bytes=%zd-\r\nIf-Range: %s\r\n",
+			   http->range_start, validator );
+	}
 
-	if ( xfer_window ( &http->socket ) ) {
-		char request[request_len + 1];
+	http->flags |= HTTP_TX_SENT;
+
+	/* Send GET request */
+	return xfer_printf ( &conn->socket,
+			     "GET %s%s HTTP/1.1\r\n"
+			     "User-Agent: gPXE/" VERSION "\r\n"
+			     "%s%s%s"
+			     "%s"
+			     "Host: %s\r\n"
+			     "\r\n",
+			     http->uri->path ? "" : "/",
+			     request,
+			     ( user ? "Authorization: Basic " : "" ),
+			     ( user ? user_pw_base64 : "" ),
+			     ( user ? "\r\n" : "" ),
+			     range,
+			     host );
+}
+
+/**
+ * Check whether the rest of an unwanted HTTP response is worth reading
+ *
+ * @v http		HTTP request
+ * @ret drain		Read and discard the rest of the response
+ *
+ * Reading the rest of a short error page keeps the connection
+ * usable, but an abandoned download may have a very long way to go.
+ * We can't tell which until we have seen the headers.
+ */
+static int http_drain ( struct http_request *http ) {
+
+	switch ( http->rx_state ) {
+	case HTTP_RX_RESPONSE:
+	case HTTP_RX_HEADER:
+	case HTTP_RX_TRAILER:
+		return 1;
+	case HTTP_RX_DATA:
+		return ( ( http->flags & HTTP_CONTENT_LENGTH ) &&
+			 ( ( http->content_length - http->rx_len ) <=
+			   HTTP_DRAIN_MAX ) );
+	default:
+		return 0;
+	}
+}
 
-		/* Construct path?query request */
-		unparse_uri ( request, sizeof ( request ), http->uri,
-			      URI_PATH_BIT | URI_QUERY_BIT );
+/**
+ * Check whether HTTP connection carries an abandoned request
+ *
+ * @v conn		HTTP connection
+ * @ret abandoned	A request on the connection has been abandoned
+ *
+ * Such a connection may be about to be dropped, so it is no use for
+ * further requests.
+ */
+static int http_conn_abandoned ( struct http_connection *conn ) {
+	struct http_request *http;
 
-		/* We want to execute only once */
-		process_del ( &http->process );
+	list_for_each_entry ( http, &conn->requests, list ) {
+		if ( http->flags & HTTP_XFER_CLOSED )
+			return 1;
+	}
+	return 0;
+}
 
-		/* Construct authorisation, if applicable */
-		if ( user ) {
-			/* Make "user:password" string from decoded fields */
-			snprintf ( user_pw, sizeof ( user_pw ), "%s:%s",
-				   user, password );
+/**
+ * HTTP connection TX process
+ *
+ * @v process		Process
+ *
+ * Sends queued requests, one per step, as the socket allows.
+ */
+static void http_conn_step ( struct process *process ) {
+	struct http_connection *conn =
+		container_of ( process, struct http_connection, process );
+	struct http_request *http;
+	int rc;
 
-			/* Base64-encode the "user:password" string */
-			base64_encode ( user_pw, user_pw_base64 );
+	/* If nobody wants the response we are receiving any more,
+	 * drop the connection rather than read a long response just
+	 * to throw it away.  Requests queued behind it are sent again
+	 * on a new connection.
+	 */
+	if ( ! list_empty ( &conn->requests ) ) {
+		http = list_entry ( conn->requests.next, struct http_request,
+				    list );
+		if ( ( http->flags & HTTP_XFER_CLOSED ) &&
+		     ! http_drain ( http ) ) {
+			DBGC ( conn, "HTTP %p dropping response for %p\n",
+			       conn, http );
+			http_conn_close ( conn, 0 );
+			return;
 		}
+	}
 
-		/* Send GET request */
-		if ( ( rc = xfer_printf ( &http->socket,
-					  "GET %s%s HTTP/1.0\r\n"
-					  "User-Agent: gPXE/" VERSION "\r\n"
-					  "%s%s%s"
-					  "Host: %s\r\n"
-					  "\r\n",
-					  http->uri->path ? "" : "/",
-					  request,
-					  ( user ?
-					    "Authorization: Basic " : "" ),
-					  ( user ? user_pw_base64 : "" ),
-					  ( user ? "\r\n" : "" ),
-					  host ) ) != 0 ) {
-			http_done ( http, rc );
+	if ( ! xfer_window ( &conn->socket ) )
+		return;
+
+	list_for_each_entry ( http, &conn->requests, list ) {
+		if ( ! ( http->flags & HTTP_TX_SENT ) ) {
+			if ( ( rc = http_send ( http ) ) != 0 )
+				http_conn_close ( conn, rc );
+			return;
 		}
 	}
+
+	/* Everything has been sent */
+	process_del ( &conn->process );
 }
 
 /**
@@ -476,13 +1235,13 @@ static void http_step ( struct process *process ) {
  * @v rc		Reason for close
  */
 static void http_socket_close ( struct xfer_interface *socket, int rc ) {
-	struct http_request *http =
-		container_of ( socket, struct http_request, socket );
+	struct http_connection *conn =
+		container_of ( socket, struct http_connection, socket );
 
-	DBGC ( http, "HTTP %p socket closed: %s\n",
-	       http, strerror ( rc ) );
-	
-	http_done ( http, rc );
+	DBGC ( conn, "HTTP %p socket closed: %s\n",
+	       conn, strerror ( rc ) );
+
+	http_conn_close ( conn, rc );
 }
 
 /** HTTP socket operations */
@@ -508,7 +1267,15 @@ static void http_xfer_close ( struct xfer_interface *xfer, int rc ) {
 	DBGC ( http, "HTTP %p interface closed: %s\n",
 	       http, strerror ( rc ) );
 
-	http_done ( http, rc );
+	http_finish ( http, rc );
+
+	/* A request which hasn't been sent can simply be dropped.
+	 * Otherwise, its response is still on its way, and the
+	 * connection will be dropped once it gets to it, unless
+	 * little of the response remains.
+	 */
+	if ( http->conn && ! ( http->flags & HTTP_TX_SENT ) )
+		http_done ( http, rc );
 }
 
 /** HTTP data transfer interface operations */
@@ -521,6 +1288,116 @@ static struct xfer_interface_operations http_xfer_operations = {
 	.deliver_raw	= ignore_xfer_deliver_raw,
 };
 
+/**
+ * Find a pooled HTTP connection which can take another request
+ *
+ * @v http		HTTP request
+ * @ret conn		HTTP connection, or NULL
+ */
+static struct http_connection * http_conn_find ( struct http_request *http ) {
+	struct http_connection *conn;
+
+	list_for_each_entry ( conn, &http_connections, list ) {
+		if ( ( conn->port != http->port ) ||
+		     ( conn->filter != http->filter ) ||
+		     ( strcasecmp ( conn->host, http->uri->host ) != 0 ) )
+			continue;
+		if ( ! ( conn->flags & HTTP_CONN_KEEPALIVE ) )
+			continue;
+		if ( http_conn_abandoned ( conn ) )
+			continue;
+		if ( list_empty ( &conn->requests ) )
+			return conn;
+		if ( ( conn->flags & HTTP_CONN_PIPELINE ) &&
+		     ( conn->pending < HTTP_MAX_PIPELINE ) )
+			return conn;
+	}
+	return NULL;
+}
+
+/**
+ * Open new HTTP connection
+ *
+ * @v http		HTTP request
+ * @ret conn		HTTP connection, or NULL
+ * @ret rc		Return status code
+ *
+ * The connection is kept alive by its socket.
+ */
+static int http_conn_open ( struct http_request *http,
+			    struct http_connection **conn ) {
+	struct http_connection *new;
+	struct sockaddr_tcpip server;
+	struct xfer_interface *socket;
+	int rc;
+
+	/* Allocate and populate HTTP connection structure */
+	new = zalloc ( sizeof ( *new ) );
+	if ( ! new )
+		return -ENOMEM;
+	new->refcnt.free = http_conn_free;
+	xfer_init ( &new->socket, &http_socket_operations, &new->refcnt );
+	process_init_stopped ( &new->process, http_conn_step,
+			       &new->refcnt );
+	INIT_LIST_HEAD ( &new->requests );
+	new->port = http->port;
+	new->filter = http->filter;
+	new->host = strdup ( http->uri->host );
+	if ( ! new->host ) {
+		rc = -ENOMEM;
+		goto err;
+	}
+
+	/* Open socket */
+	memset ( &server, 0, sizeof ( server ) );
+	server.st_port = htons ( new->port );
+	socket = &new->socket;
+	if ( new->filter ) {
+		if ( ( rc = new->filter ( socket, &socket ) ) != 0 )
+			goto err;
+	}
+	if ( ( rc = xfer_open_named_socket ( socket, SOCK_STREAM,
+					     ( struct sockaddr * ) &server,
+					     new->host, NULL ) ) != 0 )
+		goto err;
+
+	/* Add to pool, mortalise self, and return */
+	DBGC ( new, "HTTP %p connecting to %s:%d\n",
+	       new, new->host, new->port );
+	list_add ( &new->list, &http_connections );
+	*conn = new;
+	ref_put ( &new->refcnt );
+	return 0;
+
+ err:
+	DBGC ( new, "HTTP %p could not connect: %s\n", new, strerror ( rc ) );
+	xfer_nullify ( &new->socket );
+	xfer_close ( &new->socket, rc );
+	ref_put ( &new->refcnt );
+	return rc;
+}
+
+/**
+ * Queue HTTP request on a connection
+ *
+ * @v http		HTTP request
+ * @v reuse		Allow use of an existing connection
+ * @ret rc		Return status code
+ */
+static int http_connect ( struct http_request *http, int reuse ) {
+	struct http_connection *conn = NULL;
+	int rc;
+
+	if ( reuse )
+		conn = http_conn_find ( http );
+	if ( ! conn ) {
+		if ( ( rc = http_conn_open ( http, &conn ) ) != 0 )
+			return rc;
+	}
+	http_attach ( http, conn );
+	return 0;
+}
+
 /**
  * Initiate an HTTP connection, with optional filter
  *
@@ -535,8 +1412,6 @@ int http_open_filter ( struct xfer_interface *xfer, struct uri *uri,
 		       int ( * filter ) ( struct xfer_interface *xfer,
 					  struct xfer_interface **next ) ) {
 	struct http_request *http;
-	struct sockaddr_tcpip server;
-	struct xfer_interface *socket;
 	int rc;
 
 	/* Sanity checks */
@@ -550,20 +1425,11 @@ int http_open_filter ( struct xfer_interface *xfer, struct uri *uri,
 	http->refcnt.free = http_free;
 	xfer_init ( &http->xfer, &http_xfer_operations, &http->refcnt );
        	http->uri = uri_get ( uri );
-	xfer_init ( &http->socket, &http_socket_operations, &http->refcnt );
-	process_init ( &http->process, http_step, &http->refcnt );
+	http->port = uri_port ( http->uri, default_port );
+	http->filter = filter;
 
-	/* Open socket */
-	memset ( &server, 0, sizeof ( server ) );
-	server.st_port = htons ( uri_port ( http->uri, default_port ) );
-	socket = &http->socket;
-	if ( filter ) {
-		if ( ( rc = filter ( socket, &socket ) ) != 0 )
-			goto err;
-	}
-	if ( ( rc = xfer_open_named_socket ( socket, SOCK_STREAM,
-					     ( struct sockaddr * ) &server,
-					     uri->host, NULL ) ) != 0 )
+	/* Queue request on a new or pooled connection */
+	if ( ( rc = http_connect ( http, 1 ) ) != 0 )
 		goto err;
 
 	/* Attach to parent interface, mortalise self, and return */
@@ -595,3 +1461,23 @@ struct uri_opener http_uri_opener __uri_opener = {
 	.scheme	= "http",
 	.open	= http_open,
 };
+
+/**
+ * Close idle HTTP connections
+ *
+ * @v flags		Shutdown flags
+ */
+static void http_shutdown ( int flags __unused ) {
+	struct http_connection *conn;
+	struct http_connection *tmp;
+
+	list_for_each_entry_safe ( conn, tmp, &http_connections, list ) {
+		if ( list_empty ( &conn->requests ) )
+			http_conn_close ( conn, 0 );
+	}
+}
+
+/** HTTP shutdown function */
+struct startup_fn http_startup_fn __startup_fn ( STARTUP_LATE ) = {
+	.shutdown = http_shutdown,
+};